@@ -0,0 +1,280 @@
+/* calibrate.c -- measure how long the operations find relies on take.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The optimiser normally ranks tests by the coarse classes of
+ * enum EvaluationCost, which treat a stat call as costing the same
+ * whether the answer comes from the page cache or from a file server
+ * on the other side of the world.  With -calibrate, before the search
+ * starts we time a few calls to stat, readlink and access on the
+ * entries of each starting point, and each -regex test against their
+ * names, and the optimiser then compares the tests by their estimated
+ * cost in nanoseconds instead; see get_calibrated_costs.
+ *
+ * Where there are several starting points we go by the slowest
+ * filesystem.  With -profile, the figures for each filesystem are
+ * remembered in the profile, and are only measured again if they are
+ * missing from it.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xalloc.h"
+#include "dirent-safer.h"
+#include "intprops.h"
+#include "timespec.h"
+#include "defs.h"
+
+enum
+  {
+    /* The number of directory entries we time each operation on. */
+    CalibrationSamples = 32,
+
+    /* The number of times we apply each -regex test to them. */
+    RegexRounds = 8
+  };
+
+static struct calibrated_costs costs;
+static bool calibrated = false;
+
+/* The names of the figures we keep in the profile for each filesystem. */
+static const char *const cost_keys[] =
+  {
+    "@stat", "@readlink", "@access"
+  };
+
+
+static uintmax_t
+nsec_since (struct timespec before)
+{
+  struct timespec after;
+
+  gettime (&after);
+  /* Ignore the clock going backwards. */
+  if (timespec_cmp (after, before) <= 0)
+    return 0u;
+  return ((uintmax_t) (after.tv_sec - before.tv_sec) * 1000000000u
+	  + after.tv_nsec - before.tv_nsec);
+}
+
+/* Read up to CalibrationSamples names from DIR into NAMES, and return
+ * how many we found.  The caller frees them.
+ */
+static size_t
+read_samples (DIR *dir, char **names)
+{
+  struct dirent *dp;
+  size_t n = 0u;
+
+  while (n < CalibrationSamples && NULL != (dp = readdir (dir)))
+    {
+      if (0 == strcmp (dp->d_name, ".") || 0 == strcmp (dp->d_name, ".."))
+	continue;
+      names[n++] = xstrdup (dp->d_name);
+    }
+  return n;
+}
+
+/* Time stat, readlink and access on the entries of the directory
+ * PATH, setting RESULT[i] to the total time for cost_keys[i].  Return
+ * the number of entries we used.
+ */
+static size_t
+time_operations (const char *path, uintmax_t result[3])
+{
+  char *names[CalibrationSamples];
+  char buf[1];
+  struct stat st;
+  struct timespec start;
+  DIR *dir = opendir_safer (path);
+  size_t i, n;
+  int fd, flags;
+
+  if (NULL == dir)
+    return 0u;
+  fd = dirfd (dir);
+  /* Stat the entries as the search will. */
+  flags = (options.symlink_handling == SYMLINK_ALWAYS_DEREF
+	   ? 0 : AT_SYMLINK_NOFOLLOW);
+  n = read_samples (dir, names);
+
+  result[0] = result[1] = result[2] = 0u;
+  for (i = 0; i < n; ++i)
+    {
+      gettime (&start);
+      fstatat (fd, names[i], &st, flags);
+      result[0] += nsec_since (start);
+
+      gettime (&start);
+      readlinkat (fd, names[i], buf, sizeof buf);
+      result[1] += nsec_since (start);
+
+      gettime (&start);
+      faccessat (fd, names[i], R_OK, 0);
+      result[2] += nsec_since (start);
+
+      free (names[i]);
+    }
+  closedir (dir);
+  return n;
+}
+
+/* Work out the costs for the filesystem containing PATH, and raise
+ * the figures in COSTS to them if they are higher.
+ */
+static void
+calibrate_filesystem (const char *path)
+{
+  struct stat st;
+  uintmax_t total[3];
+  float nsec[3];
+  char *keys[3];
+  const char *fstype;
+  size_t i, samples;
+  bool cached = true;
+
+  /* Under -P, a start point which is a symbolic link is not followed,
+   * so there is no directory of ours to time.
+   */
+  if (0 != fstatat (AT_FDCWD, path, &st,
+		    options.symlink_handling == SYMLINK_NEVER_DEREF
+		    ? AT_SYMLINK_NOFOLLOW : 0))
+    return;
+
+  fstype = filesystem_type (&st, path);
+  for (i = 0; i < 3; ++i)
+    {
+      keys[i] = xmalloc (strlen (cost_keys[i]) + strlen (fstype)
+			 + INT_BUFSIZE_BOUND (uintmax_t) + 2u);
+      sprintf (keys[i], "%s %s %" PRIuMAX, cost_keys[i], fstype,
+	       (uintmax_t) st.st_dev);
+      if (!profile_get_cost (keys[i], &nsec[i]))
+	cached = false;
+    }
+
+  if (!cached)
+    {
+      samples = S_ISDIR (st.st_mode) ? time_operations (path, total) : 0u;
+      if (0u == samples)
+	{
+	  for (i = 0; i < 3; ++i)
+	    free (keys[i]);
+	  return;
+	}
+      for (i = 0; i < 3; ++i)
+	{
+	  nsec[i] = (float) total[i] / samples;
+	  profile_put_cost (keys[i], samples, total[i]);
+	}
+    }
+
+  if (options.debug_options & DebugTreeOpt)
+    fprintf (stderr, "calibration: on %s (%s), stat takes %gns, "
+	     "readlink %gns and access %gns%s\n", path, fstype,
+	     nsec[0], nsec[1], nsec[2], cached ? " (from the profile)" : "");
+
+  if (costs.stat_nsec < nsec[0])
+    costs.stat_nsec = nsec[0];
+  if (costs.readlink_nsec < nsec[1])
+    costs.readlink_nsec = nsec[1];
+  if (costs.access_nsec < nsec[2])
+    costs.access_nsec = nsec[2];
+  calibrated = true;
+
+  for (i = 0; i < 3; ++i)
+    free (keys[i]);
+}
+
+/* Time the -regex test P against the names of the entries of the
+ * directory PATH, unless we already know how long it takes.
+ */
+static void
+calibrate_regex (struct predicate *p, const char *path)
+{
+  char *names[CalibrationSamples];
+  char *full;
+  size_t i, n, len = strlen (path);
+  uintmax_t total = 0u;
+  struct timespec start;
+  DIR *dir;
+  int round;
+
+  if (p->est_nsec >= 0.0f || NULL == (dir = opendir_safer (path)))
+    return;
+  n = read_samples (dir, names);
+  closedir (dir);
+
+  for (i = 0; i < n; ++i)
+    {
+      full = xmalloc (len + 1u + strlen (names[i]) + 1u);
+      sprintf (full, "%s/%s", path, names[i]);
+      gettime (&start);
+      for (round = 0; round < RegexRounds; ++round)
+	(p->pred_func) (full, NULL, p);
+      total += nsec_since (start);
+      free (full);
+      free (names[i]);
+    }
+  if (n)
+    {
+      p->est_nsec = (float) total / (n * RegexRounds);
+      if (options.debug_options & DebugTreeOpt)
+	fprintf (stderr, "calibration: %s %s takes %gns\n",
+		 p->p_name, p->arg_text, p->est_nsec);
+    }
+}
+
+/* Measure the costs of the operations find needs on the filesystems
+ * of the N starting points in PATHS (or ".", if there are none), and
+ * of the -regex tests in the list PREDICATES against the names in the
+ * first of them.
+ */
+void
+calibrate_costs (char *const *paths, size_t n, struct predicate *predicates)
+{
+  static char *const dot[] = { "." };
+  struct predicate *p;
+  size_t i;
+
+  if (0u == n)
+    {
+      paths = dot;
+      n = 1u;
+    }
+
+  for (i = 0; i < n; ++i)
+    calibrate_filesystem (paths[i]);
+
+  for (p = predicates; p; p = p->pred_next)
+    if (pred_is (p, pred_regex))
+      calibrate_regex (p, paths[0]);
+}
+
+/* Return the costs we measured, or NULL if we did not. */
+const struct calibrated_costs *
+get_calibrated_costs (void)
+{
+  return calibrated ? &costs : NULL;
+}
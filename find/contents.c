@@ -0,0 +1,230 @@
+/* contents.c -- search the contents of files for -contains and -containsregex.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* -contains TEXT is true for regular files which contain TEXT, and
+ * -containsregex PATTERN for those with a line which PATTERN matches,
+ * so that find can do the work of "xargs grep -l" without starting
+ * any more processes or opening each file twice.
+ *
+ * We read each file in large blocks, and stop as soon as we find a
+ * match.  (We do not map files into memory, since a file which shrank
+ * while we had it mapped would kill find with SIGBUS.)  Between
+ * blocks, we keep the end of the previous block: for -contains, as
+ * many bytes as could hold the start of a match, and for
+ * -containsregex, the part of a line which the block did not finish.
+ * Fixed text is found with mem_search, which uses AVX2 where it can.
+ * Like grep, where there is some fixed text which every match of the
+ * pattern must contain, we look for that first, and only run the
+ * regex matcher on the lines which contain it.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xalloc.h"
+#include "memsearch.h"
+#include "defs.h"
+
+enum
+  {
+    /* The size of the reads we make. */
+    ReadSize = 256 * 1024,
+
+    /* We hold on to the unfinished part of a line until it gets this
+     * long, and after that treat it as a line by itself, so that a
+     * huge file without newlines does not take a huge buffer.
+     */
+    MaxLineSize = 64 * 1024 * 1024
+  };
+
+static char *buf = NULL;
+static size_t buf_size = 0u;
+
+/* Make room for ReadSize more bytes after the first KEEP in buf. */
+static void
+make_room (size_t keep)
+{
+  if (keep + ReadSize > buf_size)
+    {
+      buf_size = keep + ReadSize;
+      buf = xrealloc (buf, buf_size);
+    }
+}
+
+/* Does the line from START to END match the pattern RE somewhere after
+ * FROM?
+ */
+static bool
+line_matches (struct re_pattern_buffer *re, const char *start,
+	      const char *end, const char *from)
+{
+  return 0 <= re_search (re, start, end - start, from - start, end - from,
+			 (struct re_registers *) NULL);
+}
+
+/* Does some line among the N bytes at S match RE?  The regex matcher
+ * does not let a match run across a newline unless the pattern itself
+ * can match one, so we search all the lines at once, and only if the
+ * match we find does run across a newline look at that line again
+ * by itself.
+ */
+static bool
+lines_match (struct re_pattern_buffer *re, const char *s, size_t n)
+{
+  const char *from = s, *end = s + n;
+
+  while (from <= end)
+    {
+      const char *start, *eol;
+      int pos = re_search (re, s, n, from - s, end - from,
+			   (struct re_registers *) NULL);
+
+      if (pos < 0)
+	return false;
+      for (start = s + pos; start > s && '\n' != start[-1]; --start)
+	continue;
+      eol = memchr (s + pos, '\n', end - (s + pos));
+      if (NULL == eol)
+	eol = end;
+      if (line_matches (re, start, eol, s + pos))
+	return true;
+      from = eol + 1;
+    }
+  return false;
+}
+
+/* Does some line among the N bytes at S which contains the text in C
+ * match the pattern in C?
+ */
+static bool
+lines_with_text_match (const struct contents_val *c, const char *s, size_t n)
+{
+  const char *from = s, *end = s + n, *hit;
+
+  while (from < end && NULL != (hit = mem_search (from, end - from,
+						   c->text, c->len)))
+    {
+      const char *start, *eol;
+
+      for (start = hit; start > s && '\n' != start[-1]; --start)
+	continue;
+      eol = memchr (hit, '\n', end - hit);
+      if (NULL == eol)
+	eol = end;
+      if (line_matches (c->re, start, eol, start))
+	return true;
+      from = eol + 1;
+    }
+  return false;
+}
+
+/* Look for what C describes in the first N bytes of buf; AT_EOF says
+ * whether the file ends there.  Return true if we find it, and
+ * otherwise set *KEEP to the number of bytes at the end to keep for
+ * the next block.
+ */
+static bool
+search_block (const struct contents_val *c, size_t n, bool at_eof,
+	      size_t *keep)
+{
+  if (NULL == c->re)
+    {
+      if (mem_search (buf, n, c->text, c->len))
+	return true;
+      /* The text is not empty, or we would have found it. */
+      *keep = (c->len - 1u < n) ? c->len - 1u : n;
+    }
+  else
+    {
+      const char *eol = at_eof ? buf + n : memrchr (buf, '\n', n);
+      size_t done;
+
+      if (NULL == eol && n >= MaxLineSize)
+	eol = buf + n;
+      done = eol ? (size_t) (eol - buf) : 0u;
+      if (eol && (c->text
+		  ? lines_with_text_match (c, buf, done)
+		  : lines_match (c->re, buf, done)))
+	return true;
+      if (eol && eol < buf + n)
+	++done;			/* skip the newline */
+      *keep = n - done;
+    }
+  return false;
+}
+
+/* Is what C describes in the current file, PATHNAME, which we know to
+ * be a regular file?
+ */
+bool
+contents_match (const char *pathname, const struct contents_val *c)
+{
+  size_t keep = 0u;
+  bool found = false;
+  int fd = open_regular_file (pathname);
+
+  if (fd < 0)
+    return false;
+#if defined POSIX_FADV_SEQUENTIAL
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  for (;;)
+    {
+      size_t n;
+      ssize_t got;
+
+      make_room (keep);
+      got = read (fd, buf + keep, ReadSize);
+      if (got < 0)
+	{
+	  if (EINTR == errno)
+	    continue;
+	  nonfatal_target_file_error (errno, pathname);
+	  break;
+	}
+      /* Like grep, we take a file to be binary if we come across a
+       * null byte before we find a match.
+       */
+      if (c->nobinary && memchr (buf + keep, '\0', got))
+	break;
+      n = keep + got;
+      if (0 == got)
+	{
+	  /* All a pattern has left to look at is the last line, if the
+	   * file does not end with a newline.
+	   */
+	  if (c->re && keep)
+	    found = search_block (c, n, true, &keep);
+	  break;
+	}
+      if (search_block (c, n, false, &keep))
+	{
+	  found = true;
+	  break;
+	}
+      memmove (buf, buf + n - keep, keep);
+    }
+  close (fd);
+  return found;
+}
@@ -45,6 +45,7 @@ Please stop compiling the program now
 #include <unistd.h>
 #include <time.h>
 #include <limits.h>		/* for CHAR_BIT */
+#include <dirent.h>		/* for DIR */
 #include <stdbool.h>		/* for bool */
 #include <stdint.h>		/* for uintmax_t */
 #include <sys/stat.h> /* S_ISUID etc. */
@@ -196,6 +197,54 @@ struct exec_val
   int last_child_status;	/* Status of the most recent child. */
 };
 
+/* The forms of shell pattern which we can match without calling
+   fnmatch; see glob_compile.  */
+enum glob_kind
+  {
+    GLOB_FNMATCH,		/* anything else */
+    GLOB_LITERAL,		/* "abc" */
+    GLOB_PREFIX,		/* "abc*" */
+    GLOB_SUFFIX,		/* "*abc" */
+    GLOB_CONTAINS		/* "*abc*" */
+  };
+
+struct glob_val
+{
+  const char *pattern;		/* as given */
+  enum glob_kind kind;
+  char *literal;		/* the fixed text, case folded if need be */
+  size_t len;			/* its length */
+  bool casefold;
+  bool fold_ascii_only;		/* use fnmatch for non-ASCII names */
+};
+
+/* A -regex or -iregex pattern.  Any path it matches must also match
+   each of FILTERS, which are much cheaper to check; see
+   find_regex_filters.  */
+enum
+  {
+    MaxRegexFilters = 3		/* a prefix, a suffix and a substring */
+  };
+
+struct regex_val
+{
+  struct re_pattern_buffer *re;
+  struct glob_val filters[MaxRegexFilters];
+  int n_filters;
+};
+
+/* A -contains or -containsregex test; see contents.c.  */
+struct contents_val
+{
+  const char *text;		/* the text to look for, or for
+				   -containsregex, text every match
+				   contains (if we know any) */
+  size_t len;
+  struct re_pattern_buffer *re;	/* -containsregex: the pattern */
+  uintmax_t limit;		/* larger files never match */
+  bool nobinary;		/* files which look binary never match */
+};
+
 /* The format string for a -printf or -fprintf is chopped into one or
    more `struct segment', linked together into a list.
    Each stretch of plain text is a segment, and
@@ -218,22 +267,66 @@ struct segment
   struct segment *next;		/* Next segment for this predicate. */
 };
 
+/* A step of a compiled -printf format; see compile_format in pred.c. */
+struct format_op;
+
 struct format_val
 {
   struct segment *segment;	/* Linked list of segments. */
+  struct format_op *ops;	/* The segments compiled, or NULL. */
+  size_t n_ops;			/* Number of elements of `ops'. */
   FILE *stream;			/* Output stream to print on. */
   const char *filename;		/* We need the filename for error messages. */
   bool dest_is_tty;		/* True if the destination is a terminal. */
   struct quoting_options *quote_opts;
 };
 
+struct du_tally;
+struct du_val
+{
+  struct format_val dest;	/* where the totals go */
+  bool apparent_size;		/* add up st_size, not st_blocks */
+  struct du_tally *tally;	/* the totals so far; see du.c */
+};
+
+struct report;
+struct dupes;
+struct report_val
+{
+  struct format_val dest;	/* where the report goes */
+  struct report *report;	/* see report.c */
+};
+
 /* Profiling information for a predicate */
 struct predicate_performance_info
 {
   unsigned long visits;
   unsigned long successes;
+  uintmax_t nsec;		/* time spent, with -profile */
 };
 
+/* The members of struct stat that a predicate looks at.  We use
+ * these to ask the system for just the information we need, which
+ * can be a lot cheaper on network filesystems.  The values are the
+ * same as those of the Linux STATX_* constants.
+ */
+enum StatFields
+  {
+    StatFieldType   = 0x0001,	/* the S_IFMT part of st_mode */
+    StatFieldMode   = 0x0002,	/* the rest of st_mode */
+    StatFieldNlink  = 0x0004,
+    StatFieldUid    = 0x0008,
+    StatFieldGid    = 0x0010,
+    StatFieldAtime  = 0x0020,
+    StatFieldMtime  = 0x0040,
+    StatFieldCtime  = 0x0080,
+    StatFieldIno    = 0x0100,
+    StatFieldSize   = 0x0200,
+    StatFieldBlocks = 0x0400,
+    StatFieldBtime  = 0x0800,
+    StatFieldAll    = 0x0fff
+  };
+
 /* evaluation cost of a predicate */
 enum EvaluationCost
 {
@@ -244,6 +337,7 @@ enum EvaluationCost
   NeedsLinkName,
   NeedsAccessInfo,
   NeedsSyncDiskHit,
+  NeedsFileContents,
   NeedsEventualExec,
   NeedsImmediateExec,
   NeedsUserInteraction,
@@ -285,11 +379,30 @@ struct predicate
   /* True if this predicate node requires knowledge of the inode number. */
   bool need_inum;
 
+  /* If need_stat is set, which parts of struct stat we need (a mask
+     of values from enum StatFields). */
+  unsigned int stat_fields;
+
   enum EvaluationCost p_cost;
 
   /* est_success_rate is a number between 0.0 and 1.0 */
   float est_success_rate;
 
+  /* The mean number of nanoseconds each evaluation of this predicate
+     took in earlier runs, or negative if we don't know (see
+     profile.c).  */
+  float est_nsec;
+
+  /* The estimated cost in nanoseconds of evaluating this predicate,
+     including fetching any information it needs, or negative if we
+     have not measured the costs of doing that (see calibrate.c).  */
+  float est_cost;
+
+  /* The slot in which the result of this subtree for the current file
+     is remembered, or -1 if it occurs only once in the expression (see
+     simplify.c).  */
+  int memo;
+
   /* True if this predicate should display control characters literally */
   bool literal_control_chars;
 
@@ -303,8 +416,12 @@ struct predicate
      Next to each member are listed the predicates that use it. */
   union
   {
-    const char *str;		/* fstype [i]lname [i]name [i]path */
-    struct re_pattern_buffer *regex; /* regex */
+    const char *str;		/* fstype [i]lname */
+    struct glob_val glob;	/* [i]name [i]path [i]lname */
+    struct regex_val regex;	/* regex */
+    struct contents_val contents; /* contains containsregex */
+    struct du_val du;		/* du */
+    struct report_val report;	/* top histogram duplicates */
     struct exec_val exec_vec;	/* exec ok */
     struct long_val numinfo;	/* gid inum links  uid */
     struct size_val size;	/* size */
@@ -316,6 +433,7 @@ struct predicate
     mode_t type;		/* type */
     struct format_val printf_vec; /* printf fprintf fprint ls fls print0 fprint0 print */
     security_context_t scontext; /* security context */
+    struct name_set *nameset;	/* name_set path_set */
   } args;
 
   /* The next predicate in the user input sequence,
@@ -334,6 +452,14 @@ struct predicate
   const struct parser_table* parser_entry;
 };
 
+/* What run_program_batch found out about one file. */
+struct batch_result
+{
+  unsigned long generation;	/* of the program it applies to */
+  int passed;			/* the number of tests it passed */
+  bool failed;			/* true if it failed the next one */
+};
+
 /* find.c, ftsfind.c */
 bool is_fts_enabled(int *ftsoptions);
 
@@ -356,6 +482,122 @@ extern enum SymlinkOption symlink_handling; /* defined in find.c. */
 void set_follow_state (enum SymlinkOption opt);
 void cleanup(void);
 
+/* prefetch.c */
+void prefetch_start (const char *pathname, int nthreads);
+void prefetch_stop (void);
+
+/* statbatch.c */
+struct _ftsent;
+void statbatch_begin_dir (int cwd_fd, struct _ftsent *dir,
+			  struct _ftsent *children);
+bool statbatch_lookup (const struct _ftsent *ent, struct stat *p);
+void statbatch_stop (void);
+
+/* evalbatch.c */
+void evalbatch_start (int base_level);
+void evalbatch_dir (struct _ftsent *dir, struct _ftsent *entries);
+const struct batch_result *evalbatch_lookup (const struct _ftsent *ent);
+void evalbatch_stop (void);
+
+/* snapshot.c */
+void snapshot_start (const char *filename);
+struct dirent *snapshot_readdir (struct _ftsent *dir, DIR *dirp);
+void snapshot_stop (void);
+
+/* watch.c */
+typedef bool (*watch_scan_fn) (char *path, int level,
+			       int starting_path_length,
+			       const struct timespec *since);
+void watch_start (void);
+void watch_dir (const char *path, int level, int starting_path_length);
+void watch_note_dir (const struct stat *st, bool pruned);
+bool watch_dir_pruned (const struct stat *st);
+void watch_loop (watch_scan_fn scan);
+
+/* program.c */
+void compile_expression (struct predicate *eval_tree);
+bool expression_is_compiled (void);
+bool run_program (const char *pathname, struct stat *stat_buf);
+int program_batch_length (bool *needs_path);
+void run_program_batch (const char *const *names, const mode_t *modes,
+			size_t n, struct batch_result *results);
+void count_batch_result (const struct batch_result *r);
+bool run_program_after_batch (const char *pathname, struct stat *stat_buf,
+			      const struct batch_result *r);
+void update_tree_perf (struct predicate *eval_tree);
+void print_program (FILE *fp);
+
+/* nameset.c */
+struct name_set;
+struct name_set *name_set_create (bool casefold);
+void name_set_add (struct name_set *set, const char *pattern);
+bool name_set_match (const struct name_set *set, const char *name);
+bool locale_is_bytewise (void);
+void glob_compile (struct glob_val *g, const char *pattern, bool casefold);
+bool glob_match (const struct glob_val *g, const char *name);
+bool glob_may_match_below (const struct glob_val *g, const char *dir);
+bool name_set_may_match_below (const struct name_set *set, const char *dir);
+
+/* profile.c */
+void profile_start (const char *filename, struct predicate *predicates);
+bool profile_call (const char *pathname, struct stat *stat_buf,
+		   struct predicate *p, uintmax_t *nsec);
+void profile_stop (void);
+bool profile_get_cost (const char *key, float *nsec);
+void profile_put_cost (const char *key, uintmax_t samples, uintmax_t nsec);
+
+/* calibrate.c */
+struct calibrated_costs
+{
+  float stat_nsec;		/* the mean time each operation took */
+  float readlink_nsec;
+  float access_nsec;
+};
+void calibrate_costs (char *const *paths, size_t n,
+		      struct predicate *predicates);
+const struct calibrated_costs *get_calibrated_costs (void);
+
+/* contents.c */
+bool contents_match (const char *pathname, const struct contents_val *c);
+
+/* du.c */
+void du_new (struct du_val *du);
+void du_begin (void);
+void du_arrive (const char *pathname, int depth, bool is_dir);
+void du_leave (int depth);
+void du_end (void);
+void du_add (struct du_val *du, const char *pathname, const struct stat *st,
+	     uintmax_t bytes);
+void du_stop (void);
+
+/* dupes.c */
+struct dupes *dupes_new (void);
+void dupes_add (struct dupes *d, const char *pathname, const struct stat *st);
+void dupes_print (struct dupes *d, const struct format_val *dest);
+
+/* report.c */
+bool report_new_top (struct report_val *val, uintmax_t n, const char *field);
+bool report_new_histogram (struct report_val *val, const char *fields);
+void report_new_duplicates (struct report_val *val);
+void report_add (struct report_val *val, const char *pathname,
+		 const struct stat *st);
+void report_finish (void);
+
+/* simplify.c */
+void simplify_expression (struct predicate **treep);
+bool memo_recall (int slot, bool *result);
+void memo_store (int slot, bool result);
+void memo_forget (void);
+
+/* digest.c */
+int digest_now (int fd, char *hex);
+void digest_output (struct format_val *dest, const char *text, size_t len,
+		    const size_t *holes, size_t n_holes,
+		    int fd, const char *pathname, bool whole);
+bool digest_pending (void);
+void digest_sync (void);
+void digest_stop (void);
+
 /* fstype.c */
 char *filesystem_type (const struct stat *statp, const char *path);
 char * get_mounted_filesystems (void);
@@ -408,8 +650,11 @@ PREDICATEFUNCTION pred_closeparen;
 PREDICATEFUNCTION pred_cmin;
 PREDICATEFUNCTION pred_cnewer;
 PREDICATEFUNCTION pred_comma;
+PREDICATEFUNCTION pred_contains;
 PREDICATEFUNCTION pred_ctime;
 PREDICATEFUNCTION pred_delete;
+PREDICATEFUNCTION pred_du;
+PREDICATEFUNCTION pred_duplicates;
 PREDICATEFUNCTION pred_empty;
 PREDICATEFUNCTION pred_exec;
 PREDICATEFUNCTION pred_execdir;
@@ -420,6 +665,7 @@ PREDICATEFUNCTION pred_fprint;
 PREDICATEFUNCTION pred_fprint0;
 PREDICATEFUNCTION pred_fprintf;
 PREDICATEFUNCTION pred_fstype;
+PREDICATEFUNCTION pred_histogram;
 PREDICATEFUNCTION pred_gid;
 PREDICATEFUNCTION pred_group;
 PREDICATEFUNCTION pred_ilname;
@@ -432,6 +678,7 @@ PREDICATEFUNCTION pred_ls;
 PREDICATEFUNCTION pred_mmin;
 PREDICATEFUNCTION pred_mtime;
 PREDICATEFUNCTION pred_name;
+PREDICATEFUNCTION pred_name_set;
 PREDICATEFUNCTION pred_negate;
 PREDICATEFUNCTION pred_newer;
 PREDICATEFUNCTION pred_newerXY;
@@ -442,6 +689,7 @@ PREDICATEFUNCTION pred_okdir;
 PREDICATEFUNCTION pred_openparen;
 PREDICATEFUNCTION pred_or;
 PREDICATEFUNCTION pred_path;
+PREDICATEFUNCTION pred_path_set;
 PREDICATEFUNCTION pred_perm;
 PREDICATEFUNCTION pred_print;
 PREDICATEFUNCTION pred_print0;
@@ -450,7 +698,9 @@ PREDICATEFUNCTION pred_quit;
 PREDICATEFUNCTION pred_readable;
 PREDICATEFUNCTION pred_regex;
 PREDICATEFUNCTION pred_samefile;
+PREDICATEFUNCTION pred_sha256sum;
 PREDICATEFUNCTION pred_size;
+PREDICATEFUNCTION pred_top;
 PREDICATEFUNCTION pred_true;
 PREDICATEFUNCTION pred_type;
 PREDICATEFUNCTION pred_uid;
@@ -466,10 +716,12 @@ int launch (struct buildcmd_control *ctl, void *usercontext, int argc, char **ar
 
 
 char *find_pred_name (PRED_FUNC pred_func);
+char *mode_to_filetype (mode_t m);
 
 
 
 void print_predicate (FILE *fp, const struct predicate *p);
+void compile_format (struct format_val *dest);
 void print_tree (FILE*, struct predicate *node, int indent);
 void print_list (FILE*, struct predicate *node);
 void print_optlist (FILE *fp, const struct predicate *node);
@@ -485,6 +737,11 @@ struct predicate *get_new_pred (const struct parser_table *entry);
 struct predicate *get_new_pred_chk_op (const struct parser_table *entry,
 					      const char *arg);
 float  calculate_derived_rates (struct predicate *p);
+unsigned int stat_fields_needed (const struct predicate *p);
+bool expression_needs_stat (const struct predicate *pred);
+void adapt_expression (void);
+bool subtree_may_match (const char *dir);
+bool subtree_has_side_effects (const struct predicate *p);
 
 /* util.c */
 bool fd_leak_check_is_enabled (void);
@@ -498,6 +755,13 @@ void complete_pending_execdirs (void);
 const char *safely_quote_err_filename (int n, char const *arg);
 void record_initial_cwd (void);
 bool is_exec_in_local_dir(const PRED_FUNC pred_func);
+int find_fstatat (int fd, const char *name, struct stat *p, int flags);
+int open_regular_file (const char *pathname);
+bool replace_file (const char *filename, const char *mode,
+		   bool (*write_contents) (FILE *fp, void *data), void *data);
+#if defined STATX_TYPE
+void statx_to_stat (const struct statx *stx, struct stat *p);
+#endif
 
 void fatal_target_file_error (int errno_value, const char *name) ATTRIBUTE_NORETURN;
 void fatal_nontarget_file_error (int errno_value, const char *name) ATTRIBUTE_NORETURN;
@@ -515,6 +779,9 @@ void error_severity (int level);
 #else
 bool apply_predicate(const char *pathname, struct stat *stat_buf, struct predicate *p);
 #endif
+bool apply_expression (const char *pathname, struct stat *stat_buf);
+bool apply_expression_after_batch (const char *pathname, struct stat *stat_buf,
+				   const struct batch_result *r);
 
 #define pred_is(node, fn) ( ((node)->pred_func) == (fn) )
 
@@ -536,7 +803,9 @@ enum DebugOption
     DebugTreeOpt          = 8,
     DebugHelp             = 16,
     DebugExec             = 32,
-    DebugSuccessRates     = 64
+    DebugSuccessRates     = 64,
+    DebugProgram          = 128,
+    DebugInterpret        = 256
   };
 
 struct options
@@ -612,6 +881,20 @@ struct options
    */
   int regex_options;
 
+  /* Files larger than this many bytes never match -contains or
+   * -containsregex, and if nobinary_contents is true, neither do files
+   * which look binary.  These are set by the positional options
+   * -contents_limit and -contents_nobinary.
+   */
+  uintmax_t contents_limit;
+  bool nobinary_contents;
+
+  /* -du adds up the apparent sizes of files rather than the space they
+   * use if this is true; it is set by the positional option
+   * -du_apparent_size.
+   */
+  bool du_apparent_size;
+
   /* function used to get file context */
   int (*x_getfilecon) (int, const char *, security_context_t *);
 
@@ -623,6 +906,66 @@ struct options
   /* How should we quote filenames in error messages and so forth?
    */
   enum quoting_style err_quoting_style;
+
+  /* The number of threads to use (-threads).  One means that the
+   * main thread does all the work.  Extra threads only read directory
+   * metadata ahead of the main thread; see prefetch.c.
+   */
+  int threads;
+
+  /* The parts of struct stat that we actually need (a mask of values
+   * from enum StatFields).  This is worked out from the expression.
+   */
+  unsigned int stat_fields;
+
+  /* If true, accept whatever file attributes the system has cached,
+   * rather than having network filesystems revalidate them (-cached_stat).
+   */
+  bool stat_dont_sync;
+
+  /* If true, stat the contents of each directory in a batch as soon
+   * as we enter it (-batch_stat); see statbatch.c.
+   */
+  bool batch_stat;
+
+  /* If true, apply the tests at the start of the expression which
+   * only need the names and types of files to all the entries of each
+   * directory at once (-batch_eval); see evalbatch.c.
+   */
+  bool batch_eval;
+
+  /* If true, visit the entries of each directory in order of inode
+   * number (-inode_order).
+   */
+  bool inode_order;
+
+  /* Directories with more entries than this are read and processed
+   * in batches of this many entries at a time (-readdir_batch), so
+   * that memory use stays bounded.
+   */
+  size_t readdir_batch;
+
+  /* If not NULL, the file in which we remember the contents of
+   * directories from one run to the next (-snapshot); see snapshot.c.
+   */
+  const char *snapshot_file;
+
+  /* If not NULL, the file in which we keep the success rates and
+   * costs of predicates from one run to the next (-profile); see
+   * profile.c.
+   */
+  const char *profile_file;
+
+  /* If true, measure how long stat and other operations take on the
+   * filesystems being searched, and optimise accordingly (-calibrate);
+   * see calibrate.c.
+   */
+  bool calibrate;
+
+  /* If true, keep watching for new and changed files once the search
+   * is complete (-watch); see watch.c.
+   */
+  bool watch;
 };
 extern struct options options;
 
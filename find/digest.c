@@ -0,0 +1,444 @@
+/* digest.c -- checksum file contents for -printf %x and -sha256sum.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The -printf directive %x prints the SHA-256 digest of a regular
+ * file's contents, and -sha256sum prints it in the same format as the
+ * sha256sum program.  Rather than make the search wait while each
+ * file is read, the main thread opens the file and hands it to a pool
+ * of threads which read and hash it, and carries on with the search.
+ *
+ * The output for the file cannot be written until its digest is
+ * known, so it waits in a queue of records, together with any other
+ * -printf output which comes after it, and the records are written
+ * out in order as their digests become available.  At most
+ * MaxPendingRecords records wait at any time.  Anything else which
+ * writes to an output stream or runs a command calls digest_sync
+ * first, so that the order of the output is the same as it would have
+ * been had each file been hashed when it was found.  If find exits
+ * with a fatal error, an atexit handler writes out whatever is still
+ * waiting, as it would have been written had we not queued it.
+ *
+ * Without threads, we hash each file in the main thread.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
+
+#include "xalloc.h"
+#include "sha256.h"
+#include "defs.h"
+
+enum
+  {
+    /* The size of the reads we make. */
+    ReadSize = 1024 * 1024,
+
+    /* The number of records which may wait for their digests. */
+    MaxPendingRecords = 64,
+
+    /* The most threads we use if the user did not specify -threads. */
+    MaxDefaultThreads = 8
+  };
+
+struct digest_record
+{
+  struct format_val *dest;	/* where the output goes */
+  char *text;			/* the output */
+  size_t len;
+  size_t *holes;		/* where in text the digest goes */
+  size_t n_holes;
+
+  int fd;			/* the file to hash, or -1 */
+  char *pathname;		/* its name, for error messages */
+  bool whole;			/* write nothing if it can't be read */
+  bool done;			/* the digest is ready */
+  int err;			/* errno value, or 0 for success */
+  char hex[SHA256_HEX_SIZE];
+  uintmax_t size;		/* the number of bytes we read */
+
+  struct digest_record *next;	/* the following output */
+  struct digest_record *next_queued; /* for the thread pool's queue */
+};
+
+/* The records waiting to be written, oldest first. */
+static struct digest_record *oldest = NULL, *newest = NULL;
+static size_t n_pending = 0u;
+
+/* Statistics, for -D stat. */
+static uintmax_t files_hashed, bytes_hashed, waits;
+
+/* Whether digest_sync is registered with atexit. */
+static bool sync_at_exit = false;
+
+
+/* Hash the contents of FD into REC->hex, and close it. */
+static void
+hash_file (struct digest_record *rec, char *buf)
+{
+  struct sha256_state s;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  uintmax_t total = 0u;
+  ssize_t n;
+
+#if defined POSIX_FADV_SEQUENTIAL
+  posix_fadvise (rec->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  sha256_start (&s);
+  rec->err = 0;
+  while (0 != (n = read (rec->fd, buf, ReadSize)))
+    {
+      if (n < 0)
+	{
+	  if (EINTR == errno)
+	    continue;
+	  rec->err = errno;
+	  break;
+	}
+      sha256_add (&s, buf, n);
+      total += n;
+    }
+  sha256_end (&s, digest);
+  sha256_hex (digest, rec->hex);
+  rec->size = total;
+  close (rec->fd);
+  rec->fd = -1;
+}
+
+
+#if USE_POSIX_THREADS
+
+static pthread_t *pool = NULL;
+static unsigned int pool_size = 0u;
+static bool tried_pool = false;
+
+/* Protects queue_head, queue_tail, pool_stopping, and the done, err
+ * and hex fields of each record.
+ */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct digest_record *queue_head = NULL, *queue_tail = NULL;
+static bool pool_stopping = false;
+
+static void *
+pool_main (void *arg)
+{
+  char *buf = xmalloc (ReadSize);
+  (void) arg;
+
+  for (;;)
+    {
+      struct digest_record *rec;
+
+      pthread_mutex_lock (&queue_lock);
+      while (NULL == queue_head && !pool_stopping)
+	pthread_cond_wait (&queue_cond, &queue_lock);
+      rec = queue_head;
+      if (NULL == rec)
+	{
+	  /* We have been asked to stop and there is nothing left. */
+	  pthread_mutex_unlock (&queue_lock);
+	  break;
+	}
+      queue_head = rec->next_queued;
+      if (NULL == queue_head)
+	queue_tail = NULL;
+      pthread_mutex_unlock (&queue_lock);
+
+      hash_file (rec, buf);
+
+      pthread_mutex_lock (&queue_lock);
+      rec->done = true;
+      pthread_cond_broadcast (&done_cond);
+      pthread_mutex_unlock (&queue_lock);
+    }
+  free (buf);
+  return NULL;
+}
+
+static void
+pool_setup (void)
+{
+  unsigned int i, n;
+
+  if (options.threads > 1)
+    {
+      n = options.threads - 1;
+    }
+  else
+    {
+      long int cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      n = cpus < 1 ? 1 : cpus > MaxDefaultThreads ? MaxDefaultThreads : cpus;
+    }
+  pool = xnmalloc (n, sizeof *pool);
+  pool_stopping = false;
+  for (i = 0; i < n; ++i)
+    {
+      if (0 != pthread_create (&pool[i], NULL, pool_main, NULL))
+	break;			/* Carry on with however many we have. */
+    }
+  pool_size = i;
+  if (0 == pool_size)
+    {
+      free (pool);
+      pool = NULL;
+    }
+}
+
+static void
+pool_teardown (void)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&queue_lock);
+  pool_stopping = true;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+  for (i = 0; i < pool_size; ++i)
+    pthread_join (pool[i], NULL);
+  free (pool);
+  pool = NULL;
+  pool_size = 0u;
+}
+
+static void
+pool_queue (struct digest_record *rec)
+{
+  rec->next_queued = NULL;
+  pthread_mutex_lock (&queue_lock);
+  if (queue_tail)
+    queue_tail->next_queued = rec;
+  else
+    queue_head = rec;
+  queue_tail = rec;
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+static bool
+pool_done (struct digest_record *rec)
+{
+  bool done;
+
+  pthread_mutex_lock (&queue_lock);
+  done = rec->done;
+  pthread_mutex_unlock (&queue_lock);
+  return done;
+}
+
+static void
+pool_wait (struct digest_record *rec)
+{
+  pthread_mutex_lock (&queue_lock);
+  if (!rec->done)
+    {
+      ++waits;
+      while (!rec->done)
+	pthread_cond_wait (&done_cond, &queue_lock);
+    }
+  pthread_mutex_unlock (&queue_lock);
+}
+
+#endif /* USE_POSIX_THREADS */
+
+
+static bool
+write_all (FILE *fp, const char *p, size_t n)
+{
+  return fwrite (p, 1, n, fp) == n;
+}
+
+/* Write out the oldest record, once its digest is ready. */
+static void
+write_oldest (void)
+{
+  struct digest_record *rec = oldest;
+  FILE *fp = rec->dest->stream;
+  size_t i, start = 0u;
+  bool ok = true;
+
+#if USE_POSIX_THREADS
+  pool_wait (rec);
+#endif
+  bytes_hashed += rec->size;
+  if (rec->err)
+    {
+      nonfatal_target_file_error (rec->err, rec->pathname);
+      /* Leave out the digest, or everything. */
+      if (rec->whole)
+	{
+	  start = rec->len;
+	}
+      else
+	{
+	  for (i = 0; i < rec->n_holes; ++i)
+	    {
+	      ok = ok && write_all (fp, rec->text + start,
+				    rec->holes[i] - start);
+	      start = rec->holes[i] + SHA256_HEX_SIZE;
+	    }
+	}
+    }
+  else
+    {
+      for (i = 0; i < rec->n_holes; ++i)
+	memcpy (rec->text + rec->holes[i], rec->hex, SHA256_HEX_SIZE);
+    }
+  ok = ok && write_all (fp, rec->text + start, rec->len - start);
+  if (!ok)
+    nonfatal_nontarget_file_error (errno, rec->dest->filename);
+
+  oldest = rec->next;
+  if (NULL == oldest)
+    newest = NULL;
+  --n_pending;
+  free (rec->text);
+  free (rec->holes);
+  free (rec->pathname);
+  free (rec);
+}
+
+/* Write the SHA-256 digest of the file open on FD, which we close,
+ * in hexadecimal to the SHA256_HEX_SIZE bytes at HEX, and return 0; or
+ * return an errno value.
+ */
+int
+digest_now (int fd, char *hex)
+{
+  struct digest_record rec;
+  char *buf = xmalloc (ReadSize);
+
+  rec.fd = fd;
+  hash_file (&rec, buf);
+  free (buf);
+  ++files_hashed;
+  bytes_hashed += rec.size;
+  memcpy (hex, rec.hex, SHA256_HEX_SIZE);
+  return rec.err;
+}
+
+/* Write the LEN bytes of TEXT to DEST, after filling in the digest of
+ * the file open on FD (which we close) at each of the N_HOLES offsets
+ * in HOLES, where there is room for it.  If FD is -1, there is no
+ * digest to fill in.  PATHNAME is the name of the file.  If the file
+ * cannot be read, we leave out the digest, or if WHOLE, all the text.
+ */
+void
+digest_output (struct format_val *dest, const char *text, size_t len,
+	       const size_t *holes, size_t n_holes,
+	       int fd, const char *pathname, bool whole)
+{
+  struct digest_record *rec;
+
+  /* This is registered after close_stdout, so it runs first. */
+  if (!sync_at_exit)
+    {
+      atexit (digest_sync);
+      sync_at_exit = true;
+    }
+
+  rec = xzalloc (sizeof *rec);
+  rec->dest = dest;
+  rec->text = xmemdup (text, len);
+  rec->len = len;
+  if (fd >= 0)
+    {
+      rec->holes = xmemdup (holes, n_holes * sizeof *holes);
+      rec->n_holes = n_holes;
+      rec->pathname = xstrdup (pathname);
+      ++files_hashed;
+    }
+  rec->fd = fd;
+  rec->done = (fd < 0);
+  rec->whole = whole;
+
+  if (newest)
+    newest->next = rec;
+  else
+    oldest = rec;
+  newest = rec;
+  ++n_pending;
+
+#if USE_POSIX_THREADS
+  if (fd >= 0 && !tried_pool)
+    {
+      tried_pool = true;
+      pool_setup ();
+    }
+  if (pool)
+    {
+      if (fd >= 0)
+	pool_queue (rec);
+      /* Write out whatever is ready, and make room if we need to. */
+      while (oldest && (n_pending > MaxPendingRecords || pool_done (oldest)))
+	write_oldest ();
+      return;
+    }
+#endif
+  if (fd >= 0)
+    {
+      char *buf = xmalloc (ReadSize);
+      hash_file (rec, buf);
+      free (buf);
+      rec->done = true;
+    }
+  digest_sync ();
+}
+
+/* Return true if there is output waiting for a digest. */
+bool
+digest_pending (void)
+{
+  return NULL != oldest;
+}
+
+/* Write out all the output which is waiting for a digest. */
+void
+digest_sync (void)
+{
+  while (oldest)
+    write_oldest ();
+}
+
+/* Write out everything, and release everything. */
+void
+digest_stop (void)
+{
+  digest_sync ();
+#if USE_POSIX_THREADS
+  if (pool)
+    pool_teardown ();
+  tried_pool = false;
+#endif
+  if ((options.debug_options & DebugStat) && files_hashed)
+    fprintf (stderr,
+	     "digests: hashed %" PRIuMAX " files, %" PRIuMAX " bytes; "
+	     "waited for %" PRIuMAX "\n",
+	     files_hashed, bytes_hashed, waits);
+  files_hashed = bytes_hashed = waits = 0u;
+}
@@ -0,0 +1,323 @@
+/* du.c -- add up the disk usage of files for -du.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* -du adds the space used by each file for which it is evaluated to
+ * the totals of the directories which contain it, and prints the total
+ * for each directory as the search leaves it, in the same format as
+ * du(1).  "find DIR -du" therefore prints what "du DIR" does, and
+ * "find DIR -name '*.o' -du" how much space the object files in each
+ * directory take up, without walking the tree a second time.
+ *
+ * The search tells us as it enters and leaves each directory, and we
+ * keep a stack of the directories we are inside.  A directory whose
+ * contents the search skipped (because of -prune or -maxdepth, say)
+ * is closed when we next see a file at its level or above it.
+ * Like du, we count a file with several links only the first time we
+ * see it, and leave it out of the totals altogether after that; we
+ * keep the device and inode numbers of those files in an
+ * open-addressed hash table.  With -L, that goes for every file.
+ */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xalloc.h"
+#include "printquoted.h"
+#include "defs.h"
+
+enum
+  {
+    /* The initial number of slots in a table of linked files.  This
+     * must be a power of two.
+     */
+    InitialLinkTableSize = 256
+  };
+
+/* A directory we are inside. */
+struct du_dir
+{
+  char *pathname;
+  int depth;
+};
+
+/* The total for a directory, so far. */
+struct du_sum
+{
+  uintmax_t bytes;
+  bool counted;			/* -du was evaluated for something in it */
+};
+
+/* A file with several links, which we have already counted. */
+struct file_id
+{
+  dev_t dev;
+  ino_t ino;
+};
+
+struct du_tally
+{
+  struct du_val *du;		/* the predicate's arguments */
+  struct du_sum *sums;		/* one for each element of dirs */
+  size_t sums_alloc;
+
+  struct file_id *links;	/* the table of linked files */
+  size_t links_size;		/* the number of slots; a power of two */
+  size_t links_used;
+  bool have_zero;		/* the table contains 0, 0 (an empty slot) */
+
+  struct du_tally *next;
+};
+
+static struct du_tally *tallies = NULL;
+
+static struct du_dir *dirs = NULL;
+static size_t n_dirs = 0u, dirs_alloc = 0u;
+
+/* We are in a search which began at a starting point. */
+static bool walking = false;
+
+
+/* Set up DU, the arguments of a -du predicate.  */
+void
+du_new (struct du_val *du)
+{
+  struct du_tally *t = xzalloc (sizeof *t);
+
+  t->du = du;
+  t->next = tallies;
+  tallies = t;
+  du->tally = t;
+}
+
+static size_t
+file_id_hash (dev_t dev, ino_t ino)
+{
+  uintmax_t h = (uintmax_t) ino * 0x9e3779b97f4a7c15ull ^ (uintmax_t) dev;
+  return h ^ (h >> 29);
+}
+
+/* Find the slot for DEV, INO in the table of T, which has room for it. */
+static struct file_id *
+file_id_slot (struct du_tally *t, dev_t dev, ino_t ino)
+{
+  size_t mask = t->links_size - 1u;
+  size_t i = file_id_hash (dev, ino) & mask;
+
+  while (t->links[i].ino || t->links[i].dev)
+    {
+      if (t->links[i].ino == ino && t->links[i].dev == dev)
+	break;
+      i = (i + 1u) & mask;
+    }
+  return &t->links[i];
+}
+
+/* Return true if we had seen the file DEV, INO before, and remember it
+ * anyway.
+ */
+static bool
+seen_file_id (struct du_tally *t, dev_t dev, ino_t ino)
+{
+  struct file_id *slot;
+
+  if (0 == ino && 0 == dev)
+    {
+      bool seen = t->have_zero;
+      t->have_zero = true;
+      return seen;
+    }
+
+  /* Keep the table at most half full. */
+  if (2u * (t->links_used + 1u) > t->links_size)
+    {
+      struct file_id *old = t->links;
+      size_t i, old_size = t->links_size;
+
+      t->links_size = old_size ? 2u * old_size : InitialLinkTableSize;
+      t->links = xcalloc (t->links_size, sizeof *t->links);
+      for (i = 0; i < old_size; ++i)
+	if (old[i].ino || old[i].dev)
+	  *file_id_slot (t, old[i].dev, old[i].ino) = old[i];
+      free (old);
+    }
+
+  slot = file_id_slot (t, dev, ino);
+  if (slot->ino || slot->dev)
+    return true;
+  slot->dev = dev;
+  slot->ino = ino;
+  ++t->links_used;
+  return false;
+}
+
+/* Print BYTES and PATHNAME on the output of DU. */
+static void
+print_total (const struct du_val *du, uintmax_t bytes, const char *pathname)
+{
+  uintmax_t size = options.output_block_size;
+
+  digest_sync ();
+  fprintf (du->dest.stream, "%" PRIuMAX "\t", bytes / size + !!(bytes % size));
+  print_quoted (du->dest.stream, du->dest.quote_opts, du->dest.dest_is_tty,
+		"%s\n", pathname);
+}
+
+/* Leave the innermost directory we are inside, print its totals, and
+ * add them to those of its parent.
+ */
+static void
+close_dir (void)
+{
+  struct du_dir *d = &dirs[--n_dirs];
+  struct du_tally *t;
+
+  for (t = tallies; t; t = t->next)
+    {
+      const struct du_sum *sum = &t->sums[n_dirs];
+
+      if (sum->counted)
+	{
+	  print_total (t->du, sum->bytes, d->pathname);
+	  if (n_dirs)
+	    {
+	      t->sums[n_dirs - 1u].bytes += sum->bytes;
+	      t->sums[n_dirs - 1u].counted = true;
+	    }
+	}
+    }
+  free (d->pathname);
+}
+
+/* Leave each directory at DEPTH or deeper. */
+static void
+close_dirs (int depth)
+{
+  while (n_dirs && dirs[n_dirs - 1u].depth >= depth)
+    close_dir ();
+}
+
+/* We are about to start searching a starting point. */
+void
+du_begin (void)
+{
+  walking = (NULL != tallies);
+}
+
+/* The search has found PATHNAME at DEPTH, and is about to apply the
+ * expression to it.  IS_DIR says whether the search will go on to look
+ * inside it.
+ */
+void
+du_arrive (const char *pathname, int depth, bool is_dir)
+{
+  struct du_tally *t;
+
+  if (!walking)
+    return;
+  close_dirs (depth);
+  if (!is_dir)
+    return;
+
+  if (n_dirs == dirs_alloc)
+    dirs = x2nrealloc (dirs, &dirs_alloc, sizeof *dirs);
+  dirs[n_dirs].pathname = xstrdup (pathname);
+  dirs[n_dirs].depth = depth;
+  for (t = tallies; t; t = t->next)
+    {
+      if (n_dirs == t->sums_alloc)
+	t->sums = x2nrealloc (t->sums, &t->sums_alloc, sizeof *t->sums);
+      t->sums[n_dirs].bytes = 0u;
+      t->sums[n_dirs].counted = false;
+    }
+  ++n_dirs;
+}
+
+/* The search has finished with the directory at DEPTH. */
+void
+du_leave (int depth)
+{
+  if (walking)
+    close_dirs (depth);
+}
+
+/* We have finished searching a starting point. */
+void
+du_end (void)
+{
+  close_dirs (INT_MIN);
+  walking = false;
+}
+
+/* Count the file PATHNAME, at depth state.curdepth, which uses BYTES,
+ * for the -du predicate whose arguments are DU.
+ */
+void
+du_add (struct du_val *du, const char *pathname, const struct stat *st,
+	uintmax_t bytes)
+{
+  struct du_tally *t = du->tally;
+  const struct du_dir *top = n_dirs ? &dirs[n_dirs - 1u] : NULL;
+  struct du_sum *sum;
+
+  /* -watch applies the expression to files after the search. */
+  if (!walking)
+    return;
+
+  /* Like du, when following symbolic links we count each directory
+   * only once, as well as each file.
+   */
+  if ((options.symlink_handling == SYMLINK_ALWAYS_DEREF
+       || (!S_ISDIR (st->st_mode) && st->st_nlink > 1))
+      && seen_file_id (t, st->st_dev, st->st_ino))
+    return;
+
+  if (top && top->depth == (S_ISDIR (st->st_mode)
+			    ? state.curdepth : state.curdepth - 1))
+    {
+      sum = &t->sums[n_dirs - 1u];
+      sum->bytes += bytes;
+      sum->counted = true;
+    }
+  else
+    {
+      /* A starting point which is not a directory. */
+      print_total (du, bytes, pathname);
+    }
+}
+
+/* Forget everything, at the end of the run. */
+void
+du_stop (void)
+{
+  while (n_dirs)
+    free (dirs[--n_dirs].pathname);
+  walking = false;
+  while (tallies)
+    {
+      struct du_tally *t = tallies;
+      tallies = t->next;
+      t->du->tally = NULL;
+      free (t->sums);
+      free (t->links);
+      free (t);
+    }
+}
@@ -0,0 +1,399 @@
+/* dupes.c -- find regular files with the same contents, for -duplicates.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* -duplicates remembers the size, device, inode number and name of
+ * each regular file it is applied to.  When find exits, we look for
+ * files with the same contents in stages, each of which only looks at
+ * the files which the stages before it could not tell apart:
+ *
+ *  1. Files are sorted by size, and a file whose size no other file has
+ *     is dropped.  Most files go here, without being opened at all.
+ *  2. Names with the same device and inode number are hard links to one
+ *     file, which is the same as itself; we read each such file once.
+ *  3. We hash the first FirstBlockSize bytes of each file which is left,
+ *     and drop those whose hash no other file of the same size has.
+ *  4. We hash the whole of each file still left.  Files with the same
+ *     SHA-256 digest are taken to be the same.
+ *
+ * Empty files are all the same without reading them, and so are files
+ * which fit in the first block once they pass stage 3.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xalloc.h"
+#include "sha256.h"
+#include "printquoted.h"
+#include "defs.h"
+
+enum
+  {
+    /* How much of each file the first hash covers. */
+    FirstBlockSize = 4096,
+
+    /* The size of the reads we make for the full hash. */
+    ReadSize = 256 * 1024
+  };
+
+struct dupe_file
+{
+  uintmax_t size;
+  dev_t dev;
+  ino_t ino;
+  size_t seq;			/* the order in which we found it */
+  char *pathname;
+};
+
+/* The names in files[first] to files[first + n - 1], which are all
+ * links to one file.
+ */
+struct inode
+{
+  size_t first, n;
+  bool ok;			/* we could read it */
+  unsigned char digest[SHA256_DIGEST_SIZE];
+};
+
+struct dupes
+{
+  struct dupe_file *files;
+  size_t n_files, files_alloc;
+
+  /* The groups of duplicates we find, as a list of indexes into files,
+   * each group ending with SIZE_MAX.
+   */
+  size_t *groups;
+  size_t n_groups_used, groups_alloc;
+};
+
+/* Statistics, for -D stat. */
+static uintmax_t files_opened, bytes_read;
+
+
+struct dupes *
+dupes_new (void)
+{
+  return xzalloc (sizeof (struct dupes));
+}
+
+/* Remember the regular file PATHNAME, whose status is ST. */
+void
+dupes_add (struct dupes *d, const char *pathname, const struct stat *st)
+{
+  struct dupe_file *f;
+
+  if (d->n_files == d->files_alloc)
+    d->files = x2nrealloc (d->files, &d->files_alloc, sizeof *d->files);
+  f = &d->files[d->n_files];
+  f->size = st->st_size < 0 ? 0u : (uintmax_t) st->st_size;
+  f->dev = st->st_dev;
+  f->ino = st->st_ino;
+  f->seq = d->n_files++;
+  f->pathname = xstrdup (pathname);
+}
+
+static int
+compare_files (const void *av, const void *bv)
+{
+  const struct dupe_file *a = av, *b = bv;
+
+  if (a->size != b->size)
+    return a->size < b->size ? -1 : 1;
+  if (a->dev != b->dev)
+    return a->dev < b->dev ? -1 : 1;
+  if (a->ino != b->ino)
+    return a->ino < b->ino ? -1 : 1;
+  return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* Hash up to LIMIT bytes of the file F into I->digest, or set I->ok to
+ * false if we cannot read it, or it is no longer the file we found.
+ */
+static void
+hash_inode (const struct dupe_file *f, uintmax_t limit, struct inode *i,
+	    char *buf)
+{
+  struct sha256_state s;
+  struct stat st;
+  uintmax_t total = 0u;
+  int fd, flags = O_RDONLY | O_NOCTTY | O_NONBLOCK;
+
+#ifdef O_CLOEXEC
+  flags |= O_CLOEXEC;
+#endif
+  i->ok = false;
+  fd = open (f->pathname, flags);
+  if (fd < 0)
+    {
+      nonfatal_target_file_error (errno, f->pathname);
+      return;
+    }
+  ++files_opened;
+  if (0 != fstat (fd, &st) || !S_ISREG (st.st_mode)
+      || st.st_dev != f->dev || st.st_ino != f->ino)
+    {
+      close (fd);
+      return;
+    }
+#if defined POSIX_FADV_SEQUENTIAL
+  if (limit > FirstBlockSize)
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  sha256_start (&s);
+  while (total < limit)
+    {
+      size_t want = limit - total < ReadSize ? limit - total : ReadSize;
+      ssize_t n = read (fd, buf, want);
+
+      if (0 == n)
+	break;
+      if (n < 0)
+	{
+	  if (EINTR == errno)
+	    continue;
+	  nonfatal_target_file_error (errno, f->pathname);
+	  close (fd);
+	  return;
+	}
+      sha256_add (&s, buf, n);
+      total += n;
+    }
+  close (fd);
+  bytes_read += total;
+  sha256_end (&s, i->digest);
+  /* A file which changed size since we found it is not a duplicate of
+   * anything.
+   */
+  i->ok = (total == (limit < f->size ? limit : f->size));
+}
+
+static int
+compare_digests (const void *av, const void *bv)
+{
+  const struct inode *a = av, *b = bv;
+  int c = memcmp (a->digest, b->digest, sizeof a->digest);
+  return c ? c : a->first < b->first ? -1 : a->first > b->first;
+}
+
+static void
+add_group_member (struct dupes *d, size_t index)
+{
+  if (d->n_groups_used == d->groups_alloc)
+    d->groups = x2nrealloc (d->groups, &d->groups_alloc, sizeof *d->groups);
+  d->groups[d->n_groups_used++] = index;
+}
+
+/* Record the names of the N inodes at V as a group of duplicates, if
+ * there are at least two of them.
+ */
+static void
+add_group (struct dupes *d, const struct inode *v, size_t n)
+{
+  size_t i, j, names = 0u;
+
+  for (i = 0; i < n; ++i)
+    names += v[i].n;
+  if (names < 2u)
+    return;
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < v[i].n; ++j)
+      add_group_member (d, v[i].first + j);
+  add_group_member (d, SIZE_MAX);
+}
+
+/* Hash up to LIMIT bytes of each of the N inodes at V, drop those we
+ * cannot read, and sort the rest by their digests.  Return how many
+ * are left.
+ */
+static size_t
+hash_and_sort (struct dupes *d, struct inode *v, size_t n, uintmax_t limit,
+	       char *buf)
+{
+  size_t i, kept = 0u;
+
+  for (i = 0; i < n; ++i)
+    {
+      hash_inode (&d->files[v[i].first], limit, &v[i], buf);
+      if (v[i].ok)
+	v[kept++] = v[i];
+    }
+  qsort (v, kept, sizeof *v, compare_digests);
+  return kept;
+}
+
+/* Return how many of the N inodes at V, which are sorted by digest,
+ * have the same digest as the first.
+ */
+static size_t
+same_digest (const struct inode *v, size_t n)
+{
+  size_t i;
+
+  for (i = 1u; i < n && 0 == memcmp (v[0].digest, v[i].digest,
+				     sizeof v[0].digest); ++i)
+    continue;
+  return i;
+}
+
+/* Find the duplicates among the N inodes at V, which all have SIZE
+ * bytes.
+ */
+static void
+find_duplicates (struct dupes *d, struct inode *v, size_t n, uintmax_t size,
+		 char *buf)
+{
+  size_t i, j, run, m, run2;
+
+  if (0u == size || 1u == n)
+    {
+      /* Empty files, or hard links to one file. */
+      add_group (d, v, n);
+      return;
+    }
+
+  n = hash_and_sort (d, v, n, FirstBlockSize, buf);
+  for (i = 0; i < n; i += run)
+    {
+      run = same_digest (&v[i], n - i);
+      if (size <= FirstBlockSize || 1u == run)
+	{
+	  /* We have read all of these files, or there is only one. */
+	  add_group (d, &v[i], run);
+	  continue;
+	}
+      m = hash_and_sort (d, &v[i], run, UINTMAX_MAX, buf);
+      for (j = 0; j < m; j += run2)
+	{
+	  run2 = same_digest (&v[i + j], m - j);
+	  add_group (d, &v[i + j], run2);
+	}
+    }
+}
+
+static const struct dupe_file *sorted_files;
+
+/* Order groups by the first-found name in each. */
+static int
+compare_groups (const void *av, const void *bv)
+{
+  size_t a = sorted_files[**(const size_t * const *) av].seq;
+  size_t b = sorted_files[**(const size_t * const *) bv].seq;
+  return a < b ? -1 : a > b;
+}
+
+static int
+compare_members (const void *av, const void *bv)
+{
+  size_t a = sorted_files[*(const size_t *) av].seq;
+  size_t b = sorted_files[*(const size_t *) bv].seq;
+  return a < b ? -1 : a > b;
+}
+
+/* Print each group of duplicates on DEST, one name to a line, with a
+ * blank line between groups, and forget everything.
+ */
+void
+dupes_print (struct dupes *d, const struct format_val *dest)
+{
+  struct inode *v = NULL;
+  size_t v_alloc = 0u, i, j, n_groups = 0u;
+  size_t **starts;
+  char *buf = xmalloc (ReadSize);
+  uintmax_t candidates = 0u;
+
+  qsort (d->files, d->n_files, sizeof *d->files, compare_files);
+  for (i = 0; i < d->n_files; i = j)
+    {
+      size_t n_inodes = 0u;
+
+      for (j = i + 1u; j < d->n_files && d->files[j].size == d->files[i].size;
+	   ++j)
+	continue;
+      if (j - i < 2u)
+	continue;		/* no other file has this size */
+      candidates += j - i;
+
+      /* Make a list of the distinct files among these names. */
+      while (i < j)
+	{
+	  size_t first = i;
+	  while (++i < j && d->files[i].dev == d->files[first].dev
+		 && d->files[i].ino == d->files[first].ino)
+	    continue;
+	  if (n_inodes == v_alloc)
+	    v = x2nrealloc (v, &v_alloc, sizeof *v);
+	  v[n_inodes].first = first;
+	  v[n_inodes].n = i - first;
+	  ++n_inodes;
+	}
+      find_duplicates (d, v, n_inodes, d->files[j - 1u].size, buf);
+    }
+  free (v);
+  free (buf);
+
+  /* Print the groups in the order we found their first names. */
+  for (i = 0; i < d->n_groups_used; ++i)
+    if (SIZE_MAX == d->groups[i])
+      ++n_groups;
+  starts = xnmalloc (n_groups, sizeof *starts);
+  for (i = 0, j = 0; i < d->n_groups_used; ++i)
+    if (0 == i || SIZE_MAX == d->groups[i - 1u])
+      starts[j++] = &d->groups[i];
+  sorted_files = d->files;
+  for (i = 0; i < n_groups; ++i)
+    {
+      size_t len;
+      for (len = 0; SIZE_MAX != starts[i][len]; ++len)
+	continue;
+      qsort (starts[i], len, sizeof *starts[i], compare_members);
+    }
+  qsort (starts, n_groups, sizeof *starts, compare_groups);
+
+  for (i = 0; i < n_groups; ++i)
+    {
+      if (i)
+	putc ('\n', dest->stream);
+      for (j = 0; SIZE_MAX != starts[i][j]; ++j)
+	print_quoted (dest->stream, dest->quote_opts, dest->dest_is_tty,
+		      "%s\n", d->files[starts[i][j]].pathname);
+    }
+
+  if (options.debug_options & DebugStat)
+    fprintf (stderr,
+	     "duplicates: %" PRIuMAX " files, %" PRIuMAX " with the same "
+	     "size as another; opened %" PRIuMAX " files and read %" PRIuMAX
+	     " bytes\n",
+	     (uintmax_t) d->n_files, candidates, files_opened, bytes_read);
+
+  free (starts);
+  for (i = 0; i < d->n_files; ++i)
+    free (d->files[i].pathname);
+  free (d->files);
+  free (d->groups);
+  free (d);
+}
@@ -0,0 +1,229 @@
+/* evalbatch.c -- apply the first tests to a whole directory at once.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With -batch_eval, fts calls evalbatch_dir with each batch of entries
+ * it reads from a directory, and we apply the tests at the start of the
+ * expression which need only the name or type of a file (-name, -path,
+ * -regex, -type and so on) to all of them, one test at a time; see
+ * run_program_batch.  Entries which fail, and which are not
+ * directories, need no more attention at all, so fts drops them before
+ * sorting the rest, and never returns them to us.  For the others, we
+ * remember in fts_number where their result is, and when fts hands
+ * them to us we carry on from the first test that has not yet been
+ * applied.  All this is done while the entries fts has just allocated
+ * are still in the cache, and in a directory with many thousands of
+ * entries it is much cheaper than looking at each entry in turn.
+ *
+ * The directories nest, so the results form a stack, as in
+ * statbatch.c.
+ */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xalloc.h"
+#include "fts_.h"
+#include "defs.h"
+
+/* The results for the entries fts read from a directory at once. */
+struct eval_batch
+{
+  struct eval_batch *outer;
+  int level;			/* the fts_level of the directory */
+  struct batch_result *results;
+};
+
+static struct eval_batch *innermost = NULL;
+
+/* The depth of the fts root below the starting point. */
+static int base_level;
+
+/* Statistics, for -D rates. */
+static uintmax_t files_batched, files_dropped;
+
+
+static void
+pop_batch (void)
+{
+  struct eval_batch *b = innermost;
+
+  innermost = b->outer;
+  free (b->results);
+  free (b);
+}
+
+/* Can fts drop ENT if the expression is false for it?  We still want
+ * to see anything fts would report an error for, and directories,
+ * since we may have to search them.  With -L, a symbolic link may turn
+ * out to point at a directory.
+ */
+static bool
+can_drop (const FTSENT *ent)
+{
+  switch (ent->fts_info)
+    {
+    case FTS_NSOK:
+    case FTS_F:
+    case FTS_SL:
+    case FTS_DEFAULT:
+      return 0 != ent->fts_statp->st_mode
+	&& !S_ISDIR (ent->fts_statp->st_mode)
+	&& !(S_ISLNK (ent->fts_statp->st_mode)
+	     && SYMLINK_ALWAYS_DEREF == options.symlink_handling);
+    default:
+      return false;
+    }
+}
+
+/* Get ready to search below a point which is BASE levels below the
+ * starting point.
+ */
+void
+evalbatch_start (int base)
+{
+  base_level = base;
+}
+
+/* fts has just read ENTRIES from DIR.  Apply the first tests to all of
+ * them, and mark those which fail with FTS_SKIP so that fts drops them.
+ */
+void
+evalbatch_dir (FTSENT *dir, FTSENT *entries)
+{
+  struct eval_batch *b;
+  FTSENT *ent;
+  FTSENT **ents = NULL;
+  mode_t *modes = NULL;
+  const char **names;
+  char *paths, *s;
+  size_t n, i, dirlen, size, ents_alloc, modes_alloc;
+  bool needs_path;
+
+  /* Finish with any directories we have already left, and with any
+   * earlier entries of this one.
+   */
+  while (innermost && innermost->level >= dir->fts_level)
+    pop_batch ();
+
+  /* Don't bother if we are not going to look at the entries. */
+  if (0 == program_batch_length (&needs_path)
+      || dir->fts_level + 1 + base_level < options.mindepth)
+    return;
+
+  /* fts builds the path of each entry like this; see NAPPEND in fts.c. */
+  dirlen = dir->fts_pathlen;
+  if (dirlen && '/' == dir->fts_path[dirlen - 1])
+    --dirlen;
+
+  n = size = ents_alloc = modes_alloc = 0u;
+  for (ent = entries; ent; ent = ent->fts_link)
+    {
+      if (n == ents_alloc)
+	{
+	  ents = x2nrealloc (ents, &ents_alloc, sizeof *ents);
+	  modes = x2nrealloc (modes, &modes_alloc, sizeof *modes);
+	}
+      ents[n] = ent;
+      modes[n] = ent->fts_statp->st_mode;
+      size += dirlen + 1u + ent->fts_namelen + 1u;
+      ++n;
+    }
+
+  names = xnmalloc (n, sizeof *names);
+  paths = s = needs_path ? xmalloc (size) : NULL;
+  for (i = 0; i < n; ++i)
+    {
+      if (needs_path)
+	{
+	  names[i] = s;
+	  memcpy (s, dir->fts_path, dirlen);
+	  s += dirlen;
+	  *s++ = '/';
+	  memcpy (s, ents[i]->fts_name, ents[i]->fts_namelen + 1u);
+	  s += ents[i]->fts_namelen + 1u;
+	}
+      else
+	{
+	  names[i] = ents[i]->fts_name;
+	}
+    }
+
+  b = xmalloc (sizeof *b);
+  b->level = dir->fts_level;
+  b->results = xnmalloc (n, sizeof *b->results);
+  run_program_batch (names, modes, n, b->results);
+  files_batched += n;
+
+  /* fts always keeps the first entry. */
+  for (i = 0; i < n; ++i)
+    {
+      if (i > 0 && b->results[i].failed && can_drop (ents[i]))
+	{
+	  fts_set (dir->fts_fts, ents[i], FTS_SKIP);
+	  count_batch_result (&b->results[i]);
+	  ++files_dropped;
+	}
+      else
+	{
+	  ents[i]->fts_number = i + 1u;
+	}
+    }
+
+  free (ents);
+  free (modes);
+  free (names);
+  free (paths);
+
+  b->outer = innermost;
+  innermost = b;
+}
+
+/* Return what we found out about ENT when fts read it, or NULL if we
+ * did not look at it.
+ */
+const struct batch_result *
+evalbatch_lookup (const FTSENT *ent)
+{
+  /* Finish with any directories we have left. */
+  while (innermost && ent->fts_level <= innermost->level)
+    pop_batch ();
+
+  if (0 == ent->fts_number || NULL == innermost
+      || innermost->level != ent->fts_level - 1)
+    return NULL;
+  return &innermost->results[ent->fts_number - 1];
+}
+
+/* Release everything. */
+void
+evalbatch_stop (void)
+{
+  while (innermost)
+    pop_batch ();
+  if ((options.debug_options & DebugSuccessRates) && files_batched)
+    fprintf (stderr,
+	     "batched evaluation: applied the first tests to %" PRIuMAX
+	     " files, and dropped %" PRIuMAX " of them\n",
+	     files_batched, files_dropped);
+  files_batched = files_dropped = 0u;
+}
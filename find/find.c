@@ -181,6 +181,13 @@ main (int argc, char **argv)
    */
   eval_tree = build_expression_tree (argc, argv, end_of_leading_options);
 
+  /* We read directories ourselves, without fts, so the snapshot would
+   * be neither used nor updated; and we don't watch them afterwards.
+   */
+  if (options.snapshot_file)
+    error (EXIT_FAILURE, 0, _("-snapshot is not supported by oldfind"));
+  if (options.watch)
+    error (EXIT_FAILURE, 0, _("-watch is not supported by oldfind"));
 
   /* safely_chdir () needs to check that it has ended up in the right place.
    * To avoid bailing out when something gets automounted, it checks if
@@ -1018,7 +1025,7 @@ do_process_predicate (char *pathname,
   (void) mode;
 
   state.rel_pathname = base;	/* cwd_dir_fd was already set by safely_chdir */
-  apply_predicate (pathname, pstat, get_eval_tree ());
+  apply_expression (pathname, pstat);
 }
 
 
@@ -1037,7 +1044,12 @@ do_process_predicate (char *pathname,
 static void
 process_top_path (char *pathname, mode_t mode)
 {
+  if (options.threads > 1)
+    prefetch_start (pathname, options.threads - 1);
+  du_begin ();
   at_top (pathname, mode, NULL, do_process_top_dir);
+  du_end ();
+  prefetch_stop ();
 }
 
 
@@ -1127,9 +1139,7 @@ process_path (char *pathname, char *name, bool leaf, char *parent,
   struct stat stat_buf;
   static dev_t root_dev;	/* Device ID of current argument pathname. */
   int i;
-  struct predicate *eval_tree;
 
-  eval_tree = get_eval_tree ();
   /* Assume it is a non-directory initially. */
   stat_buf.st_mode = 0;
   state.rel_pathname = name;
@@ -1143,8 +1153,9 @@ process_path (char *pathname, char *name, bool leaf, char *parent,
 
   if (!S_ISDIR (state.type))
     {
+      du_arrive (pathname, state.curdepth, false);
       if (state.curdepth >= options.mindepth)
-	apply_predicate (pathname, &stat_buf, eval_tree);
+	apply_expression (pathname, &stat_buf);
       return 0;
     }
 
@@ -1190,8 +1201,13 @@ process_path (char *pathname, char *name, bool leaf, char *parent,
 	state.stop_at_current_level = true;
     }
 
+  /* Don't read directories in which nothing can match. */
+  if (!state.stop_at_current_level && !subtree_may_match (pathname))
+    state.stop_at_current_level = true;
+
+  du_arrive (pathname, state.curdepth, true);
   if (options.do_dir_first && state.curdepth >= options.mindepth)
-    apply_predicate (pathname, &stat_buf, eval_tree);
+    apply_expression (pathname, &stat_buf);
 
   if (options.debug_options & DebugSearch)
     fprintf (stderr, "pathname = %s, stop_at_current_level = %d\n",
@@ -1219,6 +1235,7 @@ process_path (char *pathname, char *name, bool leaf, char *parent,
 	  do_process_predicate (pathname, name, mode, &stat_buf);
 	}
     }
+  du_leave (state.curdepth);
 
   dir_curr--;
 
@@ -1226,6 +1243,40 @@ process_path (char *pathname, char *name, bool leaf, char *parent,
 }
 
 
+/* Free DIRINFO and, if there are more entries to be read from
+ * *DIRSTREAM, return the next batch of them.  Otherwise, close
+ * *DIRSTREAM (if it is open) and return NULL.  PATHNAME is the name of
+ * the directory, for use in diagnostics.
+ */
+static struct savedir_dirinfo *
+next_dirinfo_batch (const char *pathname, struct savedir_dirinfo *dirinfo,
+		    struct savedir_stream **dirstream, int sort_flags)
+{
+  free_dirinfo (dirinfo);
+  dirinfo = NULL;
+  if (*dirstream && !savedir_at_end (*dirstream))
+    {
+      errno = 0;
+      dirinfo = xsavedir_next (*dirstream, sort_flags, options.readdir_batch);
+      if (NULL == dirinfo)
+	{
+	  error (0, errno, "%s", safely_quote_err_filename (0, pathname));
+	  state.exit_status = 1;
+	}
+      else if (0 == dirinfo->size)
+	{
+	  free_dirinfo (dirinfo);
+	  dirinfo = NULL;
+	}
+    }
+  if (NULL == dirinfo && *dirstream)
+    {
+      savedir_close (*dirstream);
+      *dirstream = NULL;
+    }
+  return dirinfo;
+}
+
 /* Scan directory PATHNAME and recurse through process_path for each entry.
 
    PATHLEN is the length of PATHNAME.
@@ -1246,6 +1297,8 @@ process_dir (char *pathname, char *name, int pathlen, const struct stat *statp,
   struct stat stat_buf;
   size_t dircount = 0u;
   struct savedir_dirinfo *dirinfo;
+  struct savedir_stream *dirstream;
+  int sort_flags = options.inode_order ? SavedirSortInode : 0;
 
   if (statp->st_nlink < 2)
     {
@@ -1258,8 +1311,23 @@ process_dir (char *pathname, char *name, int pathlen, const struct stat *statp,
       subdirs_left = statp->st_nlink - 2; /* Account for name and ".". */
     }
 
+  /* Read (the first batch of) the directory's entries.  If that was
+   * all of them, we don't need to keep the directory open.
+   */
   errno = 0;
-  dirinfo = xsavedir (name, 0);
+  dirinfo = NULL;
+  dirstream = savedir_open (name);
+  if (dirstream)
+    {
+      dirinfo = xsavedir_next (dirstream, sort_flags, options.readdir_batch);
+      if (dirinfo == NULL || savedir_at_end (dirstream))
+	{
+	  int saved_errno = errno;
+	  savedir_close (dirstream);
+	  dirstream = NULL;
+	  errno = saved_errno;
+	}
+    }
 
 
   if (dirinfo == NULL)
@@ -1336,6 +1404,8 @@ process_dir (char *pathname, char *name, int pathlen, const struct stat *statp,
 	      error (0, errno, "%s",
 		     safely_quote_err_filename (0, pathname));
 	      state.exit_status = 1;
+	      if (dirstream)
+		savedir_close (dirstream);
 	      return;
 
 	    case SafeChdirFailSymlink:
@@ -1343,82 +1413,93 @@ process_dir (char *pathname, char *name, int pathlen, const struct stat *statp,
 		     _("warning: not following the symbolic link %s"),
 		     safely_quote_err_filename (0, pathname));
 	      state.exit_status = 1;
+	      if (dirstream)
+		savedir_close (dirstream);
 	      return;
 	    }
 	}
 
-      for (idx=0; idx < dirinfo->size; ++idx)
+      while (dirinfo)
 	{
-	  /* savedirinfo() may return dirinfo=NULL if extended information
-	   * is not available.
-	   */
-	  mode_t mode = (dirinfo->entries[idx].flags & SavedirHaveFileType) ?
-	    dirinfo->entries[idx].type_info : 0;
-	  namep = dirinfo->entries[idx].name;
-
-	  /* Append this directory entry's name to the path being searched. */
-	  file_len = pathname_len + strlen (namep);
-	  if (file_len > cur_path_size)
+	  for (idx=0; idx < dirinfo->size; ++idx)
 	    {
-	      while (file_len > cur_path_size)
-		cur_path_size += 1024;
-	      free (cur_path);
-	      cur_path = xmalloc (cur_path_size);
-	      strcpy (cur_path, pathname);
-	      cur_path[pathname_len - 2] = '/';
-	    }
-	  cur_name = cur_path + pathname_len - 1;
-	  strcpy (cur_name, namep);
+	      /* savedirinfo() may return dirinfo=NULL if extended information
+	       * is not available.
+	       */
+	      mode_t mode = (dirinfo->entries[idx].flags & SavedirHaveFileType) ?
+		dirinfo->entries[idx].type_info : 0;
+	      namep = dirinfo->entries[idx].name;
 
-	  state.curdepth++;
-	  if (!options.no_leaf_check && !subdirs_unreliable)
-	    {
-	      if (mode && S_ISDIR(mode) && (subdirs_left == 0))
+	      /* Append this directory entry's name to the path being searched. */
+	      file_len = pathname_len + strlen (namep);
+	      if (file_len > cur_path_size)
 		{
-		  /* This is a subdirectory, but the number of directories we
-		   * have found now exceeds the number we would expect given
-		   * the hard link count on the parent.   This is likely to be
-		   * a bug in the file system driver (e.g. Linux's
-		   * /proc file system) or may just be a fact that the OS
-		   * doesn't really handle hard links with Unix semantics.
-		   * In the latter case, -noleaf should be used routinely.
-		   */
-		  error (0, 0, _("WARNING: Hard link count is wrong for %s (saw only st_nlink=%" PRIuMAX  " but we already saw %" PRIuMAX " subdirectories): this may be a bug in your file system driver.  Automatically turning on find's -noleaf option.  Earlier results may have failed to include directories that should have been searched."),
-			 safely_quote_err_filename(0, pathname),
-			 (uintmax_t) statp->st_nlink,
-			 (uintmax_t) dircount);
-		  state.exit_status = 1; /* We know the result is wrong, now */
-		  options.no_leaf_check = true;	/* Don't make same
-						   mistake again */
-		  subdirs_unreliable = 1;
-		  subdirs_left = 1; /* band-aid for this iteration. */
+		  while (file_len > cur_path_size)
+		    cur_path_size += 1024;
+		  free (cur_path);
+		  cur_path = xmalloc (cur_path_size);
+		  strcpy (cur_path, pathname);
+		  cur_path[pathname_len - 2] = '/';
 		}
+	      cur_name = cur_path + pathname_len - 1;
+	      strcpy (cur_name, namep);
 
-	      /* Normal case optimization.  On normal Unix
-		 file systems, a directory that has no subdirectories
-		 has two links: its name, and ".".  Any additional
-		 links are to the ".." entries of its subdirectories.
-		 Once we have processed as many subdirectories as
-		 there are additional links, we know that the rest of
-		 the entries are non-directories -- in other words,
-		 leaf files. */
-	      {
-		int count;
-		count = process_path (cur_path, cur_name,
-					    subdirs_left == 0, pathname,
-					    mode);
-		subdirs_left -= count;
-		dircount += count;
-	      }
-	    }
-	  else
-	    {
-	      /* There might be weird (e.g., CD-ROM or MS-DOS) file systems
-		 mounted, which don't have Unix-like directory link counts. */
-	      process_path (cur_path, cur_name, false, pathname, mode);
+	      state.curdepth++;
+	      if (!options.no_leaf_check && !subdirs_unreliable)
+		{
+		  if (mode && S_ISDIR(mode) && (subdirs_left == 0))
+		    {
+		      /* This is a subdirectory, but the number of directories we
+		       * have found now exceeds the number we would expect given
+		       * the hard link count on the parent.   This is likely to be
+		       * a bug in the file system driver (e.g. Linux's
+		       * /proc file system) or may just be a fact that the OS
+		       * doesn't really handle hard links with Unix semantics.
+		       * In the latter case, -noleaf should be used routinely.
+		       */
+		      error (0, 0, _("WARNING: Hard link count is wrong for %s (saw only st_nlink=%" PRIuMAX  " but we already saw %" PRIuMAX " subdirectories): this may be a bug in your file system driver.  Automatically turning on find's -noleaf option.  Earlier results may have failed to include directories that should have been searched."),
+			     safely_quote_err_filename(0, pathname),
+			     (uintmax_t) statp->st_nlink,
+			     (uintmax_t) dircount);
+		      state.exit_status = 1; /* We know the result is wrong, now */
+		      options.no_leaf_check = true;	/* Don't make same
+						       mistake again */
+		      subdirs_unreliable = 1;
+		      subdirs_left = 1; /* band-aid for this iteration. */
+		    }
+
+		  /* Normal case optimization.  On normal Unix
+		     file systems, a directory that has no subdirectories
+		     has two links: its name, and ".".  Any additional
+		     links are to the ".." entries of its subdirectories.
+		     Once we have processed as many subdirectories as
+		     there are additional links, we know that the rest of
+		     the entries are non-directories -- in other words,
+		     leaf files. */
+		  {
+		    int count;
+		    count = process_path (cur_path, cur_name,
+						subdirs_left == 0, pathname,
+						mode);
+		    subdirs_left -= count;
+		    dircount += count;
+		  }
+		}
+	      else
+		{
+		  /* There might be weird (e.g., CD-ROM or MS-DOS) file systems
+		     mounted, which don't have Unix-like directory link counts. */
+		  process_path (cur_path, cur_name, false, pathname, mode);
+		}
+
+	      state.curdepth--;
 	    }
 
-	  state.curdepth--;
+	  /* If this is a very large directory, go on to the next
+	   * batch of its entries.
+	   */
+	  dirinfo = next_dirinfo_batch (pathname, dirinfo, &dirstream,
+					sort_flags);
 	}
 
 
@@ -1482,7 +1563,6 @@ process_dir (char *pathname, char *name, int pathlen, const struct stat *statp,
 	}
 
       free (cur_path);
-      free_dirinfo (dirinfo);
     }
 
   if (subdirs_unreliable)
@@ -55,6 +55,7 @@
 #include "cloexec.h"
 #include "fdleak.h"
 #include "unused-result.h"
+#include "stat-time.h"
 
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
@@ -84,8 +85,17 @@ static int ftsoptions = FTS_NOSTAT|FTS_TIGHT_CYCLE_CHECK|FTS_CWDFD;
 static int prev_depth = INT_MIN; /* fts_level can be < 0 */
 static int curr_fd = -1;
 
+/* When -watch searches part of the tree again, the depth of the place
+ * it starts from, and (if not NULL) the time since which files must
+ * have changed for us to look at them.
+ */
+static int base_level = 0;
+static const struct timespec *changed_since = NULL;
+
 
 static bool find (char *arg) __attribute_warn_unused_result__;
+static bool find_at_depth (char *arg, int depth, int starting_path_length,
+			   const struct timespec *since);
 static bool process_all_startpoints (int argc, char *argv[]) __attribute_warn_unused_result__;
 
 
@@ -187,21 +197,42 @@ get_fts_info_name (int info)
 static void
 visit (FTS *p, FTSENT *ent, struct stat *pstat)
 {
-  struct predicate *eval_tree;
+  const struct batch_result *batched = evalbatch_lookup (ent);
 
-  state.have_stat = (ent->fts_info != FTS_NS) && (ent->fts_info != FTS_NSOK);
+  /* consider_visiting may already have the information from -batch_stat. */
+  if (ent->fts_info != FTS_NS && ent->fts_info != FTS_NSOK)
+    state.have_stat = true;
   state.rel_pathname = ent->fts_accpath;
   state.cwd_dir_fd   = p->fts_cwd_fd;
 
+  if (changed_since)
+    {
+      if (0 != get_statinfo (ent->fts_path, ent->fts_accpath, pstat))
+	return;
+      if (timespec_cmp (get_stat_ctime (pstat), *changed_since) < 0)
+	{
+	  /* We don't look at this again, but if -prune kept us out of
+	   * it last time, it would do so now.
+	   */
+	  if (ent->fts_info == FTS_D && watch_dir_pruned (pstat))
+	    fts_set (p, ent, FTS_SKIP);
+	  return;
+	}
+    }
+
   /* Apply the predicates to this path. */
-  eval_tree = get_eval_tree ();
-  apply_predicate (ent->fts_path, pstat, eval_tree);
+  if (batched)
+    apply_expression_after_batch (ent->fts_path, pstat, batched);
+  else
+    apply_expression (ent->fts_path, pstat);
 
   /* Deal with any side effects of applying the predicates. */
   if (state.stop_at_current_level)
     {
       fts_set (p, ent, FTS_SKIP);
     }
+  if (options.watch && ent->fts_info == FTS_D)
+    watch_note_dir (ent->fts_statp, state.stop_at_current_level);
 }
 
 static const char*
@@ -334,6 +365,7 @@ consider_visiting (FTS *p, FTSENT *ent)
   struct stat statbuf;
   mode_t mode;
   int ignore, isdir;
+  int level = ent->fts_level + base_level;
 
   if (options.debug_options & DebugSearch)
     fprintf (stderr,
@@ -424,7 +456,14 @@ consider_visiting (FTS *p, FTSENT *ent)
     }
 
   /* Cope with the usual cases. */
-  if (ent->fts_info == FTS_NSOK
+  if (statbatch_lookup (ent, &statbuf))
+    {
+      /* -batch_stat already fetched the information fts didn't. */
+      state.have_stat = true;
+      state.have_type = true;
+      state.type = mode = statbuf.st_mode;
+    }
+  else if (ent->fts_info == FTS_NSOK
       || ent->fts_info == FTS_NS /* e.g. symlink loop */)
     {
       assert (!state.have_stat);
@@ -449,7 +488,7 @@ consider_visiting (FTS *p, FTSENT *ent)
   /* update state.curdepth before calling digest_mode(), because digest_mode
    * may call following_links().
    */
-  state.curdepth = ent->fts_level;
+  state.curdepth = level;
   if (mode)
     {
       if (!digest_mode (&mode, ent->fts_path, ent->fts_name, &statbuf, 0))
@@ -476,15 +515,20 @@ consider_visiting (FTS *p, FTSENT *ent)
 
   if (options.maxdepth >= 0)
     {
-      if (ent->fts_level >= options.maxdepth)
+      if (level >= options.maxdepth)
 	{
 	  fts_set (p, ent, FTS_SKIP); /* descend no further */
 
-	  if (ent->fts_level > options.maxdepth)
+	  if (level > options.maxdepth)
 	    ignore = 1;		/* don't even look at this one */
 	}
     }
 
+  /* Don't read directories in which nothing can match. */
+  if (FTS_D == ent->fts_info && FTS_SKIP != ent->fts_instr
+      && !subtree_may_match (ent->fts_path))
+    fts_set (p, ent, FTS_SKIP);
+
   if ( (ent->fts_info == FTS_D) && !options.do_dir_first )
     {
       /* this is the preorder visit, but user said -depth */
@@ -495,7 +539,7 @@ consider_visiting (FTS *p, FTSENT *ent)
       /* this is the postorder visit, but user didn't say -depth */
       ignore = 1;
     }
-  else if (ent->fts_level < options.mindepth)
+  else if (level < options.mindepth)
     {
       ignore = 1;
     }
@@ -522,14 +566,39 @@ consider_visiting (FTS *p, FTSENT *ent)
 
 
 
+/* Order directory entries by inode number, for -inode_order.
+ * fts fills in st_ino from the directory entry even when it does not
+ * stat the file.
+ */
+static int
+compare_inodes (FTSENT const **a, FTSENT const **b)
+{
+  ino_t ia = (*a)->fts_statp->st_ino, ib = (*b)->fts_statp->st_ino;
+  return ia < ib ? -1 : ia > ib;
+}
+
 static bool
 find (char *arg)
+{
+  return find_at_depth (arg, 0, strlen (arg), NULL);
+}
+
+/* Search the tree below ARG, which is DEPTH levels below a starting
+ * point whose name is STARTING_PATH_LENGTH characters long.  If SINCE
+ * is not NULL, only look at files whose status has changed since then.
+ */
+static bool
+find_at_depth (char *arg, int depth, int starting_path_length,
+	       const struct timespec *since)
 {
   char * arglist[2];
   FTS *p;
   FTSENT *ent;
+  int opts;
 
-  state.starting_path_length = strlen (arg);
+  state.starting_path_length = starting_path_length;
+  base_level = depth;
+  changed_since = since;
   inside_dir (AT_FDCWD);
 
   arglist[0] = arg;
@@ -553,7 +622,19 @@ find (char *arg)
   if (options.stay_on_filesystem)
     ftsoptions |= FTS_XDEV;
 
-  p = fts_open (arglist, ftsoptions, NULL);
+  /* Don't make fts stat everything just because we sort. */
+  if (options.inode_order)
+    ftsoptions |= FTS_DEFER_STAT;
+
+  /* -H applies only to the starting points themselves. */
+  opts = ftsoptions;
+  if (depth > 0)
+    opts &= ~FTS_COMFOLLOW;
+
+  if (options.inode_order)
+    p = fts_open (arglist, opts, compare_inodes);
+  else
+    p = fts_open (arglist, opts, NULL);
   if (NULL == p)
     {
       error (0, errno, _("cannot search %s"),
@@ -563,6 +644,26 @@ find (char *arg)
   else
     {
       int level = INT_MIN;
+      bool batch = options.batch_stat
+	&& expression_needs_stat (get_eval_tree ());
+
+      p->fts_max_readdir_entries = options.readdir_batch;
+      if (options.snapshot_file)
+	p->fts_readdir = snapshot_readdir;
+      /* When -watch rescans a directory, the files in it which have
+       * not changed are not visited, so none of the tests are applied
+       * to them.
+       */
+      if (options.batch_eval && !since)
+	{
+	  evalbatch_start (base_level);
+	  p->fts_batch = evalbatch_dir;
+	}
+      if (options.threads > 1)
+	prefetch_start (arg, options.threads - 1);
+      /* -du adds up only what the search itself finds. */
+      if (!since)
+	du_begin ();
 
       while ( (ent=fts_read (p)) != NULL )
 	{
@@ -587,8 +688,29 @@ find (char *arg)
 	  state.have_stat = false;
 	  state.have_type = !!ent->fts_statp->st_mode;
 	  state.type = state.have_type ? ent->fts_statp->st_mode : 0;
+	  if (ent->fts_info != FTS_DP)
+	    du_arrive (ent->fts_path, ent->fts_level + base_level,
+		       ent->fts_info == FTS_D);
 	  consider_visiting (p, ent);
+	  if (ent->fts_info == FTS_DP)
+	    du_leave (ent->fts_level + base_level);
+
+	  if (batch && ent->fts_info == FTS_D && ent->fts_instr != FTS_SKIP)
+	    {
+	      int cwd_fd = p->fts_cwd_fd;
+	      statbatch_begin_dir (cwd_fd, ent, fts_children (p, 0));
+	    }
+	  if (options.watch && ent->fts_info == FTS_D
+	      && ent->fts_instr != FTS_SKIP)
+	    {
+	      watch_dir (ent->fts_path, ent->fts_level + base_level,
+			 state.starting_path_length);
+	    }
 	}
+      du_end ();
+      statbatch_stop ();
+      evalbatch_stop ();
+      prefetch_stop ();
       if (0 != fts_close (p))
 	{
 	  /* Here we break the abstraction of fts_close a bit, because we
@@ -698,6 +820,11 @@ main (int argc, char **argv)
    */
   eval_tree = build_expression_tree (argc, argv, end_of_leading_options);
 
+  if (options.snapshot_file)
+    snapshot_start (options.snapshot_file);
+  if (options.watch)
+    watch_start ();
+
   /* safely_chdir() needs to check that it has ended up in the right place.
    * To avoid bailing out when something gets automounted, it checks if
    * the target directory appears to have had a directory mounted on it as
@@ -729,6 +856,12 @@ main (int argc, char **argv)
        * partially-full command lines which have been built,
        * but which are not yet complete.   Execute those now.
        */
+      if (options.watch)
+	{
+	  /* Don't wait until we stop watching to save the snapshot. */
+	  snapshot_stop ();
+	  watch_loop (find_at_depth);
+	}
       show_success_rates (eval_tree);
       cleanup ();
     }
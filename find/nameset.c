@@ -0,0 +1,596 @@
+/* nameset.c -- match names against shell patterns without fnmatch.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Expressions like "-name '*.o' -o -name '*.tmp' -o -name core ..."
+ * are common, and can have hundreds of alternatives.  Calling fnmatch
+ * for each of them in turn makes the cost of each file proportional to
+ * the number of patterns.  The optimiser replaces such chains with a
+ * single test which uses a name set (see fuse_name_tests in tree.c).
+ *
+ * Most such patterns are of one of three simple forms, which we can
+ * match without calling fnmatch at all:
+ *
+ *   "core"     a literal name; we keep these in a hash table,
+ *   "*.o"      a suffix; we keep these in a trie of reversed strings,
+ *   "core.*"   a prefix; we keep these in a trie too.
+ *
+ * Matching against all of these together takes time proportional to
+ * the length of the name, not the number of patterns.  Any other
+ * patterns are still matched with fnmatch, one by one.
+ *
+ * The same is true of single -name tests, which are the ones find
+ * evaluates most often: glob_compile works out which of these forms a
+ * pattern has (or "*abc*", which we can match with strstr), and
+ * glob_match then does a string comparison instead of calling fnmatch.
+ *
+ * Comparing bytes gives the same answer as fnmatch as long as the
+ * characters of the pattern and the name line up in the same way.
+ * That is always true for literals and prefixes, but for suffixes we
+ * need a character set in which a character cannot end in the middle
+ * of another, so we only treat suffixes specially in single-byte
+ * locales and in UTF-8.  When ignoring case in a multibyte locale, we
+ * only fold ASCII letters, so we fall back on fnmatch for names which
+ * contain other characters.  Where folding ASCII letters is all that
+ * is needed, glob_match compares many bytes at once; see asciicase.c.
+ */
+
+#include <config.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "xalloc.h"
+#include "hash.h"
+#include "c-ctype.h"
+#include "c-strcase.h"
+#include "localcharset.h"
+#include "asciicase.h"
+#include "defs.h"
+
+enum
+  {
+    DefaultHashTableSize = 61,
+    TrieNone = -1
+  };
+
+/* Tries are kept in an array, and each node refers to its first
+ * child and next sibling by index.  Node 0 is the root.
+ */
+struct trie_node
+{
+  unsigned char c;
+  bool terminal;		/* a pattern ends here */
+  int child, sibling;
+};
+
+struct trie
+{
+  struct trie_node *nodes;
+  size_t used, alloc;
+};
+
+struct name_set
+{
+  bool casefold;
+  bool bytewise;		/* we can compare bytes at all */
+  bool bytewise_suffixes;	/* suffixes can be compared as bytes */
+  bool fold_ascii_only;		/* see fold_char */
+  Hash_table *literals;
+  struct trie prefixes;
+  struct trie suffixes;		/* stored in reverse */
+  char **others;		/* patterns we need fnmatch for */
+  size_t n_others, others_alloc;
+  char **all;			/* every pattern, for the fallback */
+  size_t n_all, all_alloc;
+};
+
+/* What we know about the locale; see check_locale.  For -iname in a
+ * single-byte locale, we fold case as fnmatch does.  In a multibyte
+ * locale we only fold ASCII letters.
+ */
+static bool locale_checked = false;
+static bool single_byte_locale;
+static bool bytewise_suffixes;	/* suffixes can be compared as bytes */
+static bool ascii_folding_ok;	/* fold_char agrees with fnmatch */
+static enum ascii_fold_scope fold_scope; /* where fold_char is c_tolower */
+
+static unsigned char
+fold_char (unsigned char c)
+{
+  return single_byte_locale ? tolower (c) : c_tolower (c);
+}
+
+
+static size_t
+literal_hash (const void *p, size_t buckets)
+{
+  const unsigned char *s = p;
+  size_t h = 0;
+  while (*s)
+    h = (h << 7 | h >> (sizeof h * CHAR_BIT - 7)) ^ *s++;
+  return h % buckets;
+}
+
+static bool
+literal_compare (const void *a, const void *b)
+{
+  return 0 == strcmp (a, b);
+}
+
+static size_t
+literal_hash_fold (const void *p, size_t buckets)
+{
+  const unsigned char *s = p;
+  size_t h = 0;
+  while (*s)
+    h = (h << 7 | h >> (sizeof h * CHAR_BIT - 7)) ^ fold_char (*s++);
+  return h % buckets;
+}
+
+static bool
+literal_compare_fold (const void *a, const void *b)
+{
+  const unsigned char *s = a, *t = b;
+  while (*s && fold_char (*s) == fold_char (*t))
+    ++s, ++t;
+  return fold_char (*s) == fold_char (*t);
+}
+
+
+static void
+trie_init (struct trie *t)
+{
+  t->alloc = 16;
+  t->nodes = xnmalloc (t->alloc, sizeof *t->nodes);
+  t->used = 1;
+  t->nodes[0].c = 0;
+  t->nodes[0].terminal = false;
+  t->nodes[0].child = t->nodes[0].sibling = TrieNone;
+}
+
+static int
+trie_find_child (const struct trie *t, int node, unsigned char c)
+{
+  int i;
+  for (i = t->nodes[node].child; i != TrieNone; i = t->nodes[i].sibling)
+    if (t->nodes[i].c == c)
+      return i;
+  return TrieNone;
+}
+
+/* Add the LEN bytes at S to T, backwards if STEP is -1. */
+static void
+trie_add (struct trie *t, const char *s, size_t len, int step,
+	  const struct name_set *set)
+{
+  int node = 0;
+  const unsigned char *p = (const unsigned char *) (step < 0 ? s + len - 1 : s);
+
+  for (; len--; p += step)
+    {
+      unsigned char c = set->casefold ? fold_char (*p) : *p;
+      int next = trie_find_child (t, node, c);
+      if (TrieNone == next)
+	{
+	  if (t->used == t->alloc)
+	    t->nodes = x2nrealloc (t->nodes, &t->alloc, sizeof *t->nodes);
+	  next = t->used++;
+	  t->nodes[next].c = c;
+	  t->nodes[next].terminal = false;
+	  t->nodes[next].child = TrieNone;
+	  t->nodes[next].sibling = t->nodes[node].child;
+	  t->nodes[node].child = next;
+	}
+      node = next;
+    }
+  t->nodes[node].terminal = true;
+}
+
+/* Does a pattern in T match the start (STEP 1) or end (STEP -1) of
+ * the LEN bytes at S?
+ */
+static bool
+trie_match (const struct trie *t, const char *s, size_t len, int step,
+	    const struct name_set *set)
+{
+  int node = 0;
+  const unsigned char *p = (const unsigned char *) (step < 0 ? s + len - 1 : s);
+
+  if (t->nodes[0].terminal)
+    return true;
+  for (; len--; p += step)
+    {
+      node = trie_find_child (t, node, set->casefold ? fold_char (*p) : *p);
+      if (TrieNone == node)
+	return false;
+      if (t->nodes[node].terminal)
+	return true;
+    }
+  return false;
+}
+
+
+static void
+check_locale (void)
+{
+  if (!locale_checked)
+    {
+      single_byte_locale = (1 == MB_CUR_MAX);
+      bytewise_suffixes = (single_byte_locale
+			   || 0 == c_strcasecmp (locale_charset (), "UTF-8"));
+      /* In a multibyte locale, fold_char folds ASCII letters only,
+       * which is only right if the locale agrees (it doesn't in
+       * Turkish, for example).
+       */
+      fold_scope = ascii_fold_scope ();
+      ascii_folding_ok = single_byte_locale || ASCII_FOLD_NONE != fold_scope;
+      locale_checked = true;
+    }
+}
+
+/* Is this a single-byte locale, or UTF-8?  In either, a run of bytes
+ * which spells out some text is found in a string exactly where the
+ * text occurs, so we can search for text byte by byte.
+ */
+bool
+locale_is_bytewise (void)
+{
+  check_locale ();
+  return bytewise_suffixes;
+}
+
+static bool
+is_ascii (const char *s)
+{
+  return ascii_only (s, strlen (s));
+}
+
+/* Work out which of the forms we know about PATTERN has, and set
+ * *LITERAL and *LEN to its fixed text.  Patterns containing a
+ * backslash are left to fnmatch.
+ */
+static enum glob_kind
+classify_pattern (const char *pattern, const char **literal, size_t *len)
+{
+  static const char specials[] = "*?[\\";
+  size_t n = strlen (pattern);
+  size_t plain = strcspn (pattern, specials);
+
+  *literal = pattern;
+  *len = n;
+  if (plain == n)
+    return GLOB_LITERAL;
+  if (plain == n - 1 && '*' == pattern[n - 1])
+    {
+      *len = n - 1;
+      return GLOB_PREFIX;
+    }
+  if ('*' == pattern[0])
+    {
+      plain = strcspn (pattern + 1, specials);
+      *literal = pattern + 1;
+      if (plain == n - 1)
+	{
+	  *len = n - 1;
+	  return GLOB_SUFFIX;
+	}
+      if (plain == n - 2 && '*' == pattern[n - 1])
+	{
+	  *len = n - 2;
+	  return GLOB_CONTAINS;
+	}
+    }
+  return GLOB_FNMATCH;
+}
+
+/* Make an empty name set, whose patterns will be matched with
+ * FNM_CASEFOLD if CASEFOLD is true.
+ */
+struct name_set *
+name_set_create (bool casefold)
+{
+  struct name_set *set = xzalloc (sizeof *set);
+
+  check_locale ();
+  set->casefold = casefold;
+  set->bytewise_suffixes = bytewise_suffixes;
+  set->fold_ascii_only = casefold && !single_byte_locale;
+  set->bytewise = ascii_folding_ok || !casefold;
+  set->literals = hash_initialize (DefaultHashTableSize, NULL,
+				   casefold ? literal_hash_fold : literal_hash,
+				   casefold ? literal_compare_fold
+				   : literal_compare,
+				   free);
+  if (NULL == set->literals)
+    xalloc_die ();
+  trie_init (&set->prefixes);
+  trie_init (&set->suffixes);
+  return set;
+}
+
+static void
+add_pattern_to_list (char ***list, size_t *n, size_t *alloc, char *pattern)
+{
+  if (*n == *alloc)
+    *list = x2nrealloc (*list, alloc, sizeof **list);
+  (*list)[(*n)++] = pattern;
+}
+
+/* Add the shell pattern PATTERN to SET. */
+void
+name_set_add (struct name_set *set, const char *pattern)
+{
+  const char *literal;
+  size_t len;
+  enum glob_kind kind = classify_pattern (pattern, &literal, &len);
+
+  add_pattern_to_list (&set->all, &set->n_all, &set->all_alloc,
+		       xstrdup (pattern));
+
+  /* We can only fold ASCII, so leave anything else to fnmatch. */
+  if (!set->bytewise || (set->fold_ascii_only && !is_ascii (pattern)))
+    kind = GLOB_FNMATCH;
+
+  if (GLOB_LITERAL == kind)
+    {
+      char *copy = xstrdup (pattern);
+      char *old = hash_insert (set->literals, copy);
+      if (NULL == old)
+	xalloc_die ();
+      if (old != copy)
+	free (copy);		/* a duplicate */
+    }
+  else if (GLOB_SUFFIX == kind && set->bytewise_suffixes)
+    {
+      trie_add (&set->suffixes, literal, len, -1, set);
+    }
+  else if (GLOB_PREFIX == kind)
+    {
+      trie_add (&set->prefixes, literal, len, 1, set);
+    }
+  else
+    {
+      add_pattern_to_list (&set->others, &set->n_others, &set->others_alloc,
+			   set->all[set->n_all - 1]);
+    }
+}
+
+/* Does any pattern in SET match NAME? */
+bool
+name_set_match (const struct name_set *set, const char *name)
+{
+  const int flags = set->casefold ? FNM_CASEFOLD : 0;
+  size_t i, len;
+
+  if (set->fold_ascii_only && !is_ascii (name))
+    {
+      for (i = 0; i < set->n_all; ++i)
+	if (0 == fnmatch (set->all[i], name, flags))
+	  return true;
+      return false;
+    }
+
+  len = strlen (name);
+  if (hash_get_n_entries (set->literals)
+      && hash_lookup (set->literals, name))
+    return true;
+  if (trie_match (&set->suffixes, name, len, -1, set)
+      || trie_match (&set->prefixes, name, len, 1, set))
+    return true;
+  for (i = 0; i < set->n_others; ++i)
+    if (0 == fnmatch (set->others[i], name, flags))
+      return true;
+  return false;
+}
+
+
+/* Compile PATTERN, a single -name or -path pattern, into G.  PATTERN
+ * must outlive G.
+ */
+void
+glob_compile (struct glob_val *g, const char *pattern, bool casefold)
+{
+  const char *literal;
+  char *p;
+
+  check_locale ();
+  g->pattern = pattern;
+  g->casefold = casefold;
+  g->fold_ascii_only = casefold && !single_byte_locale;
+  g->kind = classify_pattern (pattern, &literal, &g->len);
+  if ((GLOB_SUFFIX == g->kind || GLOB_CONTAINS == g->kind)
+      && !bytewise_suffixes)
+    g->kind = GLOB_FNMATCH;
+  if (casefold && (!ascii_folding_ok
+		   || (g->fold_ascii_only && !is_ascii (pattern))))
+    g->kind = GLOB_FNMATCH;
+
+  g->literal = NULL;
+  if (GLOB_FNMATCH != g->kind)
+    {
+      g->literal = xmalloc (g->len + 1u);
+      memcpy (g->literal, literal, g->len);
+      g->literal[g->len] = '\0';
+      if (casefold)
+	for (p = g->literal; *p; ++p)
+	  *p = fold_char (*p);
+    }
+}
+
+/* Are the LEN bytes at S the same as those at FOLDED, ignoring case?
+ * FOLDED is already case folded.  If FAST, folding ASCII letters is
+ * enough.
+ */
+static bool
+fold_equal (const char *s, const char *folded, size_t len, bool fast)
+{
+  const unsigned char *a = (const unsigned char *) s;
+  const unsigned char *b = (const unsigned char *) folded;
+
+  if (fast)
+    return ascii_fold_equal (s, folded, len);
+  for (; len; --len)
+    if (fold_char (*a++) != *b++)
+      return false;
+  return true;
+}
+
+/* Does the compiled pattern G match NAME? */
+bool
+glob_match (const struct glob_val *g, const char *name)
+{
+  size_t n;
+  bool fast;
+
+  if (GLOB_FNMATCH != g->kind && !g->casefold)
+    {
+      switch (g->kind)
+	{
+	case GLOB_LITERAL:
+	  return 0 == strcmp (name, g->literal);
+
+	case GLOB_PREFIX:
+	  return 0 == strncmp (name, g->literal, g->len);
+
+	case GLOB_SUFFIX:
+	  n = strlen (name);
+	  return n >= g->len
+	    && 0 == memcmp (name + n - g->len, g->literal, g->len);
+
+	case GLOB_CONTAINS:
+	  return NULL != strstr (name, g->literal);
+
+	default:
+	  abort ();
+	}
+    }
+
+  /* When ignoring case, we can compare many bytes at once if folding
+   * ASCII letters does the job, which is usually the case at least for
+   * names which are entirely ASCII.
+   */
+  fast = false;
+  if (GLOB_FNMATCH != g->kind)
+    {
+      n = strlen (name);
+      fast = (ASCII_FOLD_ALL == fold_scope
+	      || (ASCII_FOLD_ASCII == fold_scope && ascii_only (name, n)));
+    }
+
+  if (GLOB_FNMATCH == g->kind || (g->fold_ascii_only && !fast))
+    {
+      /* FNM_PERIOD is not used here because POSIX requires that it not be.
+       * See http://standards.ieee.org/reading/ieee/interp/1003-2-92_int/pasc-1003.2-126.html
+       */
+      return 0 == fnmatch (g->pattern, name, g->casefold ? FNM_CASEFOLD : 0);
+    }
+
+  switch (g->kind)
+    {
+    case GLOB_LITERAL:
+      return n == g->len && fold_equal (name, g->literal, n, fast);
+
+    case GLOB_PREFIX:
+      return n >= g->len && fold_equal (name, g->literal, g->len, fast);
+
+    case GLOB_SUFFIX:
+      return n >= g->len
+	&& fold_equal (name + n - g->len, g->literal, g->len, fast);
+
+    case GLOB_CONTAINS:
+      if (fast)
+	return NULL != ascii_fold_search (name, n, g->literal, g->len);
+      for (; n >= g->len; --n, ++name)
+	if (fold_equal (name, g->literal, g->len, false))
+	  return true;
+      return false;
+
+    default:
+      abort ();
+    }
+}
+
+
+/* Could PATTERN match the path of any file below the directory DIR?
+ * Their paths all begin with DIR and a slash (fts and find.c don't add
+ * one if DIR already ends with a slash), followed by at least one more
+ * character.  We only say no when we are sure.
+ *
+ * Since a "*" can match anything, including a slash, this is true if
+ * the part of PATTERN before its first "*" could match the start of
+ * the path, and we only need to compare that part.
+ */
+static bool
+pattern_may_match_below (const char *pattern, bool casefold, const char *dir)
+{
+  const unsigned char *p = (const unsigned char *) pattern;
+  const size_t dirlen = strlen (dir);
+  const size_t len = dirlen + ((dirlen && '/' == dir[dirlen - 1]) ? 0 : 1);
+  size_t i;
+
+  check_locale ();
+  if (!bytewise_suffixes || (casefold && !single_byte_locale))
+    return true;
+
+  for (i = 0; i < len; ++i)
+    {
+      const unsigned char s = (i < dirlen) ? dir[i] : '/';
+      unsigned char c = *p++;
+
+      if ('\0' == c)
+	return false;		/* the pattern is too short */
+      else if ('*' == c || '[' == c)
+	return true;		/* we don't look at bracket expressions */
+      else if ('?' == c)
+	{
+	  /* In a multibyte locale, "?" can match several bytes. */
+	  if (!single_byte_locale)
+	    return true;
+	  continue;
+	}
+      else if ('\\' == c)
+	{
+	  if ('\0' == *p)
+	    return true;
+	  c = *p++;
+	}
+      if (casefold ? fold_char (c) != fold_char (s) : c != s)
+	return false;
+    }
+  /* Whatever is left of the pattern has to match the rest of the path. */
+  return '\0' != *p;
+}
+
+/* Could the compiled pattern G match the path of any file below DIR? */
+bool
+glob_may_match_below (const struct glob_val *g, const char *dir)
+{
+  return pattern_may_match_below (g->pattern, g->casefold, dir);
+}
+
+/* Could any pattern in SET match the path of any file below DIR? */
+bool
+name_set_may_match_below (const struct name_set *set, const char *dir)
+{
+  size_t i;
+  for (i = 0; i < set->n_all; ++i)
+    if (pattern_may_match_below (set->all[i], set->casefold, dir))
+      return true;
+  return false;
+}
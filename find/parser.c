@@ -46,6 +46,7 @@
 #include "fdleak.h"
 
 #include <fcntl.h>
+#include <wchar.h>
 
 
 /* The presence of unistd.h is assumed by gnulib these days, so we
@@ -90,13 +91,24 @@ static bool parse_accesscheck   (const struct parser_table*, char *argv[], int *
 static bool parse_amin          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_and           (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_anewer        (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_batch_eval    (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_batch_stat    (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_cached_stat   (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_calibrate     (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_cmin          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_cnewer        (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_comma         (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_contains      (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_containsregex (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_contents_limit (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_contents_nobinary (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_daystart      (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_delete        (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_d             (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_depth         (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_du            (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_du_apparent_size (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_duplicates    (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_empty         (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_exec          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_execdir       (const struct parser_table*, char *argv[], int *arg_ptr);
@@ -107,11 +119,13 @@ static bool parse_follow        (const struct parser_table*, char *argv[], int *
 static bool parse_fprint        (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_fprint0       (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_fstype        (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_histogram     (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_gid           (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_group         (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_help          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_ilname        (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_iname         (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_inode_order   (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_inum          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_ipath         (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_iregex        (const struct parser_table*, char *argv[], int *arg_ptr);
@@ -137,18 +151,25 @@ static bool parse_path          (const struct parser_table*, char *argv[], int *
 static bool parse_perm          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_print0        (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_printf        (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_profile       (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_prune         (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_readdir_batch (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_regex         (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_regextype     (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_snapshot      (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_samefile      (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_sha256sum     (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_size          (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_threads       (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_time          (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_top           (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_true          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_type          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_uid           (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_used          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_user          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_version       (const struct parser_table*, char *argv[], int *arg_ptr);
+static bool parse_watch         (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_wholename     (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_xdev          (const struct parser_table*, char *argv[], int *arg_ptr);
 static bool parse_ignore_race   (const struct parser_table*, char *argv[], int *arg_ptr);
@@ -252,14 +273,25 @@ static struct parser_table const parse_table[] =
   PARSE_PUNCTUATION("and",                   and),		/* GNU */
   PARSE_TEST       ("anewer",                anewer),	     /* GNU */
   {ARG_TEST,       "atime",                  parse_time, pred_atime}, /* POSIX */
+  PARSE_OPTION     ("batch_eval",            batch_eval),   /* GNU */
+  PARSE_OPTION     ("batch_stat",            batch_stat),   /* GNU */
+  PARSE_OPTION     ("cached_stat",           cached_stat),  /* GNU */
+  PARSE_OPTION     ("calibrate",             calibrate),    /* GNU */
   PARSE_TEST       ("cmin",                  cmin),	     /* GNU */
   PARSE_TEST       ("cnewer",                cnewer),	     /* GNU */
   {ARG_TEST,       "ctime",                  parse_time, pred_ctime}, /* POSIX */
   PARSE_TEST       ("context",               context),      /* GNU */
+  PARSE_TEST       ("contains",              contains),     /* GNU */
+  {ARG_TEST,       "containsregex",          parse_containsregex, pred_contains}, /* GNU */
+  PARSE_POSOPT     ("contents_limit",        contents_limit), /* GNU */
+  PARSE_POSOPT     ("contents_nobinary",     contents_nobinary), /* GNU */
   PARSE_POSOPT     ("daystart",              daystart),	     /* GNU */
   PARSE_ACTION     ("delete",                delete), /* GNU, Mac OS, FreeBSD */
   PARSE_OPTION     ("d",                     d), /* Mac OS X, FreeBSD, NetBSD, OpenBSD, but deprecated  in favour of -depth */
   PARSE_OPTION     ("depth",                 depth), /* POSIX */
+  PARSE_ACTION     ("du",                    du),	     /* GNU */
+  PARSE_POSOPT     ("du_apparent_size",      du_apparent_size), /* GNU */
+  PARSE_ACTION     ("duplicates",            duplicates),    /* GNU */
   PARSE_TEST       ("empty",                 empty),	     /* GNU */
   {ARG_ACTION,      "exec",    parse_exec, pred_exec}, /* POSIX */
   {ARG_TEST,        "executable",            parse_accesscheck, pred_executable}, /* GNU, 4.3.0+ */
@@ -271,10 +303,12 @@ static struct parser_table const parse_table[] =
   {ARG_ACTION,      "fprintf", parse_fprintf, pred_fprintf}, /* GNU */
   PARSE_TEST       ("fstype",                fstype),  /* GNU, Unix */
   PARSE_TEST       ("gid",                   gid),	     /* GNU */
+  PARSE_ACTION     ("histogram",             histogram),     /* GNU */
   PARSE_TEST       ("group",                 group), /* POSIX */
   PARSE_OPTION     ("ignore_readdir_race",   ignore_race),   /* GNU */
   PARSE_TEST       ("ilname",                ilname),	     /* GNU */
   PARSE_TEST       ("iname",                 iname),	     /* GNU */
+  PARSE_OPTION     ("inode_order",           inode_order),  /* GNU */
   PARSE_TEST       ("inum",                  inum),    /* GNU, Unix */
   PARSE_TEST       ("ipath",                 ipath), /* GNU, deprecated in favour of iwholename */
   PARSE_TEST_NP    ("iregex",                iregex),	     /* GNU */
@@ -307,21 +341,28 @@ static struct parser_table const parse_table[] =
   PARSE_ACTION     ("print",                 print), /* POSIX */
   PARSE_ACTION     ("print0",                print0),	     /* GNU */
   {ARG_ACTION,      "printf",   parse_printf, NULL},	     /* GNU */
+  PARSE_OPTION     ("profile",               profile),      /* GNU */
   PARSE_ACTION     ("prune",                 prune), /* POSIX */
   PARSE_ACTION     ("quit",                  quit),	     /* GNU */
   {ARG_TEST,       "readable",            parse_accesscheck, pred_readable}, /* GNU, 4.3.0+ */
+  PARSE_OPTION     ("readdir_batch",         readdir_batch), /* GNU */
   PARSE_TEST       ("regex",                 regex),	     /* GNU */
   PARSE_POSOPT     ("regextype",             regextype),     /* GNU */
   PARSE_TEST       ("samefile",              samefile),	     /* GNU */
+  PARSE_ACTION     ("sha256sum",             sha256sum),     /* GNU */
 #if 0
   PARSE_OPTION     ("show-control-chars",    show_control_chars), /* GNU, 4.3.0+ */
 #endif
   PARSE_TEST       ("size",                  size), /* POSIX */
+  PARSE_OPTION     ("snapshot",              snapshot),     /* GNU */
+  PARSE_OPTION     ("threads",               threads),	     /* GNU */
+  PARSE_ACTION     ("top",                   top),	     /* GNU */
   PARSE_TEST       ("type",                  type), /* POSIX */
   PARSE_TEST       ("uid",                   uid),	     /* GNU */
   PARSE_TEST       ("used",                  used),	     /* GNU */
   PARSE_TEST       ("user",                  user), /* POSIX */
   PARSE_OPTION     ("warn",                  warn),	     /* GNU */
+  PARSE_OPTION     ("watch",                 watch),        /* GNU */
   PARSE_TEST_NP    ("wholename",             wholename), /* GNU, replaced -path, but anyway -path will soon be in POSIX */
   {ARG_TEST,       "writable",               parse_accesscheck, pred_writable}, /* GNU, 4.3.0+ */
   PARSE_OPTION     ("xdev",                  xdev), /* POSIX */
@@ -905,6 +946,32 @@ parse_depth (const struct parser_table* entry, char **argv, int *arg_ptr)
   return parse_noop (entry, argv, arg_ptr);
 }
 
+static bool
+parse_du (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  struct predicate *our_pred;
+
+  (void) argv;
+  (void) arg_ptr;
+
+  our_pred = insert_primary_noarg (entry);
+  our_pred->side_effects = our_pred->no_default_print = true;
+  our_pred->need_stat = true;
+  our_pred->need_type = false;
+  our_pred->est_success_rate = 1.0f;
+  open_stdout (&our_pred->args.du.dest);
+  our_pred->args.du.apparent_size = options.du_apparent_size;
+  du_new (&our_pred->args.du);
+  return true;
+}
+
+static bool
+parse_du_apparent_size (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.du_apparent_size = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
 static bool
 parse_d (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -1235,7 +1302,9 @@ operators (decreasing precedence; -and is implicit where no others are given):\n
 positional options (always true): -daystart -follow -regextype\n\n\
 normal options (always true, specified before other expressions):\n\
       -depth --help -maxdepth LEVELS -mindepth LEVELS -mount -noleaf\n\
-      --version -xdev -ignore_readdir_race -noignore_readdir_race\n"));
+      --version -xdev -ignore_readdir_race -noignore_readdir_race\n\
+      -threads N -cached_stat -batch_stat -inode_order -readdir_batch N\n\
+      -snapshot FILE -watch -profile FILE -batch_eval -calibrate\n"));
   puts (_("\
 tests (N can be +N or -N or N): -amin N -anewer FILE -atime N -cmin N\n\
       -cnewer FILE -ctime N -empty -false -fstype TYPE -gid N -group NAME\n\
@@ -1281,7 +1350,7 @@ parse_ilname (const struct parser_table* entry, char **argv, int *arg_ptr)
   if (collect_arg (argv, arg_ptr, &name))
     {
       struct predicate *our_pred = insert_primary (entry, name);
-      our_pred->args.str = name;
+      glob_compile (&our_pred->args.glob, name, true);
       /* Use the generic glob pattern estimator to figure out how many
        * links will match, but bear in mind that most files won't be links.
        */
@@ -1350,7 +1419,7 @@ parse_iname (const struct parser_table* entry, char **argv, int *arg_ptr)
 	{
 	  struct predicate *our_pred = insert_primary (entry, name);
 	  our_pred->need_stat = our_pred->need_type = false;
-	  our_pred->args.str = name;
+	  glob_compile (&our_pred->args.glob, name, true);
 	  our_pred->est_success_rate = estimate_pattern_match_rate (name, 0);
 	  return true;
 	}
@@ -1415,7 +1484,7 @@ parse_lname (const struct parser_table* entry, char **argv, int *arg_ptr)
   if (collect_arg (argv, arg_ptr, &name))
     {
       struct predicate *our_pred = insert_primary (entry, name);
-      our_pred->args.str = name;
+      glob_compile (&our_pred->args.glob, name, false);
       our_pred->est_success_rate = 0.1 * estimate_pattern_match_rate (name, 0);
       return true;
     }
@@ -1537,7 +1606,7 @@ parse_name (const struct parser_table* entry, char **argv, int *arg_ptr)
 	{
 	  struct predicate *our_pred = insert_primary (entry, name);
 	  our_pred->need_stat = our_pred->need_type = false;
-	  our_pred->args.str = name;
+	  glob_compile (&our_pred->args.glob, name, false);
 	  our_pred->est_success_rate = estimate_pattern_match_rate (name, 0);
 	  return true;
 	}
@@ -1586,6 +1655,21 @@ parse_newer (const struct parser_table* entry, char **argv, int *arg_ptr)
 }
 
 
+/* Return the StatFields value for the timestamp XV. */
+static unsigned int
+xval_stat_field (enum xval xv)
+{
+  switch (xv)
+    {
+    case XVAL_ATIME:     return StatFieldAtime;
+    case XVAL_BIRTHTIME: return StatFieldBtime;
+    case XVAL_CTIME:     return StatFieldCtime;
+    case XVAL_MTIME:     return StatFieldMtime;
+    case XVAL_TIME:      break;
+    }
+  return StatFieldAll;
+}
+
 static bool
 parse_newerXY (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -1695,6 +1779,7 @@ parse_newerXY (const struct parser_table* entry, char **argv, int *arg_ptr)
 	    }
 	  our_pred->args.reftime.kind = COMP_GT;
 	  our_pred->est_success_rate = estimate_timestamp_success_rate (our_pred->args.reftime.ts.tv_sec);
+	  our_pred->stat_fields = xval_stat_field (our_pred->args.reftime.xval);
 	  (*arg_ptr)++;
 
 	  assert (our_pred->pred_func != NULL);
@@ -1713,22 +1798,6 @@ parse_noleaf (const struct parser_table* entry, char **argv, int *arg_ptr)
   return parse_noop (entry, argv, arg_ptr);
 }
 
-#ifdef CACHE_IDS
-/* Arbitrary amount by which to increase size
-   of `uid_unused' and `gid_unused'. */
-#define ALLOC_STEP 2048
-
-/* Boolean: if uid_unused[n] is nonzero, then UID n has no passwd entry. */
-char *uid_unused = NULL;
-
-/* Number of elements in `uid_unused'. */
-unsigned uid_allocated;
-
-/* Similar for GIDs and group entries. */
-char *gid_unused = NULL;
-unsigned gid_allocated;
-#endif
-
 static bool
 parse_nogroup (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -1739,30 +1808,6 @@ parse_nogroup (const struct parser_table* entry, char **argv, int *arg_ptr)
 
   our_pred = insert_primary (entry, NULL);
   our_pred->est_success_rate = 1e-4;
-#ifdef CACHE_IDS
-  if (gid_unused == NULL)
-    {
-      struct group *gr;
-
-      gid_allocated = ALLOC_STEP;
-      gid_unused = xmalloc (gid_allocated);
-      memset (gid_unused, 1, gid_allocated);
-      setgrent ();
-      while ((gr = getgrent ()) != NULL)
-	{
-	  if ((unsigned) gr->gr_gid >= gid_allocated)
-	    {
-	      unsigned new_allocated = (unsigned) gr->gr_gid + ALLOC_STEP;
-	      gid_unused = xrealloc (gid_unused, new_allocated);
-	      memset (gid_unused + gid_allocated, 1,
-		      new_allocated - gid_allocated);
-	      gid_allocated = new_allocated;
-	    }
-	  gid_unused[(unsigned) gr->gr_gid] = 0;
-	}
-      endgrent ();
-    }
-#endif
   return true;
 }
 
@@ -1776,30 +1821,6 @@ parse_nouser (const struct parser_table* entry, char **argv, int *arg_ptr)
 
   our_pred = insert_primary_noarg (entry);
   our_pred->est_success_rate = 1e-3;
-#ifdef CACHE_IDS
-  if (uid_unused == NULL)
-    {
-      struct passwd *pw;
-
-      uid_allocated = ALLOC_STEP;
-      uid_unused = xmalloc (uid_allocated);
-      memset (uid_unused, 1, uid_allocated);
-      setpwent ();
-      while ((pw = getpwent ()) != NULL)
-	{
-	  if ((unsigned) pw->pw_uid >= uid_allocated)
-	    {
-	      unsigned new_allocated = (unsigned) pw->pw_uid + ALLOC_STEP;
-	      uid_unused = xrealloc (uid_unused, new_allocated);
-	      memset (uid_unused + uid_allocated, 1,
-		      new_allocated - uid_allocated);
-	      uid_allocated = new_allocated;
-	    }
-	  uid_unused[(unsigned) pw->pw_uid] = 0;
-	}
-      endpwent ();
-    }
-#endif
   return true;
 }
 
@@ -1891,7 +1912,7 @@ insert_path_check (const struct parser_table* entry, char **argv, int *arg_ptr,
     {
       struct predicate *our_pred = insert_primary_withpred (entry, pred, name);
       our_pred->need_stat = our_pred->need_type = false;
-      our_pred->args.str = name;
+      glob_compile (&our_pred->args.glob, name, foldcase);
       our_pred->est_success_rate = estimate_pattern_match_rate (name, 0);
 
       if (!options.posixly_correct
@@ -2198,6 +2219,307 @@ parse_quit  (const struct parser_table* entry, char **argv, int *arg_ptr)
 }
 
 
+/* The kinds of thing find_regex_filters finds in a regex. */
+enum regex_token
+  {
+    RegexLiteral,		/* text which matches itself */
+    RegexQuantifier,		/* "*", "\\{2\\}" and so on */
+    RegexOpen,			/* the start of a group */
+    RegexClose,			/* the end of one */
+    RegexAnchor,		/* a "$" which ends the regex */
+    RegexOther			/* "." and anything else */
+  };
+
+/* The filters found so far, as shell patterns. */
+struct regex_filters
+{
+  char *prefix, *suffix, *middle;
+  size_t middle_len;
+};
+
+/* Move *POS past the bracket expression which starts there.  Return
+ * false if it never ends.
+ */
+static bool
+skip_bracket (const char *rx, size_t *pos, int syntax)
+{
+  size_t i = *pos + 1;
+
+  if ('^' == rx[i])
+    ++i;
+  if (']' == rx[i])
+    ++i;
+  while (']' != rx[i])
+    {
+      if ('\0' == rx[i])
+	return false;
+      if ('[' == rx[i] && rx[i + 1] && strchr (":.=", rx[i + 1]))
+	{
+	  /* [:alpha:], [.a.] or [=a=] */
+	  const char close = rx[i + 1];
+	  for (i += 2; rx[i] != close || rx[i + 1] != ']'; ++i)
+	    if ('\0' == rx[i])
+	      return false;
+	  i += 2;
+	}
+      else if ('\\' == rx[i] && (syntax & RE_BACKSLASH_ESCAPE_IN_LISTS)
+	       && rx[i + 1])
+	{
+	  i += 2;
+	}
+      else
+	{
+	  ++i;
+	}
+    }
+  *pos = i + 1;
+  return true;
+}
+
+/* Move *POS past the interval ("{2,3}", or "\\{2,3\\}" if BK_BRACES)
+ * whose contents start there.  Return false if it is not made up of
+ * digits and commas, since we then cannot tell what it is.
+ */
+static bool
+skip_interval (const char *rx, size_t *pos, bool bk_braces)
+{
+  size_t i = *pos;
+
+  while (ISDIGIT (rx[i]) || ',' == rx[i])
+    ++i;
+  if (bk_braces && '\\' == rx[i])
+    ++i;
+  if ('}' != rx[i])
+    return false;
+  *pos = i + 1;
+  return true;
+}
+
+/* Make the shell pattern which matches LEN bytes of TEXT, preceded by
+ * anything if STAR_BEFORE, and followed by anything if STAR_AFTER.
+ */
+static char *
+literal_glob (const char *text, size_t len, bool star_before, bool star_after)
+{
+  char *glob = xmalloc (len + 3u);
+  char *p = glob;
+
+  if (star_before)
+    *p++ = '*';
+  memcpy (p, text, len);
+  p += len;
+  if (star_after)
+    *p++ = '*';
+  *p = '\0';
+  return glob;
+}
+
+/* Note that every path the regex matches must contain the LEN bytes
+ * of RUN.  AT_START and AT_END say whether the regex starts or ends
+ * with it.
+ */
+static void
+note_regex_literal (struct regex_filters *f, const char *run, size_t len,
+		    bool at_start, bool at_end)
+{
+  if (0 == len)
+    return;
+  if (at_start)
+    f->prefix = literal_glob (run, len, false, !at_end);
+  else if (at_end)
+    f->suffix = literal_glob (run, len, true, false);
+  else if (len > f->middle_len)
+    {
+      free (f->middle);
+      f->middle = literal_glob (run, len, true, true);
+      f->middle_len = len;
+    }
+}
+
+/* Does case folding with tolower make the same characters equal as
+ * the regex matcher, which uses toupper, does?
+ */
+static bool
+folding_agrees (void)
+{
+  int c;
+  for (c = 0; c <= UCHAR_MAX; ++c)
+    if (toupper (tolower (c)) != toupper (c)
+	|| tolower (toupper (c)) != tolower (c))
+      return false;
+  return true;
+}
+
+/* Look for text which every path matched by the regex RX (whose syntax
+ * is SYNTAX) must contain, and turn it into filters for R, so that
+ * pred_regex can reject most paths without running the regex matcher.
+ * Since the regex must match the whole path, text at the start or end
+ * of the regex must be at the start or end of the path.
+ *
+ * We only need to understand enough of the syntax to be sure that
+ * text we find really is required: we give up on alternation, and
+ * ignore groups, bracket expressions, back references and anything
+ * else we don't recognise, and the character before any quantifier.
+ * Since we treat any "+" or "?" as a quantifier, we do not need to
+ * know whether the syntax makes them one.  Braces are different: a
+ * "{" which does not start an interval is a literal, and an interval
+ * is skipped as a whole, so we have to know which form of brace, if
+ * any, the syntax uses for intervals.
+ */
+static void
+find_regex_filters (const char *rx, int syntax, struct regex_val *r)
+{
+  const size_t n = strlen (rx);
+  const bool icase = (syntax & RE_ICASE) != 0;
+  const bool bk_parens = !(syntax & RE_NO_BK_PARENS);
+  const bool intervals = (syntax & RE_INTERVALS) != 0;
+  const bool bk_braces = !(syntax & RE_NO_BK_BRACES);
+  const size_t body = ('^' == rx[0]) ? 1u : 0u;
+  struct regex_filters f = { NULL, NULL, NULL, 0 };
+  char *run = xmalloc (n + 1u);
+  size_t run_len = 0, run_start = 0, last_char = 0, i;
+  int depth = 0;
+  bool ok = true;
+  char *filters[MaxRegexFilters];
+  int k;
+
+  r->n_filters = 0;
+  if (!locale_is_bytewise ()
+      || (icase && (MB_CUR_MAX > 1 || !folding_agrees ())))
+    ok = false;
+
+  for (i = body; ok && i < n; )
+    {
+      const size_t start = i;
+      const unsigned char c = rx[i];
+      enum regex_token tok = RegexOther;
+      size_t len = 1;
+
+      if ('\\' == c)
+	{
+	  const unsigned char d = rx[i + 1];
+	  i += 2;
+	  if ('\0' == d || '|' == d || d >= 0x80)
+	    ok = false;
+	  else if (strchr (".^$]", d))
+	    tok = RegexLiteral;
+	  else if (bk_parens && '(' == d)
+	    tok = RegexOpen;
+	  else if (bk_parens && ')' == d)
+	    tok = RegexClose;
+	  else if ('+' == d || '?' == d)
+	    tok = RegexQuantifier;
+	  else if ('{' == d && intervals && bk_braces)
+	    {
+	      tok = RegexQuantifier;
+	      ok = skip_interval (rx, &i, true);
+	    }
+	}
+      else if ('[' == c)
+	{
+	  ok = skip_bracket (rx, &i, syntax);
+	}
+      else if ('|' == c || '\n' == c)
+	{
+	  ok = false;
+	}
+      else if (!bk_parens && ('(' == c || ')' == c))
+	{
+	  ++i;
+	  tok = ('(' == c) ? RegexOpen : RegexClose;
+	}
+      else if ('{' == c && intervals && !bk_braces)
+	{
+	  ++i;
+	  tok = RegexQuantifier;
+	  ok = skip_interval (rx, &i, false);
+	}
+      else if (strchr ("*+?", c))
+	{
+	  ++i;
+	  tok = RegexQuantifier;
+	}
+      else if ('$' == c && n == i + 1)
+	{
+	  ++i;
+	  tok = RegexAnchor;
+	}
+      else if (strchr (".^$()]}", c))
+	{
+	  ++i;
+	}
+      else
+	{
+	  if (MB_CUR_MAX > 1)
+	    {
+	      mbstate_t mbstate;
+	      memset (&mbstate, 0, sizeof mbstate);
+	      len = mbrlen (rx + i, n - i, &mbstate);
+	      if ((size_t) -1 == len || (size_t) -2 == len)
+		ok = false;
+	    }
+	  tok = RegexLiteral;
+	  i += len;
+	}
+      if (!ok)
+	break;
+
+      switch (tok)
+	{
+	case RegexLiteral:
+	  /* Escaped characters are one byte; others are the whole character. */
+	  if (0 == run_len)
+	    run_start = start;
+	  last_char = run_len;
+	  memcpy (run + run_len, rx + i - len, len);
+	  run_len += len;
+	  break;
+
+	case RegexAnchor:
+	  break;
+
+	default:
+	  /* A quantifier applies to the character before it. */
+	  if (RegexQuantifier == tok && run_len)
+	    run_len = last_char;
+	  if (0 == depth)
+	    note_regex_literal (&f, run, run_len, body == run_start, false);
+	  run_len = 0;
+	  if (RegexOpen == tok)
+	    ++depth;
+	  else if (RegexClose == tok && 0 == depth--)
+	    ok = false;
+	  break;
+	}
+    }
+  if (ok && 0 == depth)
+    note_regex_literal (&f, run, run_len, body == run_start, true);
+  free (run);
+
+  filters[0] = f.prefix;
+  filters[1] = f.suffix;
+  filters[2] = f.middle;
+  for (k = 0; k < MaxRegexFilters; ++k)
+    {
+      if (NULL == filters[k])
+	continue;
+      if (ok)
+	{
+	  struct glob_val *g = &r->filters[r->n_filters];
+	  glob_compile (g, filters[k], icase);
+	  if (GLOB_FNMATCH != g->kind)
+	    {
+	      if (options.debug_options & DebugTreeOpt)
+		fprintf (stderr, "Paths matching the regex %s must match %s\n",
+			 rx, filters[k]);
+	      ++r->n_filters;
+	      continue;
+	    }
+	}
+      free (filters[k]);
+    }
+}
+
 static bool
 parse_regextype (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -2232,7 +2554,7 @@ insert_regex (char **argv,
       struct predicate *our_pred = insert_primary_withpred (entry, pred_regex, rx);
       our_pred->need_stat = our_pred->need_type = false;
       re = xmalloc (sizeof (struct re_pattern_buffer));
-      our_pred->args.regex = re;
+      our_pred->args.regex.re = re;
       re->allocated = 100;
       re->buffer = xmalloc (re->allocated);
       re->fastmap = NULL;
@@ -2244,12 +2566,114 @@ insert_regex (char **argv,
       error_message = re_compile_pattern (rx, strlen (rx), re);
       if (error_message)
 	error (EXIT_FAILURE, 0, "%s", error_message);
+      find_regex_filters (rx, regex_options, &our_pred->args.regex);
       our_pred->est_success_rate = estimate_pattern_match_rate (rx, 1);
       return true;
     }
   return false;
 }
 
+/* Insert a -contains or -containsregex test, for which the
+ * positional options before it set the size limit and whether to
+ * skip binary files.
+ */
+static struct predicate *
+insert_contents (const struct parser_table *entry, const char *arg)
+{
+  struct predicate *our_pred = insert_primary_withpred (entry, pred_contains,
+							arg);
+  our_pred->need_stat = true;
+  our_pred->need_type = false;
+  our_pred->est_success_rate = 0.1f;
+  our_pred->args.contents.text = NULL;
+  our_pred->args.contents.len = 0u;
+  our_pred->args.contents.re = NULL;
+  our_pred->args.contents.limit = options.contents_limit;
+  our_pred->args.contents.nobinary = options.nobinary_contents;
+  return our_pred;
+}
+
+static bool
+parse_contains (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *text;
+  if (collect_arg (argv, arg_ptr, &text))
+    {
+      struct predicate *our_pred = insert_contents (entry, text);
+      our_pred->args.contents.text = text;
+      our_pred->args.contents.len = strlen (text);
+      return true;
+    }
+  return false;
+}
+
+static bool
+parse_containsregex (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *rx;
+  if (collect_arg (argv, arg_ptr, &rx))
+    {
+      struct predicate *our_pred = insert_contents (entry, rx);
+      struct re_pattern_buffer *re = xmalloc (sizeof *re);
+      struct regex_val filters;
+      int i;
+      /* Matches must lie within a line; see lines_match.  */
+      int syntax = ((options.regex_options | RE_HAT_LISTS_NOT_NEWLINE)
+		    & ~RE_DOT_NEWLINE);
+      const char *error_message;
+
+      re->allocated = 100;
+      re->buffer = xmalloc (re->allocated);
+      re->fastmap = xmalloc (UCHAR_MAX + 1);
+      re->translate = NULL;
+      re_set_syntax (syntax);
+      re->syntax = syntax;
+      error_message = re_compile_pattern (rx, strlen (rx), re);
+      if (error_message)
+	error (EXIT_FAILURE, 0, "%s", error_message);
+      our_pred->args.contents.re = re;
+
+      /* Only look for a match in the lines of blocks which contain
+       * the longest text that every match must contain.
+       */
+      find_regex_filters (rx, syntax, &filters);
+      for (i = 0; i < filters.n_filters; ++i)
+	{
+	  const struct glob_val *g = &filters.filters[i];
+	  if (!g->casefold && g->len > our_pred->args.contents.len)
+	    {
+	      our_pred->args.contents.text = g->literal;
+	      our_pred->args.contents.len = g->len;
+	    }
+	}
+      return true;
+    }
+  return false;
+}
+
+static bool
+parse_contents_limit (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *arg;
+  uintmax_t limit;
+  if (collect_arg (argv, arg_ptr, &arg))
+    {
+      if (LONGINT_OK != xstrtoumax (arg, NULL, 10, &limit, "ckMG"))
+	error (EXIT_FAILURE, 0, _("Invalid argument %s to -contents_limit"),
+	       quotearg_n_style (0, options.err_quoting_style, arg));
+      options.contents_limit = limit;
+      return parse_noop (entry, argv, arg_ptr);
+    }
+  return false;
+}
+
+static bool
+parse_contents_nobinary (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.nobinary_contents = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
 static bool
 parse_size (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -2503,6 +2927,23 @@ parse_samefile (const struct parser_table* entry, char **argv, int *arg_ptr)
   return true;
 }
 
+static bool
+parse_sha256sum (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  struct predicate *our_pred;
+
+  (void) argv;
+  (void) arg_ptr;
+
+  our_pred = insert_primary_noarg (entry);
+  our_pred->side_effects = our_pred->no_default_print = true;
+  our_pred->need_stat = true;
+  our_pred->need_type = false;
+  our_pred->est_success_rate = 0.9f;
+  open_stdout (&our_pred->args.printf_vec);
+  return true;
+}
+
 #if 0
 /* This function is commented out partly because support for it is
  * uneven.
@@ -2546,6 +2987,82 @@ parse_show_control_chars (const struct parser_table* entry,
 #endif
 
 
+/* Set up OUR_PRED, which is -top or -histogram. */
+static void
+insert_report (struct predicate *our_pred)
+{
+  our_pred->side_effects = our_pred->no_default_print = true;
+  our_pred->need_stat = true;
+  our_pred->need_type = false;
+  our_pred->est_success_rate = 1.0f;
+  open_stdout (&our_pred->args.report.dest);
+}
+
+static bool
+parse_top (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *countstr, *field;
+  uintmax_t count;
+  int saved_argc = *arg_ptr;
+
+  if (collect_arg (argv, arg_ptr, &countstr)
+      && collect_arg (argv, arg_ptr, &field))
+    {
+      struct predicate *our_pred;
+
+      if (LONGINT_OK != xstrtoumax (countstr, NULL, 10, &count, "")
+	  || 0u == count || count > SIZE_MAX / 2u)
+	error (EXIT_FAILURE, 0, _("Invalid argument %s to -top"),
+	       quotearg_n_style (0, options.err_quoting_style, countstr));
+      our_pred = insert_primary_noarg (entry);
+      insert_report (our_pred);
+      if (!report_new_top (&our_pred->args.report, count, field))
+	error (EXIT_FAILURE, 0,
+	       _("-top can order files by size, atime, ctime or mtime, "
+		 "not %s"),
+	       quotearg_n_style (0, options.err_quoting_style, field));
+      return true;
+    }
+  *arg_ptr = saved_argc;
+  return false;
+}
+
+static bool
+parse_duplicates (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  struct predicate *our_pred;
+
+  (void) argv;
+  (void) arg_ptr;
+
+  our_pred = insert_primary_noarg (entry);
+  insert_report (our_pred);
+  our_pred->est_success_rate = 0.5f;
+  report_new_duplicates (&our_pred->args.report);
+  return true;
+}
+
+static bool
+parse_histogram (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *fields;
+
+  if (collect_arg (argv, arg_ptr, &fields))
+    {
+      struct predicate *our_pred = insert_primary (entry, fields);
+
+      insert_report (our_pred);
+      if (!report_new_histogram (&our_pred->args.report, fields))
+	error (EXIT_FAILURE, 0,
+	       _("Invalid argument %s to -histogram; it should be one or two "
+		 "of size, atime, ctime, mtime, user, group and type, "
+		 "separated by a comma"),
+	       quotearg_n_style (0, options.err_quoting_style, fields));
+      return true;
+    }
+  return false;
+}
+
 static bool
 parse_true (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -2560,6 +3077,103 @@ parse_true (const struct parser_table* entry, char **argv, int *arg_ptr)
   return true;
 }
 
+static bool
+parse_threads (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *countstr;
+  const char *predicate = argv[(*arg_ptr)-1];
+  if (collect_arg (argv, arg_ptr, &countstr))
+    {
+      int count_len = strspn (countstr, "0123456789");
+      if ((count_len > 0) && (countstr[count_len] == 0))
+	{
+	  options.threads = safe_atoi (countstr, options.err_quoting_style);
+	  if (options.threads > 0)
+	    {
+	      return parse_noop (entry, argv, arg_ptr);
+	    }
+	}
+      error (EXIT_FAILURE, 0,
+	     _("Expected a positive decimal integer argument to %s, but got %s"),
+	     predicate,
+	     quotearg_n_style (0, options.err_quoting_style, countstr));
+      /* NOTREACHED */
+      return false;
+    }
+  /* missing argument */
+  return false;
+}
+
+static bool
+parse_readdir_batch (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *countstr;
+  const char *predicate = argv[(*arg_ptr)-1];
+  if (collect_arg (argv, arg_ptr, &countstr))
+    {
+      int count_len = strspn (countstr, "0123456789");
+      if ((count_len > 0) && (countstr[count_len] == 0))
+	{
+	  int count = safe_atoi (countstr, options.err_quoting_style);
+	  if (count > 0)
+	    {
+	      options.readdir_batch = count;
+	      return parse_noop (entry, argv, arg_ptr);
+	    }
+	}
+      error (EXIT_FAILURE, 0,
+	     _("Expected a positive decimal integer argument to %s, but got %s"),
+	     predicate,
+	     quotearg_n_style (0, options.err_quoting_style, countstr));
+      /* NOTREACHED */
+      return false;
+    }
+  /* missing argument */
+  return false;
+}
+
+static bool
+parse_snapshot (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *filename, *base;
+  if (collect_arg (argv, arg_ptr, &filename))
+    {
+      /* We replace the snapshot with a new file, so it must not be
+       * (or look like) a directory.
+       */
+      base = strrchr (filename, '/');
+      base = base ? base + 1 : filename;
+      if (0 == strcmp (base, "") || 0 == strcmp (base, ".")
+	  || 0 == strcmp (base, ".."))
+	error (EXIT_FAILURE, 0, _("Invalid file name %s for -snapshot"),
+	       quotearg_n_style (0, options.err_quoting_style, filename));
+      options.snapshot_file = filename;
+      return parse_noop (entry, argv, arg_ptr);
+    }
+  /* missing argument */
+  return false;
+}
+
+static bool
+parse_profile (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  const char *filename;
+  if (collect_arg (argv, arg_ptr, &filename))
+    {
+      options.profile_file = filename;
+      return parse_noop (entry, argv, arg_ptr);
+    }
+  /* missing argument */
+  return false;
+}
+
+static bool
+parse_watch (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.watch = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
 static bool
 parse_noop (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -2702,10 +3316,6 @@ parse_version (const struct parser_table* entry, char **argv, int *arg_ptr)
   display_findutils_version ("find");
   printf (_("Features enabled: "));
 
-#if CACHE_IDS
-  printf ("CACHE_IDS ");
-  ++features;
-#endif
 #if DEBUG
   printf ("DEBUG ");
   ++features;
@@ -2755,6 +3365,11 @@ parse_version (const struct parser_table* entry, char **argv, int *arg_ptr)
   printf ("CBO(level=%d) ", (int)(options.optimisation_level));
   ++features;
 
+#if USE_POSIX_THREADS
+  printf ("THREADS ");
+  ++features;
+#endif
+
   if (0 == features)
     {
       /* For the moment, leave this as English in case someone wants
@@ -2799,6 +3414,41 @@ parse_xdev (const struct parser_table* entry, char **argv, int *arg_ptr)
   return parse_noop (entry, argv, arg_ptr);
 }
 
+static bool
+parse_batch_eval (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.batch_eval = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
+static bool
+parse_calibrate (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.calibrate = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
+static bool
+parse_batch_stat (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.batch_stat = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
+static bool
+parse_inode_order (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.inode_order = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
+static bool
+parse_cached_stat (const struct parser_table* entry, char **argv, int *arg_ptr)
+{
+  options.stat_dont_sync = true;
+  return parse_noop (entry, argv, arg_ptr);
+}
+
 static bool
 parse_ignore_race (const struct parser_table* entry, char **argv, int *arg_ptr)
 {
@@ -2955,6 +3605,7 @@ insert_fprintf (struct format_val *vec,
   our_pred->args.printf_vec = *vec;
   our_pred->need_type = false;
   our_pred->need_stat = false;
+  our_pred->stat_fields = 0u;
   our_pred->p_cost    = NeedsNothing;
 
   segmentp = &our_pred->args.printf_vec.segment;
@@ -2991,6 +3642,7 @@ insert_fprintf (struct format_val *vec,
 				our_pred);
 		  if (our_pred->need_stat && (our_pred->p_cost < NeedsStatInfo))
 		    our_pred->p_cost = NeedsStatInfo;
+		  compile_format (&our_pred->args.printf_vec);
 		  return true;
 		case 'f':
 		  *scan = '\f';
@@ -3048,7 +3700,7 @@ insert_fprintf (struct format_val *vec,
 	  if (*scan2 == '.')
 	    for (scan2++; ISDIGIT (*scan2); scan2++)
 	      /* Do nothing. */ ;
-	  if (strchr ("abcdDfFgGhHiklmMnpPsStuUyYZ", *scan2))
+	  if (strchr ("abcdDfFgGhHiklmMnpPsStuUxyYZ", *scan2))
 	    {
 	      segmentp = make_segment (segmentp, format, scan2 - format,
 				       KIND_FORMAT, *scan2, 0,
@@ -3082,9 +3734,51 @@ insert_fprintf (struct format_val *vec,
   if (scan > format)
     make_segment (segmentp, format, scan - format, KIND_PLAIN, 0, 0,
 		  our_pred);
+  compile_format (&our_pred->args.printf_vec);
   return true;
 }
 
+/* Return the parts of struct stat (as a mask of enum StatFields
+ * values) needed by the -printf directive %FORMAT_CHAR.
+ */
+static unsigned int
+format_stat_fields (char format_char)
+{
+  switch (format_char)
+    {
+    case 'a':
+    case 'A':
+      return StatFieldAtime;
+    case 'B':
+      return StatFieldBtime;
+    case 'c':
+    case 'C':
+      return StatFieldCtime;
+    case 't':
+    case 'T':
+      return StatFieldMtime;
+    case 'g':
+    case 'G':
+      return StatFieldGid;
+    case 'u':
+    case 'U':
+      return StatFieldUid;
+    case 'M':
+      return StatFieldType | StatFieldMode;
+    case 's':
+      return StatFieldSize;
+    case 'b':
+    case 'k':
+      return StatFieldBlocks;
+    case 'n':
+      return StatFieldNlink;
+    case 'D':			/* st_dev is always filled in. */
+      return 0u;
+    default:
+      return StatFieldAll;
+    }
+}
+
 /* Create a new fprintf segment in *SEGMENT, with type KIND,
    from the text in FORMAT, which has length LEN.
    Return the address of the `next' pointer of the new segment. */
@@ -3131,6 +3825,7 @@ make_segment (struct segment **segment,
     {
     case 'l':			/* object of symlink */
       pred->need_stat = true;
+      pred->stat_fields |= StatFieldType;
       mycost = NeedsLinkName;
       *fmt++ = 's';
       break;
@@ -3160,18 +3855,21 @@ make_segment (struct segment **segment,
     case 'T':			/* mtime in user-specified strftime format */
     case 'u':			/* user name */
       pred->need_stat = true;
+      pred->stat_fields |= format_stat_fields (format_char);
       mycost = NeedsStatInfo;
       *fmt++ = 's';
       break;
 
     case 'S':			/* sparseness */
       pred->need_stat = true;
+      pred->stat_fields |= StatFieldSize | StatFieldBlocks;
       mycost = NeedsStatInfo;
       *fmt++ = 'g';
       break;
 
     case 'Y':			/* symlink pointed file type */
       pred->need_stat = true;
+      pred->stat_fields |= StatFieldType;
       mycost = NeedsType;	/* true for amortised effect */
       *fmt++ = 's';
       break;
@@ -3188,6 +3886,13 @@ make_segment (struct segment **segment,
       *fmt++ = 's';
       break;
 
+    case 'x':			/* SHA-256 digest of the contents */
+      pred->need_stat = true;
+      pred->stat_fields |= StatFieldType;
+      mycost = NeedsSyncDiskHit;
+      *fmt++ = 's';
+      break;
+
     case 'H':			/* ARGV element file was found under */
       *fmt++ = 's';
       break;
@@ -3202,6 +3907,7 @@ make_segment (struct segment **segment,
     case 'k':			/* size in 1K blocks */
     case 'n':			/* number of links */
       pred->need_stat = true;
+      pred->stat_fields |= format_stat_fields (format_char);
       mycost = NeedsStatInfo;
       *fmt++ = 's';
       break;
@@ -3215,6 +3921,7 @@ make_segment (struct segment **segment,
     case 'm':			/* mode as octal number (perms only) */
       *fmt++ = 'o';
       pred->need_stat = true;
+      pred->stat_fields |= StatFieldMode;
       mycost = NeedsStatInfo;
       break;
 
@@ -3774,10 +4481,31 @@ insert_num (char **argv, int *arg_ptr, const struct parser_table *entry)
   return NULL;
 }
 
+/* Give standard output a larger buffer than stdio would, so that
+ * printing a lot of names takes fewer calls to write.  This must
+ * happen before anything is written to it, which is why we do it while
+ * parsing the expression; launch flushes the buffer before running
+ * any command, so the order of the output does not change.
+ */
+static void
+enlarge_stdout_buffer (void)
+{
+  enum { StdoutBufferSize = 128 * 1024 };
+  static bool done = false;
+
+  if (!done)
+    {
+      done = true;
+      setvbuf (stdout, xmalloc (StdoutBufferSize), _IOFBF, StdoutBufferSize);
+    }
+}
+
 static void
 open_output_file (const char *path, struct format_val *p)
 {
   p->segment = NULL;
+  p->ops = NULL;
+  p->n_ops = 0u;
   p->quote_opts = clone_quoting_options (NULL);
 
   if (!strcmp (path, "/dev/stderr"))
@@ -3802,6 +4530,8 @@ open_output_file (const char *path, struct format_val *p)
     }
 
   p->dest_is_tty = stream_is_tty (p->stream);
+  if (p->stream == stdout && !p->dest_is_tty)
+    enlarge_stdout_buffer ();
 }
 
 static void
@@ -33,15 +33,19 @@
 #include <fcntl.h>
 #include <locale.h>
 #include <ctype.h>
+#include <limits.h>
 #include <unistd.h> /* for unlinkat() */
 #include "xalloc.h"
 #include "dirname.h"
 #include "human.h"
+#include "intprops.h"
 #include "filemode.h"
 #include "printquoted.h"
 #include "buildcmd.h"
 #include "yesno.h"
 #include "listfile.h"
+#include "idname.h"
+#include "sha256.h"
 #include "stat-time.h"
 #include "dircallback.h"
 #include "error.h"
@@ -165,10 +169,12 @@
 #undef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-static bool match_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr, bool ignore_case);
+static bool match_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr);
 
 static char *format_date (struct timespec ts, int kind);
+static char *format_date_at (struct timespec ts, int kind, size_t *digits_at);
 static char *ctime_format (struct timespec ts);
+static char *ctime_format_at (struct timespec ts, size_t *digits_at);
 
 #ifdef	DEBUG
 struct pred_assoc
@@ -187,8 +193,11 @@ struct pred_assoc pred_table[] =
   {pred_cmin, "cmin    "},
   {pred_cnewer, "cnewer  "},
   {pred_comma, ",       "},
+  {pred_contains, "contains "},
   {pred_ctime, "ctime   "},
   {pred_delete, "delete  "},
+  {pred_du, "du      "},
+  {pred_duplicates, "duplicates "},
   {pred_empty, "empty   "},
   {pred_exec, "exec    "},
   {pred_execdir, "execdir "},
@@ -199,6 +208,7 @@ struct pred_assoc pred_table[] =
   {pred_fprintf, "fprintf "},
   {pred_fstype, "fstype  "},
   {pred_gid, "gid     "},
+  {pred_histogram, "histogram "},
   {pred_group, "group   "},
   {pred_ilname, "ilname  "},
   {pred_iname, "iname   "},
@@ -210,6 +220,7 @@ struct pred_assoc pred_table[] =
   {pred_mmin, "mmin    "},
   {pred_mtime, "mtime   "},
   {pred_name, "name    "},
+  {pred_name_set, "name_set "},
   {pred_negate, "not     "},
   {pred_newer, "newer   "},
   {pred_newerXY, "newerXY   "},
@@ -220,6 +231,7 @@ struct pred_assoc pred_table[] =
   {pred_openparen, "(       "},
   {pred_or, "or      "},
   {pred_path, "path    "},
+  {pred_path_set, "path_set "},
   {pred_perm, "perm    "},
   {pred_print, "print   "},
   {pred_print0, "print0  "},
@@ -228,7 +240,9 @@ struct pred_assoc pred_table[] =
   {pred_readable, "readable    "},
   {pred_regex, "regex   "},
   {pred_samefile,"samefile "},
+  {pred_sha256sum, "sha256sum"},
   {pred_size, "size    "},
+  {pred_top, "top     "},
   {pred_true, "true    "},
   {pred_type, "type    "},
   {pred_uid, "uid     "},
@@ -388,6 +402,16 @@ pred_comma (const char *pathname, struct stat *stat_buf, struct predicate *pred_
   return apply_predicate (pathname, stat_buf, pred_ptr->pred_right);
 }
 
+bool
+pred_contains (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  const struct contents_val *c = &pred_ptr->args.contents;
+
+  if (!S_ISREG (stat_buf->st_mode) || (uintmax_t) stat_buf->st_size > c->limit)
+    return false;
+  return contents_match (pathname, c);
+}
+
 bool
 pred_ctime (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
@@ -451,6 +475,40 @@ pred_delete (const char *pathname, struct stat *stat_buf, struct predicate *pred
     }
 }
 
+/* Add the space the file uses to the totals of the directories which
+ * contain it; see du.c.
+ */
+bool
+pred_du (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  struct du_val *du = &pred_ptr->args.du;
+  uintmax_t bytes;
+
+  if (du->apparent_size)
+    bytes = stat_buf->st_size < 0 ? 0u : (uintmax_t) stat_buf->st_size;
+  else
+#if defined HAVE_STRUCT_STAT_ST_BLOCKS && !defined _CRAY
+    /* Unlike %b, du counts the blocks of symbolic links too. */
+    bytes = (uintmax_t) stat_buf->st_blocks * ST_NBLOCKSIZE;
+#else
+    bytes = (uintmax_t) ST_NBLOCKS (*stat_buf) * ST_NBLOCKSIZE;
+#endif
+  du_add (du, pathname, stat_buf, bytes);
+  return true;
+}
+
+/* Remember a regular file, to compare it with the others when find
+ * exits; see dupes.c.
+ */
+bool
+pred_duplicates (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  if (!S_ISREG (stat_buf->st_mode))
+    return false;
+  report_add (&pred_ptr->args.report, pathname, stat_buf);
+  return true;
+}
+
 bool
 pred_empty (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
@@ -694,6 +752,7 @@ bool
 pred_fls (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   FILE * stream = pred_ptr->args.printf_vec.stream;
+  digest_sync ();
   list_file (pathname, state.cwd_dir_fd, state.rel_pathname, stat_buf,
 	     options.start_time.tv_sec,
 	     options.output_block_size,
@@ -707,6 +766,7 @@ pred_fprint (const char *pathname, struct stat *stat_buf, struct predicate *pred
   (void) &pathname;
   (void) &stat_buf;
 
+  digest_sync ();
   print_quoted (pred_ptr->args.printf_vec.stream,
 		pred_ptr->args.printf_vec.quote_opts,
 		pred_ptr->args.printf_vec.dest_is_tty,
@@ -722,6 +782,7 @@ pred_fprint0 (const char *pathname, struct stat *stat_buf, struct predicate *pre
 
   (void) &stat_buf;
 
+  digest_sync ();
   fputs (pathname, fp);
   putc (0, fp);
   return true;
@@ -729,7 +790,7 @@ pred_fprint0 (const char *pathname, struct stat *stat_buf, struct predicate *pre
 
 
 
-static char*
+char*
 mode_to_filetype (mode_t m)
 {
 #define HANDLE_TYPE(t,letter) if (m==t) { return letter; }
@@ -824,6 +885,37 @@ checked_fflush (struct format_val *dest)
     }
 }
 
+/* Return the permission bits of the mode M, using the traditional
+ * numbers.
+ */
+static unsigned int
+traditional_mode (mode_t m)
+{
+  /* Output the mode portably using the traditional numbers,
+     even if the host unwisely uses some other numbering
+     scheme.  But help the compiler in the common case where
+     the host uses the traditional numbering scheme.  */
+  bool traditional_numbering_scheme =
+    (S_ISUID == 04000 && S_ISGID == 02000 && S_ISVTX == 01000
+     && S_IRUSR == 00400 && S_IWUSR == 00200 && S_IXUSR == 00100
+     && S_IRGRP == 00040 && S_IWGRP == 00020 && S_IXGRP == 00010
+     && S_IROTH == 00004 && S_IWOTH == 00002 && S_IXOTH == 00001);
+  return (traditional_numbering_scheme
+	  ? m & MODE_ALL
+	  : ((m & S_ISUID ? 04000 : 0)
+	     | (m & S_ISGID ? 02000 : 0)
+	     | (m & S_ISVTX ? 01000 : 0)
+	     | (m & S_IRUSR ? 00400 : 0)
+	     | (m & S_IWUSR ? 00200 : 0)
+	     | (m & S_IXUSR ? 00100 : 0)
+	     | (m & S_IRGRP ? 00040 : 0)
+	     | (m & S_IWGRP ? 00020 : 0)
+	     | (m & S_IXGRP ? 00010 : 0)
+	     | (m & S_IROTH ? 00004 : 0)
+	     | (m & S_IWOTH ? 00002 : 0)
+	     | (m & S_IXOTH ? 00001 : 0)));
+}
+
 static void
 do_fprintf (struct format_val *dest,
 	    struct segment *segment,
@@ -892,13 +984,12 @@ do_fprintf (struct format_val *dest,
 	   * its name was selected by the system administrator)
 	   */
 	  {
-	    struct group *g;
+	    const char *name = gid_to_name (stat_buf->st_gid);
 
-	    g = getgrgid (stat_buf->st_gid);
-	    if (g)
+	    if (name)
 	      {
 		segment->text[segment->text_len] = 's';
-		checked_fprintf (dest, segment->text, g->gr_name);
+		checked_fprintf (dest, segment->text, name);
 		break;
 	      }
 	    else
@@ -1005,33 +1096,7 @@ do_fprintf (struct format_val *dest,
 
 	case 'm':		/* mode as octal number (perms only) */
 	  /* UNTRUSTED, probably unexploitable */
-	  {
-	    /* Output the mode portably using the traditional numbers,
-	       even if the host unwisely uses some other numbering
-	       scheme.  But help the compiler in the common case where
-	       the host uses the traditional numbering scheme.  */
-	    mode_t m = stat_buf->st_mode;
-	    bool traditional_numbering_scheme =
-	      (S_ISUID == 04000 && S_ISGID == 02000 && S_ISVTX == 01000
-	       && S_IRUSR == 00400 && S_IWUSR == 00200 && S_IXUSR == 00100
-	       && S_IRGRP == 00040 && S_IWGRP == 00020 && S_IXGRP == 00010
-	       && S_IROTH == 00004 && S_IWOTH == 00002 && S_IXOTH == 00001);
-	    checked_fprintf (dest, segment->text,
-		     (traditional_numbering_scheme
-		      ? m & MODE_ALL
-		      : ((m & S_ISUID ? 04000 : 0)
-			 | (m & S_ISGID ? 02000 : 0)
-			 | (m & S_ISVTX ? 01000 : 0)
-			 | (m & S_IRUSR ? 00400 : 0)
-			 | (m & S_IWUSR ? 00200 : 0)
-			 | (m & S_IXUSR ? 00100 : 0)
-			 | (m & S_IRGRP ? 00040 : 0)
-			 | (m & S_IWGRP ? 00020 : 0)
-			 | (m & S_IXGRP ? 00010 : 0)
-			 | (m & S_IROTH ? 00004 : 0)
-			 | (m & S_IWOTH ? 00002 : 0)
-			 | (m & S_IXOTH ? 00001 : 0))));
-	  }
+	  checked_fprintf (dest, segment->text, traditional_mode (stat_buf->st_mode));
 	  break;
 
 	case 'n':		/* number of links */
@@ -1092,13 +1157,12 @@ do_fprintf (struct format_val *dest,
 	   * selected by the system administrator)
 	   */
 	  {
-	    struct passwd *p;
+	    const char *name = uid_to_name (stat_buf->st_uid);
 
-	    p = getpwuid (stat_buf->st_uid);
-	    if (p)
+	    if (name)
 	      {
 		segment->text[segment->text_len] = 's';
-		checked_fprintf (dest, segment->text, p->pw_name);
+		checked_fprintf (dest, segment->text, name);
 		break;
 	      }
 	    /* else fallthru */
@@ -1168,6 +1232,32 @@ do_fprintf (struct format_val *dest,
 	  }
 	  break;
 
+	case 'x':		/* SHA-256 digest of the contents */
+	  /* trusted */
+	  {
+	    char hex[SHA256_HEX_SIZE + 1];
+	    int fd = -1, err;
+
+	    hex[0] = '\0';
+	    if (S_ISREG (stat_buf->st_mode))
+	      fd = open_regular_file (pathname);
+	    if (fd >= 0)
+	      {
+		err = digest_now (fd, hex);
+		if (err)
+		  {
+		    nonfatal_target_file_error (err, pathname);
+		    hex[0] = '\0';
+		  }
+		else
+		  {
+		    hex[SHA256_HEX_SIZE] = '\0';
+		  }
+	      }
+	    checked_fprintf (dest, segment->text, hex);
+	  }
+	  break;
+
 	case 'Z':               /* SELinux security context */
 	  {
 	    security_context_t scontext;
@@ -1197,74 +1287,662 @@ do_fprintf (struct format_val *dest,
     }
 }
 
-bool
-pred_fprintf (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+/* Set *TS to the time which the date directive %XK uses, where X is
+ * FIELD, and return false if the file does not have that time.
+ */
+static bool
+get_format_time (char field, char kind, const struct stat *stat_buf,
+		 struct timespec *ts)
+{
+  switch (field)
+    {
+    case 'A':
+    case 'a':
+      *ts = get_stat_atime (stat_buf);
+      return true;
+    case 'B':
+      *ts = get_stat_birthtime (stat_buf);
+      if ('@' == kind)
+	return true;
+      else
+	return (ts->tv_nsec >= 0);
+    case 'C':
+    case 'c':
+      *ts = get_stat_ctime (stat_buf);
+      return true;
+    case 'T':
+    case 't':
+      *ts = get_stat_mtime (stat_buf);
+      return true;
+    default:
+      assert (0);
+      abort ();
+    }
+}
+
+static void
+do_segment (struct format_val *dest,
+	    struct segment *segment,
+	    const char *pathname,
+	    const struct stat *stat_buf)
+{
+  if ( (KIND_FORMAT == segment->segkind) && segment->format_char[1]) /* Component of date. */
+    {
+      struct timespec ts;
+
+      /* We trust the output of format_date not to contain
+       * nasty characters, though the value of the date
+       * is itself untrusted data.
+       */
+      if (get_format_time (segment->format_char[0], segment->format_char[1],
+			   stat_buf, &ts))
+	{
+	  /* trusted */
+	  checked_fprintf (dest, segment->text,
+			   format_date (ts, segment->format_char[1]));
+	}
+      else
+	{
+	  /* The specified timestamp is not available, output
+	   * nothing for the timestamp, but use the rest (so that
+	   * for example find foo -printf '[%Bs] %p\n' can print
+	   * "[] foo").
+	   */
+	  /* trusted */
+	  checked_fprintf (dest, segment->text, "");
+	}
+    }
+  else
+    {
+      /* Print a segment which is not a date. */
+      do_fprintf (dest, segment, pathname, stat_buf);
+    }
+}
+
+
+/* Compiled -printf formats.
+ *
+ * Rather than walk the list of segments for each file, deciding again
+ * what each one is and formatting it with printf, compile_format turns
+ * the list into an array of steps.  The directives which are most
+ * often used, when they are written without flags, a field width or a
+ * precision, have steps of their own which copy or convert the value
+ * straight into a buffer of ours; for example %p copies the file name
+ * and %s converts the size without going through printf.  Each time
+ * step remembers the last time it printed, so that localtime and
+ * strftime are only called again when the time changes by a second or
+ * more; only the nanoseconds are filled in afresh.  Everything else is
+ * printed by do_segment, as before, after the buffer has been written
+ * out, so the output is the same.
+ *
+ * The whole of the output for a file is written to the stream with one
+ * fwrite; see also enlarge_stdout_buffer in parser.c.
+ */
+
+enum format_op_kind
+  {
+    FormatText,			/* copy the text */
+    FormatStop,			/* copy the text and flush (\c) */
+    FormatPath,			/* %p */
+    FormatBaseName,		/* %f */
+    FormatDirName,		/* %h */
+    FormatRelativePath,		/* %P */
+    FormatStartPath,		/* %H */
+    FormatNumber,		/* %b %D %G %i %k %n %s %U */
+    FormatDepth,		/* %d */
+    FormatMode,			/* %m */
+    FormatUser,			/* %u */
+    FormatGroup,		/* %g */
+    FormatCtime,		/* %a %c %t */
+    FormatDate,			/* %Ak %Bk %Ck %Tk */
+    FormatDigest,		/* %x */
+    FormatSegment		/* anything else; see do_segment */
+  };
+
+struct format_op
+{
+  enum format_op_kind kind;
+  char field;			/* format_char[0] of the segment */
+  char date_kind;		/* format_char[1] of the segment */
+  char *text;			/* the text for FormatText and FormatStop */
+  size_t text_len;
+  struct segment *segment;	/* the segment, for directives */
+
+  /* The last time printed by FormatCtime and FormatDate. */
+  bool have_time;
+  time_t time_sec;
+  char *time_text;
+  size_t time_len;
+  size_t time_digits_at;	/* see format_date_at */
+};
+
+/* The buffer we build the output for a file in. */
+static char *format_buf = NULL;
+static size_t format_buf_size = 0u;
+static size_t format_buf_used = 0u;
+
+/* The file whose digest the output needs, or -1, and where in
+ * format_buf it goes (see digest.c).
+ */
+static int format_digest_fd = -1;
+static bool format_digest_tried = false;
+static size_t *format_holes = NULL;
+static size_t format_holes_used = 0u, format_holes_size = 0u;
+
+
+static struct format_op *
+add_format_op (struct format_val *dest, size_t *alloc,
+	       enum format_op_kind kind)
+{
+  struct format_op *op;
+
+  if (dest->n_ops == *alloc)
+    dest->ops = x2nrealloc (dest->ops, alloc, sizeof *dest->ops);
+  op = &dest->ops[dest->n_ops++];
+  memset (op, 0, sizeof *op);
+  op->kind = kind;
+  return op;
+}
+
+/* Add the LEN bytes of TEXT to the end of DEST, as a step of kind
+ * KIND (FormatText or FormatStop).
+ */
+static void
+add_format_text (struct format_val *dest, size_t *alloc,
+		 enum format_op_kind kind, const char *text, size_t len)
+{
+  struct format_op *op;
+
+  if (0u == len && FormatText == kind)
+    return;
+  if (dest->n_ops && FormatText == dest->ops[dest->n_ops - 1u].kind)
+    op = &dest->ops[dest->n_ops - 1u];
+  else
+    op = add_format_op (dest, alloc, FormatText);
+  op->kind = kind;
+  op->text = xrealloc (op->text, op->text_len + len + 1u);
+  memcpy (op->text + op->text_len, text, len);
+  op->text_len += len;
+  op->text[op->text_len] = '\0';
+}
+
+/* Return the kind of step which can print the directive SEGMENT to
+ * DEST, given that it has no flags, field width or precision.
+ */
+static enum format_op_kind
+plain_directive_kind (const struct segment *segment)
+{
+  if (segment->format_char[1])
+    return FormatDate;
+
+  switch (segment->format_char[0])
+    {
+    case 'p':
+    case 'f':
+    case 'h':
+    case 'P':
+      switch (segment->format_char[0])
+	{
+	case 'p':
+	  return FormatPath;
+	case 'f':
+	  return FormatBaseName;
+	case 'h':
+	  return FormatDirName;
+	default:
+	  return FormatRelativePath;
+	}
+    case 'H':
+      return FormatStartPath;
+    case 'b':
+    case 'D':
+    case 'G':
+    case 'i':
+    case 'k':
+    case 'n':
+    case 's':
+    case 'U':
+      return FormatNumber;
+    case 'd':
+      return FormatDepth;
+    case 'm':
+      return FormatMode;
+    case 'u':
+      return FormatUser;
+    case 'g':
+      return FormatGroup;
+    case 'a':
+    case 'c':
+    case 't':
+      return FormatCtime;
+    case 'x':
+      return FormatDigest;
+    default:
+      return FormatSegment;
+    }
+}
+
+/* Compile the segments of the -printf format DEST into DEST->ops. */
+void
+compile_format (struct format_val *dest)
 {
-  struct format_val *dest = &pred_ptr->args.printf_vec;
   struct segment *segment;
+  size_t alloc = 0u, i;
+  bool any_segments = false;
 
+  dest->ops = NULL;
+  dest->n_ops = 0u;
   for (segment = dest->segment; segment; segment = segment->next)
     {
-      if ( (KIND_FORMAT == segment->segkind) && segment->format_char[1]) /* Component of date. */
+      struct format_op *op;
+      enum format_op_kind kind;
+      size_t len = segment->text_len;
+
+      switch (segment->segkind)
 	{
-	  struct timespec ts;
-	  int valid = 0;
+	case KIND_PLAIN:
+	  add_format_text (dest, &alloc, FormatText, segment->text, len);
+	  break;
 
-	  switch (segment->format_char[0])
-	    {
-	    case 'A':
-	      ts = get_stat_atime (stat_buf);
-	      valid = 1;
-	      break;
-	    case 'B':
-	      ts = get_stat_birthtime (stat_buf);
-	      if ('@' == segment->format_char[1])
-		valid = 1;
-	      else
-		valid = (ts.tv_nsec >= 0);
-	      break;
-	    case 'C':
-	      ts = get_stat_ctime (stat_buf);
-	      valid = 1;
-	      break;
-	    case 'T':
-	      ts = get_stat_mtime (stat_buf);
-	      valid = 1;
-	      break;
-	    default:
-	      assert (0);
-	      abort ();
-	    }
-	  /* We trust the output of format_date not to contain
-	   * nasty characters, though the value of the date
-	   * is itself untrusted data.
+	case KIND_STOP:
+	  add_format_text (dest, &alloc, FormatStop, segment->text, len);
+	  break;
+
+	case KIND_FORMAT:
+	  /* The text is whatever came before the directive, then the
+	   * directive itself, with the conversion character (which is
+	   * at text[text_len]) changed to suit printf.  If the '%' is
+	   * immediately before that, there are no flags.
 	   */
-	  if (valid)
+	  kind = FormatSegment;
+	  if (len > 0 && '%' == segment->text[len - 1u])
+	    kind = plain_directive_kind (segment);
+	  if (FormatSegment == kind)
 	    {
-	      /* trusted */
-	      checked_fprintf (dest, segment->text,
-			       format_date (ts, segment->format_char[1]));
+	      op = add_format_op (dest, &alloc, FormatSegment);
+	      any_segments = true;
 	    }
 	  else
 	    {
-	      /* The specified timestamp is not available, output
-	       * nothing for the timestamp, but use the rest (so that
-	       * for example find foo -printf '[%Bs] %p\n' can print
-	       * "[] foo").
-	       */
-	      /* trusted */
-	      checked_fprintf (dest, segment->text, "");
+	      add_format_text (dest, &alloc, FormatText,
+			       segment->text, len - 1u);
+	      op = add_format_op (dest, &alloc, kind);
+	      op->field = segment->format_char[0];
+	      op->date_kind = segment->format_char[1];
 	    }
+	  op->segment = segment;
+	  break;
 	}
+    }
+
+  /* do_segment writes straight to the stream, so if it has any of the
+   * output to print we can't wait for digests; do_fprintf calculates
+   * them itself instead.
+   */
+  if (any_segments)
+    for (i = 0; i < dest->n_ops; ++i)
+      if (FormatDigest == dest->ops[i].kind)
+	dest->ops[i].kind = FormatSegment;
+}
+
+
+/* Return the address of LEN more bytes at the end of format_buf. */
+static char *
+format_buf_extend (size_t len)
+{
+  char *p;
+
+  while (format_buf_size - format_buf_used < len)
+    format_buf = x2realloc (format_buf, &format_buf_size);
+  p = format_buf + format_buf_used;
+  format_buf_used += len;
+  return p;
+}
+
+static void
+format_append (const char *s, size_t len)
+{
+  memcpy (format_buf_extend (len), s, len);
+}
+
+static void
+format_append_number (uintmax_t n)
+{
+  char buf[INT_BUFSIZE_BOUND (uintmax_t)];
+  char *p = buf + sizeof buf;
+
+  do
+    *--p = '0' + n % 10u;
+  while (0u != (n /= 10u));
+  format_append (p, buf + sizeof buf - p);
+}
+
+/* Append the LEN bytes of the name S, quoted as print_quoted would
+ * quote them for DEST.
+ */
+static void
+format_append_name (const struct format_val *dest, const char *s, size_t len)
+{
+  size_t quoted_len;
+  char *p;
+
+  if (!dest->dest_is_tty)
+    {
+      format_append (s, len);
+      return;
+    }
+  quoted_len = quotearg_buffer (NULL, 0, s, len, dest->quote_opts);
+  p = format_buf_extend (quoted_len + 1u);
+  quotearg_buffer (p, quoted_len + 1u, s, len, dest->quote_opts);
+  format_buf_used -= quoted_len + 1u - qmark_chars (p, quoted_len);
+}
+
+/* Write what we have in format_buf to DEST. */
+static void
+format_flush (struct format_val *dest)
+{
+  if (format_buf_used)
+    {
+      checked_fwrite (format_buf, 1, format_buf_used, dest);
+      format_buf_used = 0u;
+    }
+}
+
+/* Leave room in format_buf for the digest of PATHNAME, unless it is
+ * not a regular file or we cannot open it.
+ */
+static void
+format_append_digest (const char *pathname, const struct stat *stat_buf)
+{
+  if (!format_digest_tried)
+    {
+      format_digest_tried = true;
+      if (S_ISREG (stat_buf->st_mode))
+	format_digest_fd = open_regular_file (pathname);
+    }
+  if (format_digest_fd < 0)
+    return;
+  if (format_holes_used == format_holes_size)
+    format_holes = x2nrealloc (format_holes, &format_holes_size,
+			       sizeof *format_holes);
+  format_holes[format_holes_used++] = format_buf_used;
+  memset (format_buf_extend (SHA256_HEX_SIZE), '?', SHA256_HEX_SIZE);
+}
+
+/* Write out the output for PATHNAME, or if it has to wait for a
+ * digest, or behind other output that does, pass it to digest.c.
+ */
+static void
+format_end (struct format_val *dest, const char *pathname)
+{
+  if (format_digest_fd >= 0 || digest_pending ())
+    {
+      digest_output (dest, format_buf, format_buf_used,
+		     format_holes, format_holes_used,
+		     format_digest_fd, pathname, false);
+      format_buf_used = 0u;
+    }
+  else
+    {
+      format_flush (dest);
+    }
+  format_digest_fd = -1;
+  format_digest_tried = false;
+  format_holes_used = 0u;
+}
+
+/* Append the time TS formatted for the step OP. */
+static void
+format_append_time (struct format_op *op, struct timespec ts)
+{
+  const char *s;
+  size_t digits_at;
+  long int ns;
+  char *p;
+  int i;
+
+  if (ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+    {
+      /* Junk in tv_nsec; don't try to be clever. */
+      s = op->date_kind ? format_date (ts, op->date_kind) : ctime_format (ts);
+      format_append (s, strlen (s));
+      return;
+    }
+
+  if (!op->have_time || op->time_sec != ts.tv_sec)
+    {
+      s = (op->date_kind
+	   ? format_date_at (ts, op->date_kind, &digits_at)
+	   : ctime_format_at (ts, &digits_at));
+      op->time_len = strlen (s);
+      op->time_text = xrealloc (op->time_text, op->time_len + 1u);
+      memcpy (op->time_text, s, op->time_len + 1u);
+      op->time_digits_at = digits_at;
+      op->time_sec = ts.tv_sec;
+      op->have_time = true;
+    }
+
+  p = format_buf_extend (op->time_len);
+  memcpy (p, op->time_text, op->time_len);
+  if (SIZE_MAX != op->time_digits_at)
+    {
+      p += op->time_digits_at;
+      for (i = 8, ns = ts.tv_nsec; i >= 0; --i, ns /= 10)
+	p[i] = '0' + ns % 10;
+    }
+}
+
+/* Append the number which the directive %FIELD prints. */
+static void
+format_append_field (char field, const struct stat *stat_buf)
+{
+  char hbuf[LONGEST_HUMAN_READABLE + 1];
+  const char *s;
+
+  switch (field)
+    {
+    case 'b':
+    case 'k':
+      s = human_readable ((uintmax_t) ST_NBLOCKS (*stat_buf),
+			  hbuf, human_ceiling,
+			  ST_NBLOCKSIZE, 'b' == field ? 512 : 1024);
+      format_append (s, strlen (s));
+      break;
+    case 'D':
+      format_append_number ((uintmax_t) stat_buf->st_dev);
+      break;
+    case 'G':
+      format_append_number ((uintmax_t) stat_buf->st_gid);
+      break;
+    case 'i':
+      format_append_number ((uintmax_t) stat_buf->st_ino);
+      break;
+    case 'n':
+      format_append_number ((uintmax_t) stat_buf->st_nlink);
+      break;
+    case 's':
+      format_append_number ((uintmax_t) stat_buf->st_size);
+      break;
+    case 'U':
+      format_append_number ((uintmax_t) stat_buf->st_uid);
+      break;
+    default:
+      assert (0);
+      abort ();
+    }
+}
+
+/* Carry out the step OP of the -printf format DEST for PATHNAME.
+ * Return false after \c.
+ */
+static bool
+run_format_op (struct format_val *dest, struct format_op *op,
+	       const char *pathname, const struct stat *stat_buf)
+{
+  struct timespec ts;
+  const char *cp;
+  char *base;
+  unsigned int mode;
+  char octal[sizeof mode * CHAR_BIT / 3 + 2];
+  char *p;
+
+  switch (op->kind)
+    {
+    case FormatText:
+      format_append (op->text, op->text_len);
+      break;
+
+    case FormatStop:
+      format_append (op->text, op->text_len);
+      format_end (dest, pathname);
+      digest_sync ();
+      checked_fflush (dest);
+      return false;
+
+    case FormatPath:
+      format_append_name (dest, pathname, strlen (pathname));
+      break;
+
+    case FormatBaseName:
+      base = base_name (pathname);
+      format_append_name (dest, base, strlen (base));
+      free (base);
+      break;
+
+    case FormatDirName:
+      cp = strrchr (pathname, '/');
+      if (cp == NULL)
+	format_append_name (dest, ".", 1u);
       else
+	format_append_name (dest, pathname, cp - pathname);
+      break;
+
+    case FormatRelativePath:
+      if (state.curdepth > 0)
 	{
-	  /* Print a segment which is not a date. */
-	  do_fprintf (dest, segment, pathname, stat_buf);
+	  cp = pathname + state.starting_path_length;
+	  if (*cp == '/')
+	    cp++;
+	  format_append_name (dest, cp, strlen (cp));
 	}
+      break;
+
+    case FormatStartPath:
+      format_append (pathname, strnlen (pathname, state.starting_path_length));
+      break;
+
+    case FormatNumber:
+      format_append_field (op->field, stat_buf);
+      break;
+
+    case FormatDepth:
+      if (state.curdepth < 0)
+	{
+	  format_append ("-", 1u);
+	  format_append_number (- (uintmax_t) state.curdepth);
+	}
+      else
+	{
+	  format_append_number (state.curdepth);
+	}
+      break;
+
+    case FormatMode:
+      mode = traditional_mode (stat_buf->st_mode);
+      p = octal + sizeof octal;
+      do
+	*--p = '0' + (mode & 7u);
+      while (0u != (mode >>= 3));
+      format_append (p, octal + sizeof octal - p);
+      break;
+
+    case FormatUser:
+      cp = uid_to_name (stat_buf->st_uid);
+      if (cp)
+	format_append (cp, strlen (cp));
+      else
+	format_append_number ((uintmax_t) stat_buf->st_uid);
+      break;
+
+    case FormatGroup:
+      cp = gid_to_name (stat_buf->st_gid);
+      if (cp)
+	format_append (cp, strlen (cp));
+      else
+	format_append_number ((uintmax_t) stat_buf->st_gid);
+      break;
+
+    case FormatCtime:
+    case FormatDate:
+      /* If the time is not available, print nothing for it. */
+      if (get_format_time (op->field, op->date_kind, stat_buf, &ts))
+	format_append_time (op, ts);
+      break;
+
+    case FormatDigest:
+      format_append_digest (pathname, stat_buf);
+      break;
+
+    case FormatSegment:
+      digest_sync ();
+      format_flush (dest);
+      do_segment (dest, op->segment, pathname, stat_buf);
+      break;
     }
   return true;
 }
 
+bool
+pred_fprintf (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  struct format_val *dest = &pred_ptr->args.printf_vec;
+  size_t i;
+
+  for (i = 0; i < dest->n_ops; ++i)
+    if (!run_format_op (dest, &dest->ops[i], pathname, stat_buf))
+      return true;
+  format_end (dest, pathname);
+  return true;
+}
+
+/* Print the digest of a regular file and its name in the format of
+ * sha256sum, which marks names containing a backslash or a newline
+ * with a backslash at the start of the line and escapes them.
+ */
+bool
+pred_sha256sum (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  const char *s;
+  size_t hole, n;
+  int fd;
+
+  if (!S_ISREG (stat_buf->st_mode) || (fd = open_regular_file (pathname)) < 0)
+    return false;
+
+  if (strpbrk (pathname, "\\\n"))
+    format_append ("\\", 1u);
+  hole = format_buf_used;
+  memset (format_buf_extend (SHA256_HEX_SIZE), '?', SHA256_HEX_SIZE);
+  format_append ("  ", 2u);
+  for (s = pathname; *s; s += n)
+    {
+      n = strcspn (s, "\\\n");
+      format_append (s, n);
+      if ('\\' == s[n])
+	format_append ("\\\\", 2u);
+      else if ('\n' == s[n])
+	format_append ("\\n", 2u);
+      else
+	break;
+      ++n;
+    }
+  format_append ("\n", 1u);
+  digest_output (&pred_ptr->args.printf_vec, format_buf, format_buf_used,
+		 &hole, 1u, fd, pathname, true);
+  format_buf_used = 0u;
+  return true;
+}
+
 bool
 pred_fstype (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
@@ -1310,34 +1988,55 @@ pred_group (const char *pathname, struct stat *stat_buf, struct predicate *pred_
     return (false);
 }
 
+/* Count the file in the histogram; see report.c. */
+bool
+pred_histogram (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  report_add (&pred_ptr->args.report, pathname, stat_buf);
+  return true;
+}
+
 bool
 pred_ilname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
-  return match_lname (pathname, stat_buf, pred_ptr, true);
+  return match_lname (pathname, stat_buf, pred_ptr);
 }
 
-/* Common code between -name, -iname.  PATHNAME is being visited, STR
-   is name to compare basename against, and FLAGS are passed to
-   fnmatch.  Recall that 'find / -name /' is one of the few times where a '/'
-   in the -name must actually find something. */
-static bool
-pred_name_common (const char *pathname, const char *str, int flags)
+/* Return the part of PATHNAME which -name compares against: its
+   basename, without trailing slashes.  If we had to make a copy to
+   remove them, set *COPY to it so that the caller can free it;
+   otherwise set *COPY to NULL.  Recall that 'find / -name /' is one
+   of the few times where a '/' in the -name must actually find
+   something. */
+static const char *
+name_to_match (const char *pathname, char **copy)
 {
-  bool b;
-  /* We used to use last_component() here, but that would not allow us to modify the
-   * input string, which is const.   We could optimise by duplicating the string only
-   * if we need to modify it, and I'll do that if there is a measurable
-   * performance difference on a machine built after 1990...
-   */
-  char *base = base_name (pathname);
-  /* remove trailing slashes, but leave  "/" or "//foo" unchanged. */
-  strip_trailing_slashes (base);
+  const char *base;
+  size_t len = strlen (pathname);
 
-  /* FNM_PERIOD is not used here because POSIX requires that it not be.
-   * See http://standards.ieee.org/reading/ieee/interp/1003-2-92_int/pasc-1003.2-126.html
-   */
-  b = fnmatch (str, base, flags) == 0;
-  free (base);
+  if (len > 0 && '/' == pathname[len - 1])
+    {
+      /* Only start points can look like this, so it is not worth
+       * avoiding the copy.
+       */
+      *copy = base_name (pathname);
+      /* remove trailing slashes, but leave  "/" or "//foo" unchanged. */
+      strip_trailing_slashes (*copy);
+      return *copy;
+    }
+  *copy = NULL;
+  base = strrchr (pathname, '/');
+  return base ? base + 1 : pathname;
+}
+
+/* Common code between -name, -iname.  PATHNAME is being visited, and
+   G is the pattern to compare its basename against.  */
+static bool
+pred_name_common (const char *pathname, const struct glob_val *g)
+{
+  char *copy;
+  bool b = glob_match (g, name_to_match (pathname, &copy));
+  free (copy);
   return b;
 }
 
@@ -1345,7 +2044,7 @@ bool
 pred_iname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   (void) stat_buf;
-  return pred_name_common (pathname, pred_ptr->args.str, FNM_CASEFOLD);
+  return pred_name_common (pathname, &pred_ptr->args.glob);
 }
 
 bool
@@ -1377,10 +2076,7 @@ bool
 pred_ipath (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   (void) stat_buf;
-
-  if (fnmatch (pred_ptr->args.str, pathname, FNM_CASEFOLD) == 0)
-    return (true);
-  return (false);
+  return glob_match (&pred_ptr->args.glob, pathname);
 }
 
 bool
@@ -1409,11 +2105,11 @@ pred_links (const char *pathname, struct stat *stat_buf, struct predicate *pred_
 bool
 pred_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
-  return match_lname (pathname, stat_buf, pred_ptr, false);
+  return match_lname (pathname, stat_buf, pred_ptr);
 }
 
 static bool
-match_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr, bool ignore_case)
+match_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   bool ret = false;
 #ifdef S_ISLNK
@@ -1422,8 +2118,7 @@ match_lname (const char *pathname, struct stat *stat_buf, struct predicate *pred
       char *linkname = areadlinkat (state.cwd_dir_fd, state.rel_pathname);
       if (linkname)
 	{
-	  if (fnmatch (pred_ptr->args.str, linkname,
-		       ignore_case ? FNM_CASEFOLD : 0) == 0)
+	  if (glob_match (&pred_ptr->args.glob, linkname))
 	    ret = true;
 	}
       else
@@ -1461,7 +2156,20 @@ bool
 pred_name (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   (void) stat_buf;
-  return pred_name_common (pathname, pred_ptr->args.str, 0);
+  return pred_name_common (pathname, &pred_ptr->args.glob);
+}
+
+/* Several -name or -iname tests fused into one; see nameset.c. */
+bool
+pred_name_set (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  char *copy;
+  bool b;
+
+  (void) stat_buf;
+  b = name_set_match (pred_ptr->args.nameset, name_to_match (pathname, &copy));
+  free (copy);
+  return b;
 }
 
 bool
@@ -1531,36 +2239,23 @@ pred_nogroup (const char *pathname, struct stat *stat_buf, struct predicate *pre
   (void) pathname;
   (void) pred_ptr;
 
-#ifdef CACHE_IDS
-  extern char *gid_unused;
-
-  return gid_unused[(unsigned) stat_buf->st_gid];
-#else
-  return getgrgid (stat_buf->st_gid) == NULL;
-#endif
+  return gid_to_name (stat_buf->st_gid) == NULL;
 }
 
 bool
 pred_nouser (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
-#ifdef CACHE_IDS
-  extern char *uid_unused;
-#endif
-
   (void) pathname;
   (void) pred_ptr;
 
-#ifdef CACHE_IDS
-  return uid_unused[(unsigned) stat_buf->st_uid];
-#else
-  return getpwuid (stat_buf->st_uid) == NULL;
-#endif
+  return uid_to_name (stat_buf->st_uid) == NULL;
 }
 
 
 static bool
 is_ok (const char *program, const char *arg)
 {
+  digest_sync ();
   fflush (stdout);
   /* The draft open standard requires that, in the POSIX locale,
      the last non-blank character of this prompt be '?'.
@@ -1616,9 +2311,15 @@ bool
 pred_path (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
   (void) stat_buf;
-  if (fnmatch (pred_ptr->args.str, pathname, 0) == 0)
-    return (true);
-  return (false);
+  return glob_match (&pred_ptr->args.glob, pathname);
+}
+
+/* Several -path or -ipath tests fused into one; see nameset.c. */
+bool
+pred_path_set (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  (void) stat_buf;
+  return name_set_match (pred_ptr->args.nameset, pathname);
 }
 
 bool
@@ -1700,6 +2401,7 @@ pred_print (const char *pathname, struct stat *stat_buf, struct predicate *pred_
   (void) stat_buf;
   (void) pred_ptr;
 
+  digest_sync ();
   print_quoted (pred_ptr->args.printf_vec.stream,
 		pred_ptr->args.printf_vec.quote_opts,
 		pred_ptr->args.printf_vec.dest_is_tty,
@@ -1754,9 +2456,16 @@ pred_quit (const char *pathname, struct stat *stat_buf, struct predicate *pred_p
 bool
 pred_regex (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
-  int len = strlen (pathname);
-(void) stat_buf;
-  if (re_match (pred_ptr->args.regex, pathname, len, 0,
+  const struct regex_val *r = &pred_ptr->args.regex;
+  int i, len;
+
+  (void) stat_buf;
+  for (i = 0; i < r->n_filters; ++i)
+    if (!glob_match (&r->filters[i], pathname))
+      return false;
+
+  len = strlen (pathname);
+  if (re_match (r->re, pathname, len, 0,
 		(struct re_registers *) NULL) == len)
     return (true);
   return (false);
@@ -1829,6 +2538,14 @@ pred_samefile (const char *pathname, struct stat *stat_buf, struct predicate *pr
     }
 }
 
+/* Add the file to the report; see report.c. */
+bool
+pred_top (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
+{
+  report_add (&pred_ptr->args.report, pathname, stat_buf);
+  return true;
+}
+
 bool
 pred_true (const char *pathname, struct stat *stat_buf, struct predicate *pred_ptr)
 {
@@ -2077,6 +2794,7 @@ launch (struct buildcmd_control *ctl, void *usercontext, int argc, char **argv)
   struct exec_val *execp = usercontext;
 
   /* Make sure output of command doesn't get mixed with find output. */
+  digest_sync ();
   fflush (stdout);
   fflush (stderr);
 
@@ -2212,8 +2930,13 @@ scan_for_digit_differences (const char *p, const char *q,
 }
 
 
+/* Format the time P according to FMT, inserting the NS_SIZE bytes of
+ * NS after the seconds, if there are any; if so, set *NS_AT to where
+ * they start in the result.
+ */
 static char*
-do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_size)
+do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_size,
+		size_t *ns_at)
 {
   static char *buf = NULL;
   static size_t buf_size;
@@ -2244,6 +2967,7 @@ do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_s
    * character.
    */
   buf_size = 1u;
+  free (buf);
   buf = xmalloc (buf_size);
   while (true)
     {
@@ -2286,6 +3010,7 @@ do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_s
 		       buf+end_of_seconds,
 		       suffix_len);
 	      memcpy (buf+i+n, ns, ns_size);
+	      *ns_at = i + n - 1u; /* allow for the underscore */
 	    }
 	  else
 	    {
@@ -2294,6 +3019,7 @@ do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_s
 	  /* The first character of buf is the underscore, which we actually
 	   * don't want.
 	   */
+	  free (altbuf);
 	  free (timefmt);
 	  return buf+1;
 	}
@@ -2318,6 +3044,17 @@ do_time_format (const char *fmt, const struct tm *p, const char *ns, size_t ns_s
  */
 static char *
 format_date (struct timespec ts, int kind)
+{
+  size_t digits_at;
+  return format_date_at (ts, kind, &digits_at);
+}
+
+/* Like format_date, but also set *DIGITS_AT to where the nine digits
+ * of the nanoseconds are in the result, or to SIZE_MAX if it does not
+ * include them.
+ */
+static char *
+format_date_at (struct timespec ts, int kind, size_t *digits_at)
 {
   /* In theory, we use an extra 10 characters for 9 digits of
    * nanoseconds and 1 for the decimal point.  However, the real
@@ -2340,6 +3077,7 @@ format_date (struct timespec ts, int kind)
 			    MAX (LONGEST_HUMAN_READABLE + 2, NS_BUF_LEN+64+200))];
   char ns_buf[NS_BUF_LEN]; /* -.9999999990 (- sign can happen!)*/
   int  charsprinted, need_ns_suffix;
+  bool valid_ns = (0 <= ts.tv_nsec && ts.tv_nsec < 1000000000);
   struct tm *tm;
   char fmt[6];
 
@@ -2357,6 +3095,7 @@ format_date (struct timespec ts, int kind)
 
   charsprinted = 0;
   need_ns_suffix = 0;
+  *digits_at = SIZE_MAX;
 
   /* Format the main part of the time. */
   if (kind == '+')
@@ -2407,9 +3146,14 @@ format_date (struct timespec ts, int kind)
       tm = localtime (&ts.tv_sec);
       if (tm)
 	{
-	  char *s = do_time_format (fmt, tm, ns_buf, charsprinted);
+	  size_t ns_at = SIZE_MAX;
+	  char *s = do_time_format (fmt, tm, ns_buf, charsprinted, &ns_at);
 	  if (s)
-	    return s;
+	    {
+	      if (need_ns_suffix && valid_ns && SIZE_MAX != ns_at)
+		*digits_at = ns_at + 1u;
+	      return s;
+	    }
 	}
     }
 
@@ -2451,6 +3195,8 @@ format_date (struct timespec ts, int kind)
 	    }
 	  assert (strlen (ns_buf) < remaining);
 	  strcat (p, ns_buf);
+	  if (valid_ns)
+	    *digits_at = len + 1u;
 	}
       return p;
     }
@@ -2469,6 +3215,16 @@ static char * months[] =
 
 static char *
 ctime_format (struct timespec ts)
+{
+  size_t digits_at;
+  return ctime_format_at (ts, &digits_at);
+}
+
+/* Like ctime_format, but also set *DIGITS_AT to where the last nine
+ * digits of the nanoseconds are in the result, or to SIZE_MAX.
+ */
+static char *
+ctime_format_at (struct timespec ts, size_t *digits_at)
 {
   const struct tm * ptm;
 #define TIME_BUF_LEN 1024u
@@ -2500,13 +3256,16 @@ ctime_format (struct timespec ts)
 		       1900 + ptm->tm_year);
 
       assert (nout < TIME_BUF_LEN);
+      *digits_at = SIZE_MAX;
+      if (0 <= ts.tv_nsec && ts.tv_nsec < 1000000000)
+	*digits_at = strchr (resultbuf, '.') - resultbuf + 2;
       return resultbuf;
     }
   else
     {
       /* The time cannot be represented as a struct tm.
 	 Output it as an integer.  */
-      return format_date (ts, '@');
+      return format_date_at (ts, '@', digits_at);
     }
 }
 
@@ -2610,6 +3369,8 @@ void show_success_rates (const struct predicate *p)
 {
   if (options.debug_options & DebugSuccessRates)
     {
+      /* The counts are kept in the compiled program, if there is one. */
+      update_tree_perf (get_eval_tree ());
       fprintf (stderr, "Predicate success rates after completion:\n");
       print_optlist (stderr, p);
       fprintf (stderr, "\n");
@@ -0,0 +1,475 @@
+/* prefetch.c -- read directory metadata ahead of the search.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The -threads option makes find start a number of worker threads
+ * which walk the directory hierarchy below each start point ahead of
+ * the main search.  The workers only read directories and stat their
+ * entries; they never evaluate the expression.  The point is that
+ * the kernel's dentry, inode and (for network file systems)
+ * attribute caches are warm by the time the main thread gets there,
+ * so the main thread spends much less time waiting for I/O.
+ *
+ * Since the expression is still evaluated by a single thread in the
+ * usual order, the output and the semantics of actions like -delete,
+ * -exec and -quit are exactly the same as they are without -threads.
+ *
+ * Each worker owns a deque of directories still to be read.  A worker
+ * takes work from the tail of its own deque (so that it proceeds
+ * depth-first, roughly in the order in which fts will want the
+ * information) and when that is empty it steals from the head of
+ * another worker's deque (taking the shallowest, and therefore
+ * probably the largest, piece of outstanding work).
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
+
+#include "xalloc.h"
+#include "defs.h"
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW 0
+#endif
+
+#if USE_POSIX_THREADS
+
+enum
+  {
+    /* Don't queue more than this many directories per worker.  When
+     * the workers are this far ahead, there is little point in them
+     * getting further ahead still.
+     */
+    MaxPendingPerWorker = 4096,
+    InitialDequeSize = 64
+  };
+
+struct prefetch_task
+{
+  char *relpath;		/* relative to root_fd */
+  int depth;
+};
+
+struct prefetch_worker
+{
+  pthread_t thread;
+  pthread_mutex_t lock;		/* protects the deque */
+  struct prefetch_task *tasks;	/* circular buffer */
+  size_t head;			/* index of the oldest task */
+  size_t count;			/* number of queued tasks */
+  size_t allocated;
+  unsigned int index;
+
+  /* Statistics, read only after the thread has been joined. */
+  uintmax_t dirs_read;
+  uintmax_t entries_seen;
+  uintmax_t stats_done;
+  uintmax_t steals;
+};
+
+static struct prefetch_worker *workers = NULL;
+static unsigned int nworkers = 0u;
+static int root_fd = -1;
+static dev_t root_dev;
+static bool want_stat;
+
+/* idle_lock protects pending, generation and stopping. */
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static size_t pending;		/* queued or in-progress tasks */
+static unsigned long generation; /* bumped whenever work is queued */
+static bool stopping;
+
+
+static bool
+is_stopping (void)
+{
+  bool result;
+  pthread_mutex_lock (&idle_lock);
+  result = stopping;
+  pthread_mutex_unlock (&idle_lock);
+  return result;
+}
+
+static void
+push_task (struct prefetch_worker *w, char *relpath, int depth)
+{
+  size_t slot;
+
+  pthread_mutex_lock (&idle_lock);
+  if (stopping || pending >= MaxPendingPerWorker * nworkers)
+    {
+      pthread_mutex_unlock (&idle_lock);
+      free (relpath);
+      return;
+    }
+  ++pending;
+  pthread_mutex_unlock (&idle_lock);
+
+  pthread_mutex_lock (&w->lock);
+  if (w->count == w->allocated)
+    {
+      /* Grow the buffer, unwrapping it as we go. */
+      size_t i, newsize = w->allocated ? 2 * w->allocated : InitialDequeSize;
+      struct prefetch_task *newtasks = xnmalloc (newsize, sizeof *newtasks);
+      for (i = 0; i < w->count; ++i)
+	newtasks[i] = w->tasks[(w->head + i) % w->allocated];
+      free (w->tasks);
+      w->tasks = newtasks;
+      w->head = 0;
+      w->allocated = newsize;
+    }
+  slot = (w->head + w->count) % w->allocated;
+  w->tasks[slot].relpath = relpath;
+  w->tasks[slot].depth = depth;
+  ++w->count;
+  pthread_mutex_unlock (&w->lock);
+
+  pthread_mutex_lock (&idle_lock);
+  ++generation;
+  pthread_cond_broadcast (&idle_cond);
+  pthread_mutex_unlock (&idle_lock);
+}
+
+/* Take the most recently queued task from our own deque. */
+static bool
+pop_task (struct prefetch_worker *w, struct prefetch_task *out)
+{
+  bool found = false;
+  pthread_mutex_lock (&w->lock);
+  if (w->count)
+    {
+      --w->count;
+      *out = w->tasks[(w->head + w->count) % w->allocated];
+      found = true;
+    }
+  pthread_mutex_unlock (&w->lock);
+  return found;
+}
+
+/* Take the oldest task from some other worker's deque. */
+static bool
+steal_task (struct prefetch_worker *thief, struct prefetch_task *out)
+{
+  unsigned int i;
+  for (i = 1; i < nworkers; ++i)
+    {
+      struct prefetch_worker *victim = &workers[(thief->index + i) % nworkers];
+      bool found = false;
+
+      pthread_mutex_lock (&victim->lock);
+      if (victim->count)
+	{
+	  *out = victim->tasks[victim->head];
+	  victim->head = (victim->head + 1) % victim->allocated;
+	  --victim->count;
+	  found = true;
+	}
+      pthread_mutex_unlock (&victim->lock);
+      if (found)
+	{
+	  ++thief->steals;
+	  return true;
+	}
+    }
+  return false;
+}
+
+static void
+task_done (void)
+{
+  pthread_mutex_lock (&idle_lock);
+  assert (pending > 0);
+  if (0 == --pending)
+    pthread_cond_broadcast (&idle_cond);
+  pthread_mutex_unlock (&idle_lock);
+}
+
+static char *
+child_path (const char *parent, const char *name)
+{
+  size_t plen = strlen (parent), nlen = strlen (name);
+  char *result = xmalloc (plen + nlen + 2);
+  memcpy (result, parent, plen);
+  result[plen] = '/';
+  memcpy (result + plen + 1, name, nlen + 1);
+  return result;
+}
+
+/* Read one directory, stat its entries if the expression will need
+ * that, and queue its subdirectories.
+ */
+static void
+scan_directory (struct prefetch_worker *w, const struct prefetch_task *task)
+{
+  DIR *dirp;
+  struct dirent *dp;
+  int fd, flags = O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC;
+  bool descend;
+
+  /* The start point itself may be a symbolic link we are supposed to
+   * follow, but we never follow links below it.  That way we cannot
+   * get into a loop and never need to keep track of where we have been.
+   */
+  if (task->depth > 0 || options.symlink_handling == SYMLINK_NEVER_DEREF)
+    flags |= O_NOFOLLOW;
+
+  fd = openat (root_fd, task->relpath, flags);
+  if (fd < 0)
+    return;
+
+  if (options.stay_on_filesystem && task->depth > 0)
+    {
+      struct stat st;
+      if (0 != fstat (fd, &st) || st.st_dev != root_dev)
+	{
+	  close (fd);
+	  return;
+	}
+    }
+
+  dirp = fdopendir (fd);
+  if (NULL == dirp)
+    {
+      close (fd);
+      return;
+    }
+  ++w->dirs_read;
+
+  descend = (options.maxdepth < 0) || (task->depth + 1 < options.maxdepth);
+  while ((dp = readdir (dirp)) != NULL)
+    {
+      const char *name = dp->d_name;
+      bool isdir = false, known = false;
+
+      if (name[name[0] != '.' ? 0 : name[1] != '.' ? 1 : 2] == '\0')
+	continue;		/* "", "." or ".." */
+      /* Checking for a request to stop needs a lock, so don't do it
+       * for every entry.
+       */
+      if (0 == (++w->entries_seen % 256u) && is_stopping ())
+	break;
+
+#if defined HAVE_STRUCT_DIRENT_D_TYPE && defined DT_UNKNOWN
+      if (dp->d_type != DT_UNKNOWN)
+	{
+	  isdir = (DT_DIR == dp->d_type);
+	  known = true;
+	}
+#endif
+      if (want_stat || !known)
+	{
+	  struct stat st;
+	  ++w->stats_done;
+	  if (0 == find_fstatat (dirfd (dirp), name, &st,
+				 AT_SYMLINK_NOFOLLOW))
+	    isdir = S_ISDIR (st.st_mode);
+	}
+      if (isdir && descend)
+	push_task (w, child_path (task->relpath, name), task->depth + 1);
+    }
+  closedir (dirp);
+}
+
+static void *
+worker_main (void *arg)
+{
+  struct prefetch_worker *w = arg;
+  struct prefetch_task task;
+
+  for (;;)
+    {
+      unsigned long gen;
+      bool finished;
+
+      pthread_mutex_lock (&idle_lock);
+      gen = generation;
+      pthread_mutex_unlock (&idle_lock);
+
+      if (pop_task (w, &task) || steal_task (w, &task))
+	{
+	  if (!is_stopping ())
+	    scan_directory (w, &task);
+	  free (task.relpath);
+	  task_done ();
+	  continue;
+	}
+
+      /* Nothing to do.  Wait until either someone queues more work or
+       * all outstanding work is finished.
+       */
+      pthread_mutex_lock (&idle_lock);
+      while (!stopping && pending > 0 && gen == generation)
+	pthread_cond_wait (&idle_cond, &idle_lock);
+      finished = stopping || (0 == pending);
+      pthread_mutex_unlock (&idle_lock);
+      if (finished)
+	break;
+    }
+  return NULL;
+}
+
+/* Start NTHREADS threads reading ahead below the start point PATHNAME.
+ * PATHNAME is interpreted relative to the current working directory.
+ */
+void
+prefetch_start (const char *pathname, int nthreads)
+{
+  struct stat st;
+  unsigned int i;
+  int flags = O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC;
+
+  if (nthreads < 1 || workers != NULL)
+    return;
+
+  if (options.symlink_handling == SYMLINK_NEVER_DEREF)
+    flags |= O_NOFOLLOW;
+  root_fd = open (pathname, flags);
+  if (root_fd < 0)
+    return;			/* not a directory; nothing to do. */
+  if (0 != fstat (root_fd, &st))
+    {
+      close (root_fd);
+      root_fd = -1;
+      return;
+    }
+  root_dev = st.st_dev;
+  want_stat = expression_needs_stat (get_eval_tree ());
+
+  stopping = false;
+  pending = 0;
+  generation = 0;
+  nworkers = nthreads;
+  workers = xcalloc (nworkers, sizeof *workers);
+  for (i = 0; i < nworkers; ++i)
+    {
+      workers[i].index = i;
+      pthread_mutex_init (&workers[i].lock, NULL);
+    }
+
+  /* Queue the start point before any thread exists, so that none of
+   * them decides there is nothing to do.
+   */
+  push_task (&workers[0], xstrdup ("."), 0);
+
+  for (i = 0; i < nworkers; ++i)
+    {
+      int err = pthread_create (&workers[i].thread, NULL,
+				worker_main, &workers[i]);
+      if (err)
+	{
+	  /* Carry on with however many threads we have. */
+	  if (0 == i)
+	    {
+	      struct prefetch_task task;
+	      while (pop_task (&workers[0], &task))
+		{
+		  free (task.relpath);
+		  task_done ();
+		}
+	    }
+	  nworkers = i;
+	  break;
+	}
+    }
+  if (0 == nworkers)
+    {
+      free (workers);
+      workers = NULL;
+      close (root_fd);
+      root_fd = -1;
+    }
+}
+
+
+/* Stop the read-ahead threads (if any) and wait for them to finish.
+ */
+void
+prefetch_stop (void)
+{
+  unsigned int i;
+  uintmax_t dirs = 0u, entries = 0u, stats = 0u, steals = 0u;
+
+  if (NULL == workers)
+    return;
+
+  pthread_mutex_lock (&idle_lock);
+  stopping = true;
+  pthread_cond_broadcast (&idle_cond);
+  pthread_mutex_unlock (&idle_lock);
+
+  for (i = 0; i < nworkers; ++i)
+    {
+      struct prefetch_task task;
+      pthread_join (workers[i].thread, NULL);
+      while (pop_task (&workers[i], &task))
+	free (task.relpath);
+      free (workers[i].tasks);
+      pthread_mutex_destroy (&workers[i].lock);
+
+      dirs += workers[i].dirs_read;
+      entries += workers[i].entries_seen;
+      stats += workers[i].stats_done;
+      steals += workers[i].steals;
+    }
+
+  if (options.debug_options & DebugSearch)
+    fprintf (stderr,
+	     "prefetch: %u threads read %" PRIuMAX " directories, "
+	     "saw %" PRIuMAX " entries, made %" PRIuMAX " stat calls "
+	     "and stole work %" PRIuMAX " times\n",
+	     nworkers, dirs, entries, stats, steals);
+
+  free (workers);
+  workers = NULL;
+  nworkers = 0u;
+  close (root_fd);
+  root_fd = -1;
+}
+
+#else  /* !USE_POSIX_THREADS */
+
+void
+prefetch_start (const char *pathname, int nthreads)
+{
+  (void) pathname;
+  (void) nthreads;
+}
+
+void
+prefetch_stop (void)
+{
+}
+
+#endif /* USE_POSIX_THREADS */
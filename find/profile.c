@@ -0,0 +1,397 @@
+/* profile.c -- remember how predicates behave from one run to the next.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The optimiser has to guess how often each test will succeed and
+ * how long it will take.  With -profile FILE, we record at the end of
+ * the run how often each test was evaluated, how often it succeeded
+ * and how much time it took (the same counts that -D rates shows),
+ * and on later runs we use these figures instead of the guesses.
+ *
+ * Tests are identified by their name and argument, as -D rates shows
+ * them, so a profile can be shared by several different commands,
+ * though it works best if each has its own.  Each time a test's
+ * figures are saved, those from earlier runs are halved first, so that
+ * the profile follows changes in the files being searched.
+ *
+ * The file is plain text: a header line, then one line per test
+ * giving the number of evaluations, the number of successes, the
+ * total time in nanoseconds, and the test itself.  Lines for things
+ * other than tests, such as the cost of stat on each filesystem that
+ * -calibrate measures (see calibrate.c), have a key starting with "@".
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xalloc.h"
+#include "error.h"
+#include "hash.h"
+#include "hash-pjw.h"
+#include "timespec.h"
+#include "stdio-safer.h"
+#include "defs.h"
+
+#if ENABLE_NLS
+# include <libintl.h>
+# define _(Text) gettext (Text)
+#else
+# define _(Text) Text
+#endif
+
+enum
+  {
+    DefaultHashTableSize = 61,
+
+    /* Figures based on fewer evaluations than this are not used. */
+    ProfileMinVisits = 32
+  };
+
+static const char profile_magic[] = "GNU find profile 1\n";
+
+struct profile_entry
+{
+  char *key;			/* the test and its argument */
+  uintmax_t visits;
+  uintmax_t successes;
+  uintmax_t nsec;
+  bool merged;			/* already updated by this run */
+};
+
+static Hash_table *profile_table = NULL;
+static const char *profile_file = NULL;
+
+
+static size_t
+profile_entry_hash (const void *pv, size_t buckets)
+{
+  const struct profile_entry *p = pv;
+  return hash_pjw (p->key, buckets);
+}
+
+static bool
+profile_entry_compare (const void *av, const void *bv)
+{
+  const struct profile_entry *a = av, *b = bv;
+  return 0 == strcmp (a->key, b->key);
+}
+
+static void
+profile_entry_free (void *pv)
+{
+  struct profile_entry *p = pv;
+  free (p->key);
+  free (p);
+}
+
+/* Return the key for P, which the caller must free, or NULL if P
+ * cannot be recorded.  Options are not worth recording.
+ */
+static char *
+profile_key (const struct predicate *p)
+{
+  char *key;
+
+  if (NULL == p->p_name
+      || (p->parser_entry && ARG_NOOP == p->parser_entry->type))
+    return NULL;
+  if (p->arg_text)
+    {
+      key = xmalloc (strlen (p->p_name) + 1u + strlen (p->arg_text) + 1u);
+      sprintf (key, "%s %s", p->p_name, p->arg_text);
+    }
+  else
+    {
+      key = xstrdup (p->p_name);
+    }
+  if (strchr (key, '\n'))
+    {
+      free (key);
+      return NULL;
+    }
+  return key;
+}
+
+static struct profile_entry *
+profile_lookup (const char *key)
+{
+  struct profile_entry probe;
+  probe.key = (char *) key;
+  return hash_lookup (profile_table, &probe);
+}
+
+/* Parse LINE, which has the trailing newline removed.  */
+static bool
+parse_profile_line (char *line)
+{
+  struct profile_entry *p, *old;
+  uintmax_t v[3];
+  char *s = line, *end;
+  int i;
+
+  for (i = 0; i < 3; ++i)
+    {
+      if (*s < '0' || *s > '9')
+	return false;
+      errno = 0;
+      v[i] = strtoumax (s, &end, 10);
+      if (errno || ' ' != *end)
+	return false;
+      s = end + 1;
+    }
+  if ('\0' == *s || v[1] > v[0])
+    return false;
+
+  p = xmalloc (sizeof *p);
+  p->key = xstrdup (s);
+  p->visits = v[0];
+  p->successes = v[1];
+  p->nsec = v[2];
+  p->merged = false;
+  old = hash_delete (profile_table, p);
+  if (old)
+    profile_entry_free (old);
+  if (NULL == hash_insert (profile_table, p))
+    xalloc_die ();
+  return true;
+}
+
+static void
+read_profile (const char *filename)
+{
+  FILE *fp = fopen_safer (filename, "r");
+  char *line = NULL;
+  size_t linesize = 0;
+  ssize_t len;
+  bool bad = false;
+
+  if (NULL == fp)
+    {
+      if (ENOENT != errno)
+	nonfatal_nontarget_file_error (errno, filename);
+      return;
+    }
+
+  len = getline (&line, &linesize, fp);
+  if (len < 0 || 0 != strcmp (line, profile_magic))
+    bad = true;
+  while (!bad && (len = getline (&line, &linesize, fp)) > 0)
+    {
+      if ('\n' != line[len - 1])
+	bad = true;
+      else
+	{
+	  line[len - 1] = '\0';
+	  bad = !parse_profile_line (line);
+	}
+    }
+
+  if (ferror (fp))
+    {
+      nonfatal_nontarget_file_error (errno, filename);
+      hash_clear (profile_table);
+    }
+  else if (bad)
+    {
+      error (0, 0, _("ignoring the profile %s, which is not valid"),
+	     safely_quote_err_filename (0, filename));
+      hash_clear (profile_table);
+    }
+  free (line);
+  fclose (fp);
+}
+
+/* Load the profile in FILENAME, and use it in place of the estimated
+ * success rates and costs of the tests in the list PREDICATES.  It is
+ * not an error for the file not to exist yet.
+ */
+void
+profile_start (const char *filename, struct predicate *predicates)
+{
+  struct predicate *p;
+
+  profile_file = filename;
+  profile_table = hash_initialize (DefaultHashTableSize, NULL,
+				   profile_entry_hash, profile_entry_compare,
+				   profile_entry_free);
+  if (NULL == profile_table)
+    xalloc_die ();
+  read_profile (filename);
+
+  for (p = predicates; p; p = p->pred_next)
+    {
+      const struct profile_entry *e;
+      char *key;
+
+      if (PRIMARY_TYPE != p->p_type || NULL == (key = profile_key (p)))
+	continue;
+      e = profile_lookup (key);
+      if (e && e->visits >= ProfileMinVisits)
+	{
+	  p->est_success_rate = (float) e->successes / e->visits;
+	  p->est_nsec = (float) e->nsec / e->visits;
+	  if (options.debug_options & DebugTreeOpt)
+	    fprintf (stderr, "profile: %s succeeds %g of the time "
+		     "and takes %gns\n", key,
+		     p->est_success_rate, p->est_nsec);
+	}
+      free (key);
+    }
+}
+
+/* Apply P to PATHNAME, adding the time it took to *NSEC. */
+bool
+profile_call (const char *pathname, struct stat *stat_buf,
+	      struct predicate *p, uintmax_t *nsec)
+{
+  struct timespec before, after;
+  bool result;
+
+  gettime (&before);
+  result = (p->pred_func) (pathname, stat_buf, p);
+  gettime (&after);
+  /* Ignore the clock going backwards. */
+  if (timespec_cmp (after, before) > 0)
+    *nsec += ((uintmax_t) (after.tv_sec - before.tv_sec) * 1000000000u
+	      + after.tv_nsec - before.tv_nsec);
+  return result;
+}
+
+
+/* Set *NSEC to the mean time recorded in the profile for KEY, which is
+ * not a test but something calibrate.c measured, and return true; or
+ * return false if there is no profile or KEY is not in it.
+ */
+bool
+profile_get_cost (const char *key, float *nsec)
+{
+  const struct profile_entry *e;
+
+  if (NULL == profile_table || NULL == (e = profile_lookup (key))
+      || 0 == e->visits)
+    return false;
+  *nsec = (float) e->nsec / e->visits;
+  return true;
+}
+
+/* Record in the profile that SAMPLES measurements of KEY took NSEC
+ * nanoseconds in all, replacing any earlier figures.
+ */
+void
+profile_put_cost (const char *key, uintmax_t samples, uintmax_t nsec)
+{
+  struct profile_entry *e;
+
+  if (NULL == profile_table)
+    return;
+  e = profile_lookup (key);
+  if (NULL == e)
+    {
+      e = xzalloc (sizeof *e);
+      e->key = xstrdup (key);
+      if (NULL == hash_insert (profile_table, e))
+	xalloc_die ();
+    }
+  e->visits = samples;
+  e->successes = 0u;
+  e->nsec = nsec;
+  e->merged = true;
+}
+
+
+/* Fold the counts of the tests in the tree P into the profile. */
+static void
+merge_counts (const struct predicate *p)
+{
+  struct profile_entry *e;
+  char *key;
+
+  if (NULL == p)
+    return;
+  merge_counts (p->pred_left);
+  merge_counts (p->pred_right);
+
+  if (PRIMARY_TYPE != p->p_type || 0 == p->perf.visits
+      || NULL == (key = profile_key (p)))
+    return;
+  e = profile_lookup (key);
+  if (NULL == e)
+    {
+      e = xzalloc (sizeof *e);
+      e->key = key;
+      if (NULL == hash_insert (profile_table, e))
+	xalloc_die ();
+    }
+  else
+    {
+      free (key);
+    }
+  if (!e->merged)
+    {
+      e->visits /= 2u;
+      e->successes /= 2u;
+      e->nsec /= 2u;
+      e->merged = true;
+    }
+  e->visits += p->perf.visits;
+  e->successes += p->perf.successes;
+  e->nsec += p->perf.nsec;
+}
+
+static bool
+write_profile_entry (void *entry, void *data)
+{
+  const struct profile_entry *p = entry;
+  FILE *fp = data;
+
+  return fprintf (fp, "%" PRIuMAX " %" PRIuMAX " %" PRIuMAX " %s\n",
+		  p->visits, p->successes, p->nsec, p->key) > 0;
+}
+
+static bool
+write_profile (FILE *fp, void *data)
+{
+  (void) data;
+  return (EOF != fputs (profile_magic, fp))
+    && (hash_get_n_entries (profile_table)
+	== hash_do_for_each (profile_table, write_profile_entry, fp));
+}
+
+/* Save the profile, including what we have seen during this run, and
+ * release everything.
+ */
+void
+profile_stop (void)
+{
+  if (NULL == profile_table)
+    return;
+
+  /* The counts are kept in the compiled program, if there is one. */
+  update_tree_perf (get_eval_tree ());
+  merge_counts (get_eval_tree ());
+
+  (void) replace_file (profile_file, "w", write_profile, NULL);
+
+  hash_free (profile_table);
+  profile_table = NULL;
+}
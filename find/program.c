@@ -0,0 +1,622 @@
+/* program.c -- compile the expression tree into a flat program.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Evaluating the expression tree directly means a chain of calls
+ * through pred_and, pred_or and so on for every file, each of which
+ * touches a large struct predicate.  Instead, once the tree has been
+ * optimised, we turn it into an array of instructions, one for each
+ * test or action.  The operators disappear: each instruction says
+ * which instruction to go to next if it succeeds and which if it
+ * fails, so the short-circuit evaluation is just a jump.  The
+ * instructions are laid out in the order in which they are usually
+ * executed, and carry the few things the evaluator needs to look at
+ * for every file, so it seldom has to touch the predicates themselves
+ * except to call them.
+ *
+ * The instructions count how often they succeed and fail, and these
+ * counts are added to those in the tree (see update_tree_perf) when
+ * anything needs to look at them.
+ *
+ * With -batch_eval, the tests at the start of the program which only
+ * look at the name or type of a file are applied to all the entries
+ * of a directory at once (see run_program_batch and evalbatch.c), and
+ * run_program_after_batch carries on from there for each file.
+ *
+ * The results of tests which occur more than once in the expression
+ * are remembered for each file in the memo slots of simplify.c.
+ *
+ * "-D interp" makes find evaluate the tree as before, so that the two
+ * can be compared, and "-D prog" shows the compiled program.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xalloc.h"
+#include "defs.h"
+
+enum
+  {
+    /* Jump targets which end the program. */
+    ProgReturnFalse = -2,
+    ProgReturnTrue = -1
+  };
+
+enum opcode
+  {
+    OpCall,			/* call the predicate function */
+    OpType			/* -type, done inline */
+  };
+
+enum
+  {
+    /* The need_* flags of the predicate. */
+    InsnNeedStat = 0x1,
+    InsnNeedType = 0x2,
+    InsnNeedInum = 0x4
+  };
+
+struct instruction
+{
+  PRED_FUNC pred_func;
+  struct predicate *pred;
+  unsigned char opcode;		/* enum opcode */
+  unsigned char needs;		/* InsnNeed* flags */
+  bool forgets;			/* has side effects; see memo_forget */
+  mode_t type;			/* for OpType */
+  int memo;			/* the predicate's memo slot, or -1 */
+  int on_true, on_false;	/* next instruction, or ProgReturn* */
+  unsigned long visits, successes;
+  uintmax_t nsec;		/* with -profile */
+};
+
+static struct instruction *program = NULL;
+static int program_size = 0;
+static int program_entry = ProgReturnTrue;
+static int emit_pos;
+
+/* Incremented each time the expression is compiled, so that we can
+ * tell whether a batch_result is for the current program.
+ */
+static unsigned long program_generation = 0u;
+
+/* The instructions which run_program_batch applies, in order, and for
+ * each one the result which lets a file go on to the next; any other
+ * result makes the expression false.
+ */
+static int *batch_chain = NULL;
+static bool *batch_want = NULL;
+static int batch_len = 0;
+static bool batch_needs_path = false;
+
+
+static int
+count_primaries (const struct predicate *p)
+{
+  if (NULL == p)
+    return 0;
+  else if (pred_is (p, pred_and) || pred_is (p, pred_or)
+	   || pred_is (p, pred_comma) || pred_is (p, pred_negate))
+    return count_primaries (p->pred_left) + count_primaries (p->pred_right);
+  else
+    return 1;
+}
+
+/* Can we compile P?  We only know about the operators which are
+ * listed in compile_node.
+ */
+static bool
+compilable (const struct predicate *p)
+{
+  if (NULL == p)
+    return true;
+  switch (p->p_type)
+    {
+    case BI_OP:
+      if (!pred_is (p, pred_and) && !pred_is (p, pred_or)
+	  && !pred_is (p, pred_comma))
+	return false;
+      break;
+    case UNI_OP:
+      if (!pred_is (p, pred_negate) || p->pred_left)
+	return false;
+      break;
+    case PRIMARY_TYPE:
+      return NULL == p->pred_left && NULL == p->pred_right;
+    default:
+      return false;
+    }
+  return compilable (p->pred_left) && compilable (p->pred_right);
+}
+
+/* Emit the instructions for P, going to ON_TRUE if it succeeds and to
+ * ON_FALSE if it fails.  We fill the program in from the end, right
+ * hand operands first, so that the instructions end up in the order
+ * in which they are evaluated.  Return the index of the first
+ * instruction for P.
+ */
+static int
+compile_node (struct predicate *p, int on_true, int on_false)
+{
+  struct instruction *insn;
+
+  if (pred_is (p, pred_and))
+    {
+      int right = compile_node (p->pred_right, on_true, on_false);
+      return p->pred_left ? compile_node (p->pred_left, right, on_false) : right;
+    }
+  else if (pred_is (p, pred_or))
+    {
+      int right = compile_node (p->pred_right, on_true, on_false);
+      return p->pred_left ? compile_node (p->pred_left, on_true, right) : right;
+    }
+  else if (pred_is (p, pred_comma))
+    {
+      int right = compile_node (p->pred_right, on_true, on_false);
+      return p->pred_left ? compile_node (p->pred_left, right, right) : right;
+    }
+  else if (pred_is (p, pred_negate))
+    {
+      return compile_node (p->pred_right, on_false, on_true);
+    }
+
+  assert (emit_pos > 0);
+  insn = &program[--emit_pos];
+  insn->pred_func = p->pred_func;
+  insn->pred = p;
+  insn->opcode = OpCall;
+  insn->needs = ((p->need_stat ? InsnNeedStat : 0)
+		 | (p->need_type ? InsnNeedType : 0)
+		 | (p->need_inum ? InsnNeedInum : 0));
+  insn->forgets = p->side_effects;
+  insn->type = 0;
+  insn->memo = p->memo;
+#ifdef S_IFMT
+  if (pred_is (p, pred_type))
+    {
+      insn->opcode = OpType;
+      insn->type = p->args.type;
+    }
+#endif
+  insn->on_true = on_true;
+  insn->on_false = on_false;
+  insn->visits = insn->successes = 0;
+  insn->nsec = 0u;
+  return emit_pos;
+}
+
+/* Can INSN be applied to a file knowing only its name, or its path,
+ * and its type?  Set *NEEDS_PATH if it needs the whole path.
+ */
+static bool
+batchable (const struct instruction *insn, bool *needs_path)
+{
+  PRED_FUNC f = insn->pred_func;
+
+#ifdef S_IFMT
+  if (OpType == insn->opcode)
+    {
+      /* With -L, the type is that of the file a link points to, and
+       * fts has not looked at that.
+       */
+      return options.symlink_handling != SYMLINK_ALWAYS_DEREF;
+    }
+#endif
+  if (pred_true == f || pred_name == f || pred_iname == f
+      || pred_name_set == f)
+    return true;
+  if (pred_path == f || pred_ipath == f || pred_path_set == f
+      || pred_regex == f)
+    {
+      *needs_path = true;
+      return true;
+    }
+  return false;
+}
+
+/* Find the tests at the start of the program which run_program_batch
+ * can apply.  We stop at the first test which is not followed by the
+ * next whatever its result, other than by the expression being false.
+ */
+static void
+find_batch_chain (void)
+{
+  int pc = program_entry;
+
+  batch_len = 0;
+  batch_needs_path = false;
+  /* -profile needs the time taken by each test for each file. */
+  if (!options.batch_eval || options.profile_file)
+    return;
+
+  while (pc >= 0)
+    {
+      const struct instruction *insn = &program[pc];
+      bool want;
+
+      if (ProgReturnFalse == insn->on_false)
+	want = true;
+      else if (ProgReturnFalse == insn->on_true)
+	want = false;
+      else
+	break;
+      if (!batchable (insn, &batch_needs_path))
+	break;
+      batch_chain[batch_len] = pc;
+      batch_want[batch_len] = want;
+      ++batch_len;
+      pc = want ? insn->on_true : insn->on_false;
+    }
+}
+
+/* Compile the expression EVAL_TREE.  If we can't, or the user asked
+ * for the tree to be interpreted, we leave things so that
+ * apply_expression uses the tree directly.
+ */
+void
+compile_expression (struct predicate *eval_tree)
+{
+  free (program);
+  free (batch_chain);
+  free (batch_want);
+  program = NULL;
+  batch_chain = NULL;
+  batch_want = NULL;
+  batch_len = 0;
+  program_size = 0;
+  program_entry = ProgReturnTrue;
+  ++program_generation;
+
+  if ((options.debug_options & DebugInterpret) || !compilable (eval_tree))
+    return;
+
+  program_size = count_primaries (eval_tree);
+  program = xnmalloc (program_size ? program_size : 1, sizeof *program);
+  emit_pos = program_size;
+  if (eval_tree)
+    program_entry = compile_node (eval_tree, ProgReturnTrue, ProgReturnFalse);
+  assert (0 == emit_pos);
+
+  batch_chain = xnmalloc (program_size ? program_size : 1, sizeof *batch_chain);
+  batch_want = xnmalloc (program_size ? program_size : 1, sizeof *batch_want);
+  find_batch_chain ();
+
+  if (options.debug_options & DebugProgram)
+    print_program (stderr);
+}
+
+bool
+expression_is_compiled (void)
+{
+  return NULL != program;
+}
+
+/* Apply the single instruction INSN to PATHNAME. */
+static inline bool
+execute (struct instruction *insn, const char *pathname,
+	 struct stat *stat_buf)
+{
+  if (insn->needs && get_info (pathname, stat_buf, insn->pred) != 0)
+    return false;
+#ifdef S_IFMT
+  if (OpType == insn->opcode)
+    {
+      mode_t mode = state.have_stat ? stat_buf->st_mode : state.type;
+      return (0 != state.type) && (mode & S_IFMT) == insn->type;
+    }
+#endif
+  if (options.profile_file)
+    return profile_call (pathname, stat_buf, insn->pred, &insn->nsec);
+  return (insn->pred_func) (pathname, stat_buf, insn->pred);
+}
+
+/* Run the compiled program for PATHNAME, starting at instruction PC.
+ * This does just what apply_predicate does for each node of the tree.
+ */
+static bool
+run_from (int pc, const char *pathname, struct stat *stat_buf)
+{
+  while (pc >= 0)
+    {
+      struct instruction *insn = &program[pc];
+      bool result;
+
+      ++insn->visits;
+      if (insn->memo < 0)
+	{
+	  result = execute (insn, pathname, stat_buf);
+	  if (insn->forgets)
+	    memo_forget ();
+	}
+      else if (!memo_recall (insn->memo, &result))
+	{
+	  result = execute (insn, pathname, stat_buf);
+	  memo_store (insn->memo, result);
+	}
+
+      if (result)
+	{
+	  ++insn->successes;
+	  pc = insn->on_true;
+	}
+      else
+	{
+	  pc = insn->on_false;
+	}
+    }
+  return ProgReturnTrue == pc;
+}
+
+bool
+run_program (const char *pathname, struct stat *stat_buf)
+{
+  return run_from (program_entry, pathname, stat_buf);
+}
+
+/* Return the number of tests which run_program_batch applies, and set
+ * *NEEDS_PATH if any of them needs the whole path of each file rather
+ * than just its name.
+ */
+int
+program_batch_length (bool *needs_path)
+{
+  *needs_path = batch_needs_path;
+  return batch_len;
+}
+
+/* Apply the tests at the start of the program to N files at once.
+ * NAMES gives the path of each file (or just its name, if
+ * program_batch_length said that is enough) and MODES its type, or 0
+ * if that is not known.  We apply each test to all the files which
+ * passed the ones before it, rather than all the tests to each file in
+ * turn, so that the loop over the files is tight and the branches in
+ * it predictable.  The results go in RESULTS, for
+ * run_program_after_batch or count_batch_result.  The counts of the
+ * tests are not updated yet, since we may never be asked about some of
+ * these files.
+ */
+void
+run_program_batch (const char *const *names, const mode_t *modes,
+		   size_t n, struct batch_result *results)
+{
+  size_t *live = xnmalloc (n ? n : 1, sizeof *live);
+  size_t nlive, i, j;
+  int k;
+
+  for (i = 0; i < n; ++i)
+    {
+      results[i].generation = program_generation;
+      results[i].passed = 0;
+      results[i].failed = false;
+      live[i] = i;
+    }
+
+  for (k = 0, nlive = n; k < batch_len && nlive > 0; ++k)
+    {
+      const struct instruction *insn = &program[batch_chain[k]];
+      const bool want = batch_want[k];
+
+      for (i = j = 0; i < nlive; ++i)
+	{
+	  const size_t f = live[i];
+	  bool result;
+
+#ifdef S_IFMT
+	  if (OpType == insn->opcode)
+	    {
+	      if (0 == modes[f])
+		continue;	/* leave it to run_program_after_batch */
+	      result = (modes[f] & S_IFMT) == insn->type;
+	    }
+	  else
+#endif
+	    {
+	      result = (insn->pred_func) (names[f], NULL, insn->pred);
+	    }
+
+	  if (result == want)
+	    {
+	      results[f].passed = k + 1;
+	      live[j++] = f;
+	    }
+	  else
+	    {
+	      results[f].failed = true;
+	    }
+	}
+      nlive = j;
+    }
+  free (live);
+}
+
+/* Count a visit to the Kth test of the batch, which the file passed
+ * if PASSED is true.
+ */
+static void
+count_batched (int k, bool passed)
+{
+  struct instruction *insn = &program[batch_chain[k]];
+
+  ++insn->visits;
+  if (passed == batch_want[k])
+    ++insn->successes;
+}
+
+/* Add the tests which run_program_batch applied to a file, with result
+ * R, to their counts.  The caller must not then pass R to
+ * run_program_after_batch.
+ */
+void
+count_batch_result (const struct batch_result *r)
+{
+  int k;
+
+  if (r->generation != program_generation)
+    return;
+  for (k = 0; k < r->passed; ++k)
+    count_batched (k, true);
+  if (r->failed)
+    count_batched (r->passed, false);
+}
+
+/* Finish running the program for PATHNAME, to which run_program_batch
+ * has already applied the first tests, with result R.
+ */
+bool
+run_program_after_batch (const char *pathname, struct stat *stat_buf,
+			 const struct batch_result *r)
+{
+  const struct instruction *last;
+
+  /* The program has changed since (at -O4), so start again. */
+  if (r->generation != program_generation)
+    return run_program (pathname, stat_buf);
+
+  count_batch_result (r);
+  if (r->failed)
+    return false;
+  if (r->passed < batch_len)
+    return run_from (batch_chain[r->passed], pathname, stat_buf);
+  last = &program[batch_chain[batch_len - 1]];
+  return run_from (batch_want[batch_len - 1] ? last->on_true : last->on_false,
+		   pathname, stat_buf);
+}
+
+
+/* Add the counts in the program to the predicates of the subtree P,
+ * whose first instruction is at *NEXT, working out those of the
+ * operators, which have no instructions of their own, from those of
+ * their operands.  Return the counts we added to P.
+ */
+static struct predicate_performance_info
+collect_perf (struct predicate *p, int *next)
+{
+  struct predicate_performance_info l = { 0, 0, 0 }, r = { 0, 0, 0 }, d;
+
+  if (p->pred_left)
+    l = collect_perf (p->pred_left, next);
+  if (p->pred_right)
+    r = collect_perf (p->pred_right, next);
+
+  if (pred_is (p, pred_and) || pred_is (p, pred_comma))
+    {
+      d.visits = p->pred_left ? l.visits : r.visits;
+      d.successes = r.successes;
+      d.nsec = l.nsec + r.nsec;
+    }
+  else if (pred_is (p, pred_or))
+    {
+      d.visits = p->pred_left ? l.visits : r.visits;
+      d.successes = l.successes + r.successes;
+      d.nsec = l.nsec + r.nsec;
+    }
+  else if (pred_is (p, pred_negate))
+    {
+      d.visits = r.visits;
+      d.successes = r.visits - r.successes;
+      d.nsec = r.nsec;
+    }
+  else
+    {
+      /* The instructions are in the same order as the primaries. */
+      struct instruction *insn = &program[(*next)++];
+
+      assert (insn->pred == p);
+      d.visits = insn->visits;
+      d.successes = insn->successes;
+      d.nsec = insn->nsec;
+      insn->visits = insn->successes = 0;
+      insn->nsec = 0u;
+    }
+  p->perf.visits += d.visits;
+  p->perf.successes += d.successes;
+  p->perf.nsec += d.nsec;
+  return d;
+}
+
+/* Copy the counts of visits and successes from the program into the
+ * expression tree.  This must be done before the tree is changed in
+ * any way, since the program's counts only make sense for the tree
+ * it was compiled from.
+ */
+void
+update_tree_perf (struct predicate *eval_tree)
+{
+  int next = 0;
+
+  if (NULL == program || NULL == eval_tree)
+    return;
+  collect_perf (eval_tree, &next);
+  assert (next == program_size);
+}
+
+static void
+print_target (FILE *fp, int target)
+{
+  if (ProgReturnTrue == target)
+    fprintf (fp, "true");
+  else if (ProgReturnFalse == target)
+    fprintf (fp, "false");
+  else
+    fprintf (fp, "%d", target);
+}
+
+void
+print_program (FILE *fp)
+{
+  int i;
+
+  if (NULL == program)
+    {
+      fprintf (fp, "The expression is not compiled.\n");
+      return;
+    }
+  fprintf (fp, "Compiled program (%d instructions, starting at ",
+	   program_size);
+  print_target (fp, program_entry);
+  fprintf (fp, "):\n");
+  for (i = 0; i < program_size; ++i)
+    {
+      const struct instruction *insn = &program[i];
+      bool batched = false;
+      int k;
+
+      for (k = 0; k < batch_len; ++k)
+	if (batch_chain[k] == i)
+	  batched = true;
+
+      fprintf (fp, "%4d: %s", i, OpType == insn->opcode ? "type " : "call ");
+      print_predicate (fp, insn->pred);
+      fprintf (fp, "%s%s%s%s",
+	       (insn->needs & InsnNeedStat) ? " [call stat]" : "",
+	       (insn->needs & InsnNeedType) ? " [need type]" : "",
+	       (insn->needs & InsnNeedInum) ? " [need inum]" : "",
+	       batched ? " [batched]" : "");
+      if (insn->memo >= 0)
+	fprintf (fp, " [memo %d]", insn->memo);
+      fprintf (fp, " -> ");
+      print_target (fp, insn->on_true);
+      fprintf (fp, " else ");
+      print_target (fp, insn->on_false);
+      fprintf (fp, "\n");
+    }
+}
@@ -0,0 +1,548 @@
+/* report.c -- -top and -histogram, which report on the files found.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* "-top N FIELD" remembers the N files with the largest size or the
+ * latest timestamp, and "-histogram FIELDS" counts the files in each
+ * bucket of size, age, owner and so on.  Both print their results when
+ * find exits, saving a "find -printf ... | sort | head" pipeline which
+ * would format, sort and parse a line for every file.
+ *
+ * The memory they use depends only on N and on the number of buckets.
+ * -top keeps the files in a heap whose root is the one which would be
+ * dropped next, so that a file which does not make the list costs one
+ * comparison, and only the names of files which do are copied.  Sizes
+ * and ages are put into buckets whose bounds are powers of two, so
+ * there are never more than a few dozen of those.
+ *
+ * -duplicates, which also prints its results at the end, is here too,
+ * but the work is done in dupes.c.
+ */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "xalloc.h"
+#include "idname.h"
+#include "printquoted.h"
+#include "stat-time.h"
+#include "defs.h"
+
+enum
+  {
+    DefaultHashTableSize = 31,
+
+    /* The largest number of fields -histogram can count by. */
+    MaxHistogramFields = 2
+  };
+
+enum report_field
+  {
+    FieldSize,
+    FieldAtime,
+    FieldCtime,
+    FieldMtime,
+    FieldUser,
+    FieldGroup,
+    FieldType
+  };
+
+static const struct
+{
+  const char *name;
+  enum report_field field;
+  bool top;			/* can be used with -top */
+} field_names[] =
+  {
+    { "size",  FieldSize,  true  },
+    { "atime", FieldAtime, true  },
+    { "ctime", FieldCtime, true  },
+    { "mtime", FieldMtime, true  },
+    { "user",  FieldUser,  false },
+    { "group", FieldGroup, false },
+    { "type",  FieldType,  false },
+  };
+
+/* The value by which -top orders files. */
+struct top_key
+{
+  intmax_t sec;			/* or the size */
+  long int nsec;
+};
+
+struct top_entry
+{
+  struct top_key key;
+  uintmax_t seq;		/* the order in which files were found */
+  char *pathname;
+};
+
+/* The counts for one bucket of a histogram. */
+struct bucket
+{
+  uintmax_t key[MaxHistogramFields];
+  uintmax_t files;
+  uintmax_t bytes;
+};
+
+struct report
+{
+  struct report_val *val;	/* the predicate's arguments */
+  enum report_field fields[MaxHistogramFields];
+  size_t n_fields;
+
+  /* For -top. */
+  bool is_top;
+  struct top_entry *heap;
+  size_t heap_size;		/* N */
+  size_t heap_used, heap_alloc;
+  uintmax_t seq;
+
+  /* For -histogram. */
+  Hash_table *buckets;
+
+  /* For -duplicates. */
+  struct dupes *dupes;
+
+  struct report *next;
+};
+
+/* The reports, in the order they appear on the command line. */
+static struct report *first = NULL, *last = NULL;
+
+
+static bool
+lookup_field (const char *name, size_t len, bool top,
+	      enum report_field *field)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof field_names / sizeof field_names[0]; ++i)
+    if (strlen (field_names[i].name) == len
+	&& 0 == strncmp (field_names[i].name, name, len)
+	&& (field_names[i].top || !top))
+      {
+	*field = field_names[i].field;
+	return true;
+      }
+  return false;
+}
+
+static struct report *
+new_report (struct report_val *val)
+{
+  struct report *r = xzalloc (sizeof *r);
+
+  r->val = val;
+  val->report = r;
+  if (last)
+    last->next = r;
+  else
+    first = r;
+  last = r;
+  return r;
+}
+
+/* Set up VAL, the arguments of "-top N FIELD".  Return false if FIELD
+ * is not something -top can order files by.
+ */
+bool
+report_new_top (struct report_val *val, uintmax_t n, const char *field)
+{
+  enum report_field f;
+  struct report *r;
+
+  if (!lookup_field (field, strlen (field), true, &f))
+    return false;
+  r = new_report (val);
+  r->is_top = true;
+  r->fields[0] = f;
+  r->n_fields = 1u;
+  r->heap_size = n;
+  return true;
+}
+
+static size_t
+bucket_hash (const void *pv, size_t n_buckets)
+{
+  const struct bucket *p = pv;
+  uintmax_t h = p->key[0] * 31u + p->key[1];
+  return h % n_buckets;
+}
+
+static bool
+bucket_compare (const void *av, const void *bv)
+{
+  const struct bucket *a = av, *b = bv;
+  return 0 == memcmp (a->key, b->key, sizeof a->key);
+}
+
+/* Set up VAL, the arguments of "-histogram FIELDS", where FIELDS is a
+ * list of up to MaxHistogramFields field names separated by commas.
+ * Return false if FIELDS is not valid.
+ */
+bool
+report_new_histogram (struct report_val *val, const char *fields)
+{
+  enum report_field f[MaxHistogramFields];
+  size_t n = 0u;
+  const char *s = fields;
+  struct report *r;
+
+  for (;;)
+    {
+      size_t len = strcspn (s, ",");
+      if (n == MaxHistogramFields || !lookup_field (s, len, false, &f[n]))
+	return false;
+      ++n;
+      if ('\0' == s[len])
+	break;
+      s += len + 1u;
+    }
+
+  r = new_report (val);
+  memcpy (r->fields, f, n * sizeof f[0]);
+  r->n_fields = n;
+  r->buckets = hash_initialize (DefaultHashTableSize, NULL,
+				bucket_hash, bucket_compare, free);
+  if (NULL == r->buckets)
+    xalloc_die ();
+  return true;
+}
+
+/* Set up VAL, the arguments of -duplicates. */
+void
+report_new_duplicates (struct report_val *val)
+{
+  struct report *r = new_report (val);
+  r->dupes = dupes_new ();
+}
+
+
+static struct top_key
+top_key (enum report_field field, const struct stat *st)
+{
+  struct timespec ts;
+  struct top_key k;
+
+  switch (field)
+    {
+    case FieldAtime:
+      ts = get_stat_atime (st);
+      break;
+    case FieldCtime:
+      ts = get_stat_ctime (st);
+      break;
+    case FieldMtime:
+      ts = get_stat_mtime (st);
+      break;
+    case FieldSize:
+    default:
+      k.sec = st->st_size;
+      k.nsec = 0;
+      return k;
+    }
+  k.sec = ts.tv_sec;
+  k.nsec = ts.tv_nsec;
+  return k;
+}
+
+/* Should A come after B in the list?  Of two files with the same key,
+ * the one found first comes first.
+ */
+static bool
+top_after (const struct top_entry *a, const struct top_entry *b)
+{
+  if (a->key.sec != b->key.sec)
+    return a->key.sec < b->key.sec;
+  if (a->key.nsec != b->key.nsec)
+    return a->key.nsec < b->key.nsec;
+  return a->seq > b->seq;
+}
+
+/* Restore the heap property of R's heap, after the entry at I changed. */
+static void
+sift_down (struct report *r, size_t i)
+{
+  struct top_entry *h = r->heap;
+  size_t n = r->heap_used;
+
+  for (;;)
+    {
+      size_t child = 2u * i + 1u, worst = i;
+      struct top_entry tmp;
+
+      if (child < n && top_after (&h[child], &h[worst]))
+	worst = child;
+      if (child + 1u < n && top_after (&h[child + 1u], &h[worst]))
+	worst = child + 1u;
+      if (worst == i)
+	break;
+      tmp = h[i];
+      h[i] = h[worst];
+      h[worst] = tmp;
+      i = worst;
+    }
+}
+
+static void
+top_add (struct report *r, const char *pathname, const struct stat *st)
+{
+  struct top_entry e;
+
+  e.key = top_key (r->fields[0], st);
+  e.seq = r->seq++;
+
+  if (r->heap_used < r->heap_size)
+    {
+      size_t i;
+
+      if (r->heap_used == r->heap_alloc)
+	r->heap = x2nrealloc (r->heap, &r->heap_alloc, sizeof *r->heap);
+
+      /* Sift the new entry up. */
+      e.pathname = xstrdup (pathname);
+      for (i = r->heap_used++; i > 0u; i = (i - 1u) / 2u)
+	{
+	  struct top_entry *parent = &r->heap[(i - 1u) / 2u];
+	  if (!top_after (&e, parent))
+	    break;
+	  r->heap[i] = *parent;
+	}
+      r->heap[i] = e;
+    }
+  else if (top_after (&r->heap[0], &e))
+    {
+      free (r->heap[0].pathname);
+      e.pathname = xstrdup (pathname);
+      r->heap[0] = e;
+      sift_down (r, 0u);
+    }
+}
+
+/* Return the lower bound of the power-of-two bucket containing N. */
+static uintmax_t
+log_bucket (uintmax_t n)
+{
+  uintmax_t b = 1u;
+
+  if (0u == n)
+    return 0u;
+  while (n >>= 1)
+    b <<= 1;
+  return b;
+}
+
+/* Return the age in days of a file with timestamp TS, as -mtime would
+ * see it, put into a bucket, or UINTMAX_MAX if it is in the future.
+ */
+static uintmax_t
+age_bucket (struct timespec ts)
+{
+  /* cur_day_start is a day before the time -mtime measures from. */
+  intmax_t secs = options.cur_day_start.tv_sec + DAYSECS - ts.tv_sec;
+
+  if (secs < 0)
+    return UINTMAX_MAX;
+  return log_bucket (secs / DAYSECS);
+}
+
+static uintmax_t
+histogram_key (enum report_field field, const struct stat *st)
+{
+  switch (field)
+    {
+    case FieldSize:
+      return log_bucket (st->st_size < 0 ? 0u : (uintmax_t) st->st_size);
+    case FieldAtime:
+      return age_bucket (get_stat_atime (st));
+    case FieldCtime:
+      return age_bucket (get_stat_ctime (st));
+    case FieldMtime:
+      return age_bucket (get_stat_mtime (st));
+    case FieldUser:
+      return st->st_uid;
+    case FieldGroup:
+      return st->st_gid;
+    case FieldType:
+    default:
+      return st->st_mode & S_IFMT;
+    }
+}
+
+static void
+histogram_add (struct report *r, const struct stat *st)
+{
+  struct bucket probe, *b;
+  size_t i;
+
+  memset (&probe, 0, sizeof probe);
+  for (i = 0; i < r->n_fields; ++i)
+    probe.key[i] = histogram_key (r->fields[i], st);
+
+  b = hash_lookup (r->buckets, &probe);
+  if (NULL == b)
+    {
+      b = xmemdup (&probe, sizeof probe);
+      if (NULL == hash_insert (r->buckets, b))
+	xalloc_die ();
+    }
+  ++b->files;
+  if (st->st_size > 0)
+    b->bytes += st->st_size;
+}
+
+/* Count the file PATHNAME in the report for VAL. */
+void
+report_add (struct report_val *val, const char *pathname,
+	    const struct stat *st)
+{
+  struct report *r = val->report;
+
+  if (NULL == r)
+    return;			/* we have already printed it */
+  if (r->is_top)
+    top_add (r, pathname, st);
+  else if (r->dupes)
+    dupes_add (r->dupes, pathname, st);
+  else
+    histogram_add (r, st);
+}
+
+
+static int
+compare_top_entries (const void *av, const void *bv)
+{
+  const struct top_entry *a = av, *b = bv;
+  return top_after (a, b) ? 1 : top_after (b, a) ? -1 : 0;
+}
+
+static void
+print_top (struct report *r)
+{
+  FILE *fp = r->val->dest.stream;
+  size_t i;
+
+  qsort (r->heap, r->heap_used, sizeof *r->heap, compare_top_entries);
+  for (i = 0; i < r->heap_used; ++i)
+    {
+      const struct top_entry *e = &r->heap[i];
+
+      if (FieldSize == r->fields[0])
+	fprintf (fp, "%" PRIdMAX "\t", e->key.sec);
+      else
+	fprintf (fp, "%" PRIdMAX ".%09ld0\t", e->key.sec, e->key.nsec);
+      print_quoted (fp, r->val->dest.quote_opts, r->val->dest.dest_is_tty,
+		    "%s\n", e->pathname);
+      free (e->pathname);
+    }
+  free (r->heap);
+}
+
+static int
+compare_buckets (const void *av, const void *bv)
+{
+  const struct bucket *a = *(const struct bucket * const *) av;
+  const struct bucket *b = *(const struct bucket * const *) bv;
+  size_t i;
+
+  for (i = 0; i < MaxHistogramFields; ++i)
+    if (a->key[i] != b->key[i])
+      return a->key[i] < b->key[i] ? -1 : 1;
+  return 0;
+}
+
+static void
+print_label (const struct report *r, enum report_field field, uintmax_t key)
+{
+  FILE *fp = r->val->dest.stream;
+  const char *name = NULL;
+
+  switch (field)
+    {
+    case FieldAtime:
+    case FieldCtime:
+    case FieldMtime:
+      if (UINTMAX_MAX == key)
+	name = "future";
+      break;
+    case FieldUser:
+      name = uid_to_name ((uid_t) key);
+      break;
+    case FieldGroup:
+      name = gid_to_name ((gid_t) key);
+      break;
+    case FieldType:
+      name = mode_to_filetype ((mode_t) key);
+      break;
+    case FieldSize:
+      break;
+    }
+  if (name)
+    print_quoted (fp, r->val->dest.quote_opts, r->val->dest.dest_is_tty,
+		  "%s\t", name);
+  else
+    fprintf (fp, "%" PRIuMAX "\t", key);
+}
+
+static void
+print_histogram (struct report *r)
+{
+  FILE *fp = r->val->dest.stream;
+  size_t n = hash_get_n_entries (r->buckets), i, j;
+  struct bucket **v = xnmalloc (n, sizeof *v);
+
+  hash_get_entries (r->buckets, (void **) v, n);
+  qsort (v, n, sizeof *v, compare_buckets);
+  for (i = 0; i < n; ++i)
+    {
+      for (j = 0; j < r->n_fields; ++j)
+	print_label (r, r->fields[j], v[i]->key[j]);
+      fprintf (fp, "%" PRIuMAX "\t%" PRIuMAX "\n", v[i]->files, v[i]->bytes);
+    }
+  free (v);
+  hash_free (r->buckets);
+}
+
+/* Print each report, in the order they appear on the command line, and
+ * forget them.  This happens once, when find exits.
+ */
+void
+report_finish (void)
+{
+  while (first)
+    {
+      struct report *r = first;
+
+      first = r->next;
+      if (r->is_top)
+	print_top (r);
+      else if (r->dupes)
+	dupes_print (r->dupes, &r->val->dest);
+      else
+	print_histogram (r);
+      r->val->report = NULL;
+      free (r);
+    }
+  last = NULL;
+}
@@ -0,0 +1,591 @@
+/* simplify.c -- remove redundant parts of the expression.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Command lines which are generated by other programs often say the
+ * same thing several times, for example "-type f" in every branch of
+ * a chain of -o, or contain things like "-true -a X".  Before the
+ * optimiser rearranges the expression, simplify_expression
+ *
+ *   - merges range tests on the same quantity in a chain of -a or -o,
+ *     so that "-size +10k -size +1M" becomes "-size +1M", and
+ *     "-mtime -7 -o -mtime -30" becomes "-mtime -30";
+ *
+ *   - folds -true and -false into the operators around them, so that
+ *     "-true -a X" becomes "X" and "! ! X" becomes "X"; and
+ *
+ *   - at -O2 and above, finds the tests without side effects which
+ *     occur more than once, and gives each set of identical tests a
+ *     slot in which the result is remembered, so that each is only
+ *     evaluated once for each file (see memo_recall).
+ *
+ * Anything with side effects is left where it is, and nothing is moved
+ * past it.  The results remembered for a file are forgotten as soon as
+ * anything with side effects is done, since an action such as -exec
+ * may change the file.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+#include "hash.h"
+#include "timespec.h"
+#include "defs.h"
+
+enum
+  {
+    DefaultHashTableSize = 61
+  };
+
+/* The result of a subtree, if it is for the file with the serial
+ * number SERIAL.
+ */
+struct memo
+{
+  uintmax_t serial;
+  bool result;
+};
+
+static struct memo *memos = NULL;
+static int memo_count = 0;
+
+/* Each file we evaluate the expression for gets a new serial number,
+ * as does each run of tests after something with side effects.
+ */
+static uintmax_t current_serial = 1u;
+
+/* A subtree which we have seen, for finding the others like it. */
+struct subtree
+{
+  struct predicate *p;
+  size_t hash;
+};
+
+
+/* Is P -true or -false, or the negation of one?  If so set *VALUE. */
+static bool
+constant_value (const struct predicate *p, bool *value)
+{
+  if (pred_is (p, pred_true) || pred_is (p, pred_false))
+    {
+      *value = pred_is (p, pred_true);
+      return true;
+    }
+  if (pred_is (p, pred_negate) && p->pred_right
+      && constant_value (p->pred_right, value))
+    {
+      *value = !*value;
+      return true;
+    }
+  return false;
+}
+
+static void
+show_dropped (const struct predicate *p, const char *why)
+{
+  if (options.debug_options & DebugTreeOpt)
+    {
+      fprintf (stderr, "Simplifying: dropping ");
+      print_predicate (stderr, p);
+      fprintf (stderr, "%s\n", why);
+    }
+}
+
+
+/* The quantities which range tests compare with a bound. */
+enum range_quantity
+  {
+    RangeNone,
+    RangeSize,
+    RangeAtime,
+    RangeCtime,
+    RangeMtime,
+    RangeOther			/* the pred_func says which */
+  };
+
+/* A test of the form "X > BOUND" (if KIND is COMP_GT) or "X < BOUND"
+ * (if it is COMP_LT).
+ */
+struct range
+{
+  enum range_quantity quantity;
+  PRED_FUNC func;
+  enum comparison_type kind;
+  uintmax_t bound;		/* for everything but times */
+  struct timespec ts;		/* for times */
+};
+
+/* If P is a test of a range which we know how to merge, describe it in
+ * *R and return true.
+ */
+static bool
+get_range (const struct predicate *p, struct range *r)
+{
+  PRED_FUNC f = p->pred_func;
+
+  r->quantity = RangeNone;
+  r->func = f;
+  r->bound = 0u;
+  r->ts.tv_sec = 0;
+  r->ts.tv_nsec = 0;
+
+  if (pred_size == f)
+    {
+      /* pred_size compares the size in blocks, rounded up, so
+       * "-size +N" is true for sizes above N blocks, and "-size -N"
+       * for sizes of at most N-1 blocks.
+       */
+      uintmax_t n = p->args.size.size;
+      uintmax_t b = p->args.size.blocksize;
+
+      r->kind = p->args.size.kind;
+      if (COMP_GT == r->kind && n <= UINTMAX_MAX / b)
+	r->bound = n * b;
+      else if (COMP_LT == r->kind && n > 0u && n - 1u <= (UINTMAX_MAX - 1u) / b)
+	r->bound = (n - 1u) * b + 1u;
+      else
+	return false;
+      r->quantity = RangeSize;
+      return true;
+    }
+
+  if (pred_uid == f || pred_gid == f || pred_inum == f || pred_links == f)
+    {
+      r->kind = p->args.numinfo.kind;
+      r->bound = p->args.numinfo.l_val;
+      r->quantity = RangeOther;
+    }
+  else if (pred_amin == f || pred_atime == f || pred_anewer == f)
+    {
+      r->kind = p->args.reftime.kind;
+      r->ts = p->args.reftime.ts;
+      r->quantity = RangeAtime;
+    }
+  else if (pred_cmin == f || pred_ctime == f || pred_cnewer == f)
+    {
+      r->kind = p->args.reftime.kind;
+      r->ts = p->args.reftime.ts;
+      r->quantity = RangeCtime;
+    }
+  else if (pred_mmin == f || pred_mtime == f || pred_newer == f)
+    {
+      r->kind = p->args.reftime.kind;
+      r->ts = p->args.reftime.ts;
+      r->quantity = RangeMtime;
+    }
+  return RangeNone != r->quantity && COMP_EQ != r->kind;
+}
+
+/* Compare the bounds of A and B, which are of the same quantity. */
+static int
+compare_bounds (const struct range *a, const struct range *b)
+{
+  if (RangeAtime == a->quantity || RangeCtime == a->quantity
+      || RangeMtime == a->quantity)
+    return timespec_cmp (a->ts, b->ts);
+  return a->bound < b->bound ? -1 : a->bound > b->bound;
+}
+
+/* Tests A and B are both in a chain of -a (if CONJUNCTION is true) or
+ * of -o.  If one of them makes the other redundant, return -1 if A is
+ * the one to drop, or 1 if it is B, and otherwise return 0.
+ */
+static int
+redundant_range (const struct predicate *a, const struct predicate *b,
+		 bool conjunction)
+{
+  struct range ra, rb;
+  int cmp;
+  bool keep_higher;
+
+  if (!get_range (a, &ra) || !get_range (b, &rb)
+      || ra.quantity != rb.quantity || ra.kind != rb.kind
+      || (RangeOther == ra.quantity && ra.func != rb.func))
+    return 0;
+
+  /* With -a we want the stronger condition, which for "X > BOUND" is
+   * the higher bound, and with -o the weaker one.
+   */
+  keep_higher = (COMP_GT == ra.kind) == conjunction;
+  cmp = compare_bounds (&ra, &rb);
+  if (0 == cmp)
+    return 1;
+  return ((cmp > 0) == keep_higher) ? 1 : -1;
+}
+
+/* The places in the tree of the operands of a chain of operators. */
+struct chain
+{
+  struct predicate ***ops;
+  size_t n, alloc;
+};
+
+/* Add to C the operands of the chain of operators using FUNC which
+ * starts at *SLOT.
+ */
+static void
+collect_chain (struct predicate **slot, PRED_FUNC func, struct chain *c)
+{
+  if (*slot && pred_is (*slot, func))
+    {
+      collect_chain (&(*slot)->pred_left, func, c);
+      collect_chain (&(*slot)->pred_right, func, c);
+    }
+  else if (*slot)
+    {
+      if (c->n == c->alloc)
+	c->ops = x2nrealloc (c->ops, &c->alloc, sizeof *c->ops);
+      c->ops[c->n++] = slot;
+    }
+}
+
+/* Merge the range tests in each chain of -a or -o in the tree at
+ * *SLOT.  The tests we drop are replaced with NULL, which
+ * fold_constants then removes.
+ */
+static void
+merge_ranges (struct predicate **slot)
+{
+  struct chain c = { NULL, 0u, 0u };
+  struct predicate ***ops;
+  size_t n, i, j, start, end;
+  PRED_FUNC func;
+
+  if (NULL == *slot)
+    return;
+  if (!pred_is (*slot, pred_and) && !pred_is (*slot, pred_or))
+    {
+      merge_ranges (&(*slot)->pred_left);
+      merge_ranges (&(*slot)->pred_right);
+      return;
+    }
+
+  func = (*slot)->pred_func;
+  collect_chain (slot, func, &c);
+  ops = c.ops;
+  n = c.n;
+
+  /* Only compare tests which have nothing with side effects between
+   * them.
+   */
+  for (start = 0u; start < n; start = end + 1u)
+    {
+      for (end = start; end < n; ++end)
+	if (subtree_has_side_effects (*ops[end]))
+	  break;
+      for (i = start; i < end; ++i)
+	for (j = i + 1u; j < end && *ops[i]; ++j)
+	  {
+	    int which;
+
+	    if (NULL == *ops[j])
+	      continue;
+	    which = redundant_range (*ops[i], *ops[j], pred_and == func);
+	    if (which < 0)
+	      {
+		show_dropped (*ops[i], ", which a later test makes redundant");
+		*ops[i] = NULL;
+	      }
+	    else if (which > 0)
+	      {
+		show_dropped (*ops[j], ", which an earlier test makes redundant");
+		*ops[j] = NULL;
+	      }
+	  }
+    }
+
+  for (i = 0u; i < n; ++i)
+    merge_ranges (ops[i]);
+  free (ops);
+}
+
+/* Remove the -true and -false tests which make no difference in the
+ * tree at *SLOT, and the operands merge_ranges has dropped.
+ */
+static void
+fold_constants (struct predicate **slot)
+{
+  struct predicate *p = *slot, *l, *r;
+  bool lv, rv, lconst, rconst;
+
+  if (NULL == p)
+    return;
+  fold_constants (&p->pred_left);
+  fold_constants (&p->pred_right);
+  l = p->pred_left;
+  r = p->pred_right;
+
+  if (pred_is (p, pred_negate))
+    {
+      /* "! ! X" is X. */
+      if (r && pred_is (r, pred_negate) && r->pred_right)
+	{
+	  show_dropped (p, " twice");
+	  *slot = r->pred_right;
+	}
+      return;
+    }
+  if (BI_OP != p->p_type)
+    return;
+  if (NULL == l || NULL == r)
+    {
+      *slot = l ? l : r;
+      return;
+    }
+
+  lconst = constant_value (l, &lv);
+  rconst = constant_value (r, &rv);
+  if (pred_is (p, pred_and) || pred_is (p, pred_or))
+    {
+      /* The value which decides the result of the operator on its own. */
+      const bool decisive = pred_is (p, pred_or);
+
+      if (lconst)
+	{
+	  /* "-true -a X" is X, and "-false -a X" is false. */
+	  show_dropped (lv == decisive ? r : l, "");
+	  *slot = lv == decisive ? l : r;
+	}
+      else if (rconst && rv != decisive)
+	{
+	  /* "X -a -true" is X. */
+	  show_dropped (r, "");
+	  *slot = l;
+	}
+      else if (rconst && !subtree_has_side_effects (l))
+	{
+	  /* "X -a -false" is false, if X does nothing. */
+	  show_dropped (l, "");
+	  *slot = r;
+	}
+    }
+  else if (pred_is (p, pred_comma))
+    {
+      /* "X , Y" is Y, if X does nothing. */
+      if (!subtree_has_side_effects (l))
+	{
+	  show_dropped (l, "");
+	  *slot = r;
+	}
+    }
+}
+
+
+/* Return a hash code for the subtree P.  Subtrees which are the same
+ * (see same_subtree) have the same code.
+ */
+static size_t
+subtree_hash (const struct predicate *p)
+{
+  size_t h;
+  const char *s;
+
+  if (NULL == p)
+    return 0u;
+  h = (size_t) p->p_type * 31u;
+  for (s = p->p_name ? p->p_name : ""; *s; ++s)
+    h = h * 31u + (unsigned char) *s;
+  if (PRIMARY_TYPE == p->p_type && p->arg_text)
+    for (s = p->arg_text; *s; ++s)
+      h = h * 31u + (unsigned char) *s;
+  h = h * 31u + subtree_hash (p->pred_left);
+  h = h * 31u + subtree_hash (p->pred_right);
+  return h;
+}
+
+static bool
+same_string (const char *a, const char *b)
+{
+  return a == b || (a && b && 0 == strcmp (a, b));
+}
+
+/* Are the tests A and B the same?  Tests are the same if they were
+ * given in the same way, except that the meaning of a -regex depends
+ * on the -regextype before it, that of a test on times on whether
+ * -daystart came before it, and that of -contains on -contents_limit
+ * and -contents_nobinary.
+ */
+static bool
+same_test (const struct predicate *a, const struct predicate *b)
+{
+  PRED_FUNC f = a->pred_func;
+
+  if (f != b->pred_func
+      || !same_string (a->p_name, b->p_name)
+      || !same_string (a->arg_text, b->arg_text))
+    return false;
+  if (pred_regex == f)
+    return a->args.regex.re->syntax == b->args.regex.re->syntax;
+  if (pred_amin == f || pred_atime == f || pred_anewer == f
+      || pred_cmin == f || pred_ctime == f || pred_cnewer == f
+      || pred_mmin == f || pred_mtime == f || pred_newer == f
+      || pred_newerXY == f || pred_used == f)
+    return (a->args.reftime.xval == b->args.reftime.xval
+	    && a->args.reftime.kind == b->args.reftime.kind
+	    && 0 == timespec_cmp (a->args.reftime.ts, b->args.reftime.ts));
+  if (pred_samefile == f)
+    return (a->args.samefileid.dev == b->args.samefileid.dev
+	    && a->args.samefileid.ino == b->args.samefileid.ino);
+  if (pred_contains == f)
+    return (a->args.contents.limit == b->args.contents.limit
+	    && a->args.contents.nobinary == b->args.contents.nobinary
+	    && (NULL == a->args.contents.re
+		|| a->args.contents.re->syntax == b->args.contents.re->syntax));
+  return true;
+}
+
+static bool
+same_subtree (const struct predicate *a, const struct predicate *b)
+{
+  if (NULL == a || NULL == b)
+    return a == b;
+  if (a->p_type != b->p_type || a->pred_func != b->pred_func)
+    return false;
+  if (PRIMARY_TYPE == a->p_type)
+    return same_test (a, b);
+  return (same_subtree (a->pred_left, b->pred_left)
+	  && same_subtree (a->pred_right, b->pred_right));
+}
+
+static size_t
+subtree_table_hash (const void *pv, size_t buckets)
+{
+  const struct subtree *s = pv;
+  return s->hash % buckets;
+}
+
+static bool
+subtree_table_compare (const void *av, const void *bv)
+{
+  const struct subtree *a = av, *b = bv;
+  return a->hash == b->hash && same_subtree (a->p, b->p);
+}
+
+/* Give each test in P which has no side effects, and is the same as
+ * one we have already seen, the memo slot of that one.  Return true
+ * if P has side effects.
+ *
+ * Only tests get memo slots, not operators: the optimiser goes on to
+ * relink the chains of -a and -o, so an operator node would keep its
+ * slot after the subtree below it had changed.
+ */
+static bool
+find_common_subtrees (struct predicate *p, Hash_table *seen)
+{
+  struct subtree *s, *found;
+  bool effects;
+  bool dummy;
+
+  if (NULL == p)
+    return false;
+  effects = find_common_subtrees (p->pred_left, seen);
+  if (find_common_subtrees (p->pred_right, seen))
+    effects = true;
+  if (effects || p->side_effects)
+    return true;
+
+  /* The type of a file is already known by the time we evaluate -type,
+   * so remembering it would save nothing.
+   */
+  if (PRIMARY_TYPE != p->p_type
+      || pred_is (p, pred_type) || constant_value (p, &dummy))
+    return false;
+
+  s = xmalloc (sizeof *s);
+  s->p = p;
+  s->hash = subtree_hash (p);
+  found = hash_insert (seen, s);
+  if (NULL == found)
+    xalloc_die ();
+  if (found != s)
+    {
+      free (s);
+      if (found->p->memo < 0)
+	{
+	  found->p->memo = memo_count++;
+	  if (options.debug_options & DebugTreeOpt)
+	    {
+	      fprintf (stderr, "Remembering the result of ");
+	      print_predicate (stderr, found->p);
+	      fprintf (stderr, " for each file, since it occurs more than once\n");
+	    }
+	}
+      p->memo = found->p->memo;
+    }
+  return false;
+}
+
+/* Simplify the expression tree at *TREEP, as described above. */
+void
+simplify_expression (struct predicate **treep)
+{
+  Hash_table *seen;
+  int i;
+
+  merge_ranges (treep);
+  fold_constants (treep);
+
+  if (options.optimisation_level < 2 || NULL == *treep)
+    return;
+  seen = hash_initialize (DefaultHashTableSize, NULL,
+			  subtree_table_hash, subtree_table_compare, free);
+  if (NULL == seen)
+    xalloc_die ();
+  find_common_subtrees (*treep, seen);
+  hash_free (seen);
+
+  free (memos);
+  memos = xnmalloc (memo_count ? memo_count : 1, sizeof *memos);
+  for (i = 0; i < memo_count; ++i)
+    memos[i].serial = 0u;
+}
+
+
+/* If we already know the result of the subtree with memo slot SLOT for
+ * the current file, set *RESULT to it and return true.
+ */
+bool
+memo_recall (int slot, bool *result)
+{
+  assert (slot < memo_count);
+  if (memos[slot].serial != current_serial)
+    return false;
+  *result = memos[slot].result;
+  return true;
+}
+
+/* Remember that the subtree with memo slot SLOT gave RESULT. */
+void
+memo_store (int slot, bool result)
+{
+  assert (slot < memo_count);
+  memos[slot].serial = current_serial;
+  memos[slot].result = result;
+}
+
+/* Forget every result we have remembered, because we are moving on to
+ * the next file, or because something may have changed this one.
+ */
+void
+memo_forget (void)
+{
+  ++current_serial;
+}
@@ -0,0 +1,528 @@
+/* snapshot.c -- remember directory contents from one run of find to the next.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With -snapshot FILE, we record the entries of each directory we
+ * read, together with the directory's device and inode numbers and
+ * its modification and status change times.  On the next run, if a
+ * directory still has the same times, its contents cannot have
+ * changed, so we hand fts the recorded entries instead of reading
+ * the directory again.  We still open the directory, since fts needs
+ * a file descriptor for it, but we don't call readdir on it.
+ *
+ * All we record for each entry is what readdir tells us: the name,
+ * the inode number and (where the file system supplies it) the file
+ * type.  Those cannot change without changing the directory.  Other
+ * information about the entries can change without the directory
+ * changing, so we don't keep it.
+ *
+ * A directory changed within the same second as we read it might
+ * end up with the same times as the snapshot but different contents,
+ * so we don't record directories whose status change time is not
+ * before the time at which find started.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "xalloc.h"
+#include "error.h"
+#include "hash.h"
+#include "stat-time.h"
+#include "timespec.h"
+#include "stdio-safer.h"
+#include "fts_.h"
+#include "defs.h"
+
+#if ENABLE_NLS
+# include <libintl.h>
+# define _(Text) gettext (Text)
+#else
+# define _(Text) Text
+#endif
+
+enum
+  {
+    DefaultHashTableSize = 1021,
+
+    /* Lets us recognise files written with a different byte order. */
+    SnapshotByteOrder = 0x01020304
+  };
+
+static const char snapshot_magic[] = "GNU find snapshot 1\n";
+
+/* The recorded contents of one directory. */
+struct snap_dir
+{
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+  size_t count;			/* number of entries */
+  size_t names_size;		/* bytes in NAMES */
+  uint64_t *inodes;		/* COUNT inode numbers */
+  unsigned char *types;		/* COUNT d_type values */
+  char *names;			/* COUNT null-terminated names */
+  bool keep;			/* write this out at the end */
+};
+
+/* The state of a directory which fts is in the middle of reading.
+ * We hang this from the directory's fts_pointer field.
+ */
+struct snap_read
+{
+  struct snap_read *next_pending;
+  DIR *dirp;
+  struct snap_dir *hit;		/* recorded contents we are handing out */
+  size_t next;			/* index of the next entry of HIT */
+  const char *next_name;	/* name of that entry */
+  bool recording;		/* save what readdir gives us */
+  struct snap_dir rec;		/* what we have read so far */
+  size_t inodes_alloc, names_alloc;
+  struct dirent ent;		/* what we return to fts */
+};
+
+static Hash_table *snapshot_table = NULL;
+static const char *snapshot_file = NULL;
+static struct snap_read *pending = NULL;
+
+/* Statistics, for -D search. */
+static uintmax_t dirs_served, dirs_read;
+
+
+static size_t
+snap_dir_hash (const void *pv, size_t buckets)
+{
+  const struct snap_dir *p = pv;
+  return (p->dev ^ p->ino) % buckets;
+}
+
+static bool
+snap_dir_compare (const void *av, const void *bv)
+{
+  const struct snap_dir *a = av, *b = bv;
+  return (a->ino == b->ino) && (a->dev == b->dev);
+}
+
+static void
+snap_dir_free (void *pv)
+{
+  struct snap_dir *p = pv;
+  free (p->inodes);
+  free (p);
+}
+
+/* Allocate a snap_dir whose three arrays share a single block. */
+static struct snap_dir *
+snap_dir_alloc (size_t count, size_t names_size)
+{
+  struct snap_dir *p = xmalloc (sizeof *p);
+  size_t inode_bytes;
+
+  if (xalloc_oversized (count, sizeof *p->inodes + 1)
+      || count * (sizeof *p->inodes + 1) + names_size < names_size)
+    xalloc_die ();
+  inode_bytes = count * sizeof *p->inodes;
+  p->inodes = xmalloc (inode_bytes + count + names_size + 1);
+  p->types = (unsigned char *) p->inodes + inode_bytes;
+  p->names = (char *) p->types + count;
+  p->count = count;
+  p->names_size = names_size;
+  p->keep = false;
+  return p;
+}
+
+static void
+snap_dir_replace (struct snap_dir *p)
+{
+  struct snap_dir *old = hash_delete (snapshot_table, p);
+  if (old)
+    snap_dir_free (old);
+  if (NULL == hash_insert (snapshot_table, p))
+    xalloc_die ();
+}
+
+
+static bool
+read_u64 (FILE *fp, uint64_t *val)
+{
+  return 1 == fread (val, sizeof *val, 1, fp);
+}
+
+/* Read one directory from FP.  Return NULL at the end of the file
+ * and set *BAD if the file is not a valid snapshot.
+ */
+static struct snap_dir *
+read_snap_dir (FILE *fp, bool *bad)
+{
+  uint64_t v[8];
+  struct snap_dir *p;
+  size_t i, nuls, len;
+  int c;
+
+  c = getc (fp);
+  if (EOF == c)
+    return NULL;
+  ungetc (c, fp);
+
+  for (i = 0; i < sizeof v / sizeof v[0]; ++i)
+    {
+      if (!read_u64 (fp, &v[i]))
+	{
+	  *bad = true;
+	  return NULL;
+	}
+    }
+  /* Each name has at least one byte plus its null. */
+  if (v[6] > v[7] / 2u || v[7] > SIZE_MAX / 2u)
+    {
+      *bad = true;
+      return NULL;
+    }
+
+  p = snap_dir_alloc (v[6], v[7]);
+  p->dev = v[0];
+  p->ino = v[1];
+  p->mtime.tv_sec = v[2];
+  p->mtime.tv_nsec = v[3];
+  p->ctime.tv_sec = v[4];
+  p->ctime.tv_nsec = v[5];
+  if (p->count != fread (p->inodes, sizeof *p->inodes, p->count, fp)
+      || p->count != fread (p->types, 1, p->count, fp)
+      || p->names_size != fread (p->names, 1, p->names_size, fp))
+    {
+      snap_dir_free (p);
+      *bad = true;
+      return NULL;
+    }
+  for (nuls = len = i = 0; i < p->names_size; ++i)
+    {
+      if ('\0' == p->names[i])
+	{
+	  if (0 == len)
+	    break;
+	  ++nuls;
+	  len = 0;
+	}
+      else if (++len >= sizeof ((struct dirent *) 0)->d_name)
+	{
+	  break;
+	}
+    }
+  if (i != p->names_size || nuls != p->count)
+    {
+      snap_dir_free (p);
+      *bad = true;
+      return NULL;
+    }
+  return p;
+}
+
+/* Start using the snapshot in FILENAME.  It is not an error for it
+ * not to exist yet.
+ */
+void
+snapshot_start (const char *filename)
+{
+  FILE *fp;
+
+  snapshot_file = filename;
+  snapshot_table = hash_initialize (DefaultHashTableSize, NULL,
+				    snap_dir_hash, snap_dir_compare,
+				    snap_dir_free);
+  if (NULL == snapshot_table)
+    xalloc_die ();
+
+  fp = fopen_safer (filename, "rb");
+  if (NULL == fp)
+    {
+      if (ENOENT != errno)
+	nonfatal_nontarget_file_error (errno, filename);
+      return;
+    }
+  else
+    {
+      char magic[sizeof snapshot_magic - 1u];
+      uint32_t order;
+      bool bad = false;
+      struct snap_dir *p;
+
+      if (sizeof magic != fread (magic, 1, sizeof magic, fp)
+	  || 0 != memcmp (magic, snapshot_magic, sizeof magic)
+	  || 1 != fread (&order, sizeof order, 1, fp)
+	  || SnapshotByteOrder != order)
+	bad = true;
+      else
+	while (NULL != (p = read_snap_dir (fp, &bad)))
+	  snap_dir_replace (p);
+
+      if (ferror (fp))
+	{
+	  nonfatal_nontarget_file_error (errno, filename);
+	  hash_clear (snapshot_table);
+	}
+      else if (bad)
+	{
+	  error (0, 0, _("ignoring the snapshot file %s, which is not valid"),
+		 safely_quote_err_filename (0, filename));
+	  hash_clear (snapshot_table);
+	}
+      fclose (fp);
+    }
+}
+
+
+/* Decide whether we can hand out the recorded contents of DIR, which
+ * fts is about to read from DIRP.
+ */
+static struct snap_read *
+begin_read (FTSENT *dir, DIR *dirp)
+{
+  struct snap_read *r = xzalloc (sizeof *r);
+  const struct stat *st = dir->fts_statp;
+
+  r->dirp = dirp;
+  r->next_pending = pending;
+  pending = r;
+
+  if (!S_ISDIR (st->st_mode))
+    return r;
+
+  r->rec.dev = st->st_dev;
+  r->rec.ino = st->st_ino;
+  r->rec.mtime = get_stat_mtime (st);
+  r->rec.ctime = get_stat_ctime (st);
+  r->hit = hash_lookup (snapshot_table, &r->rec);
+  if (r->hit
+      && 0 == timespec_cmp (r->hit->mtime, r->rec.mtime)
+      && 0 == timespec_cmp (r->hit->ctime, r->rec.ctime))
+    {
+      r->next_name = r->hit->names;
+    }
+  else
+    {
+      r->hit = NULL;
+      r->recording = (r->rec.ctime.tv_sec < options.start_time.tv_sec);
+    }
+  return r;
+}
+
+static void
+end_read (FTSENT *dir, struct snap_read *r)
+{
+  struct snap_read **pp;
+
+  for (pp = &pending; *pp != r; pp = &(*pp)->next_pending)
+    continue;
+  *pp = r->next_pending;
+  dir->fts_pointer = NULL;
+  free (r->rec.inodes);
+  free (r->rec.types);
+  free (r->rec.names);
+  free (r);
+}
+
+static void
+record_entry (struct snap_read *r, const struct dirent *dp)
+{
+  size_t len = strlen (dp->d_name) + 1u;
+
+  if (r->rec.count == r->inodes_alloc)
+    {
+      r->rec.inodes = x2nrealloc (r->rec.inodes, &r->inodes_alloc,
+				  sizeof *r->rec.inodes);
+      r->rec.types = xrealloc (r->rec.types, r->inodes_alloc);
+    }
+  while (r->names_alloc - r->rec.names_size < len)
+    r->rec.names = x2nrealloc (r->rec.names, &r->names_alloc, 1);
+
+  r->rec.inodes[r->rec.count] = dp->d_ino;
+#if HAVE_STRUCT_DIRENT_D_TYPE
+  r->rec.types[r->rec.count] = dp->d_type;
+#else
+  r->rec.types[r->rec.count] = 0;
+#endif
+  memcpy (r->rec.names + r->rec.names_size, dp->d_name, len);
+  r->rec.names_size += len;
+  r->rec.count++;
+}
+
+/* We have read all of the entries of the directory R describes. */
+static void
+save_recording (struct snap_read *r)
+{
+  struct snap_dir *p = snap_dir_alloc (r->rec.count, r->rec.names_size);
+
+  p->dev = r->rec.dev;
+  p->ino = r->rec.ino;
+  p->mtime = r->rec.mtime;
+  p->ctime = r->rec.ctime;
+  if (p->count)
+    {
+      memcpy (p->inodes, r->rec.inodes, p->count * sizeof *p->inodes);
+      memcpy (p->types, r->rec.types, p->count);
+      memcpy (p->names, r->rec.names, p->names_size);
+    }
+  p->keep = true;
+  snap_dir_replace (p);
+}
+
+/* Our replacement for readdir, which fts calls through fts_readdir. */
+struct dirent *
+snapshot_readdir (FTSENT *dir, DIR *dirp)
+{
+  struct snap_read *r = dir->fts_pointer;
+  struct dirent *dp;
+
+  /* -watch saves the snapshot before it starts watching. */
+  if (NULL == snapshot_table)
+    return readdir (dirp);
+
+  if (NULL == r || r->dirp != dirp)
+    {
+      r = begin_read (dir, dirp);
+      dir->fts_pointer = r;
+    }
+
+  if (r->hit)
+    {
+      const char *name = r->next_name;
+      size_t len;
+
+      if (r->next == r->hit->count)
+	{
+	  r->hit->keep = true;
+	  ++dirs_served;
+	  end_read (dir, r);
+	  return NULL;
+	}
+      len = strlen (name);
+      memcpy (r->ent.d_name, name, len + 1u);
+      r->ent.d_ino = r->hit->inodes[r->next];
+#if HAVE_STRUCT_DIRENT_D_TYPE
+      r->ent.d_type = r->hit->types[r->next];
+#endif
+      r->next_name = name + len + 1u;
+      r->next++;
+      return &r->ent;
+    }
+
+  do
+    {
+      errno = 0;
+      dp = readdir (dirp);
+    }
+  while (dp && '.' == dp->d_name[0]
+	 && ('\0' == dp->d_name[1]
+	     || ('.' == dp->d_name[1] && '\0' == dp->d_name[2])));
+
+  if (dp)
+    {
+      if (r->recording)
+	record_entry (r, dp);
+    }
+  else
+    {
+      int saved_errno = errno;
+      if (0 == saved_errno && r->recording)
+	save_recording (r);
+      ++dirs_read;
+      end_read (dir, r);
+      errno = saved_errno;
+    }
+  return dp;
+}
+
+
+static bool
+write_u64 (FILE *fp, uint64_t val)
+{
+  return 1 == fwrite (&val, sizeof val, 1, fp);
+}
+
+static bool
+write_snap_dir (void *entry, void *data)
+{
+  const struct snap_dir *p = entry;
+  FILE *fp = data;
+
+  if (!p->keep)
+    return true;
+  return write_u64 (fp, p->dev)
+    && write_u64 (fp, p->ino)
+    && write_u64 (fp, p->mtime.tv_sec)
+    && write_u64 (fp, p->mtime.tv_nsec)
+    && write_u64 (fp, p->ctime.tv_sec)
+    && write_u64 (fp, p->ctime.tv_nsec)
+    && write_u64 (fp, p->count)
+    && write_u64 (fp, p->names_size)
+    && p->count == fwrite (p->inodes, sizeof *p->inodes, p->count, fp)
+    && p->count == fwrite (p->types, 1, p->count, fp)
+    && p->names_size == fwrite (p->names, 1, p->names_size, fp);
+}
+
+static bool
+write_snapshot (FILE *fp, void *data)
+{
+  const uint32_t order = SnapshotByteOrder;
+
+  (void) data;
+  return (sizeof snapshot_magic - 1u
+	  == fwrite (snapshot_magic, 1, sizeof snapshot_magic - 1u, fp))
+    && 1 == fwrite (&order, sizeof order, 1, fp)
+    && (hash_get_n_entries (snapshot_table)
+	== hash_do_for_each (snapshot_table, write_snap_dir, fp));
+}
+
+/* Write out the contents of every directory we read or served from
+ * the snapshot during this run, and release everything.  Directories
+ * we did not look at this time are dropped from the snapshot.
+ */
+void
+snapshot_stop (void)
+{
+  if (NULL == snapshot_table)
+    return;
+
+  while (pending)
+    {
+      struct snap_read *r = pending;
+      pending = r->next_pending;
+      free (r->rec.inodes);
+      free (r->rec.types);
+      free (r->rec.names);
+      free (r);
+    }
+
+  (void) replace_file (snapshot_file, "wb", write_snapshot, NULL);
+
+  if (options.debug_options & DebugSearch)
+    fprintf (stderr,
+	     "snapshot: %" PRIuMAX " directories served from the snapshot, %"
+	     PRIuMAX " read\n", dirs_served, dirs_read);
+
+  hash_free (snapshot_table);
+  snapshot_table = NULL;
+  dirs_served = dirs_read = 0u;
+}
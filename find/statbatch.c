@@ -0,0 +1,733 @@
+/* statbatch.c -- stat the entries of a directory in batches.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With -batch_stat, when find enters a directory and the expression
+ * needs stat information, we ask for the stat information of the
+ * directory's entries all at once, rather than one at a time as fts
+ * hands them to us.  The main thread then waits only for the entry
+ * it is about to evaluate, while the requests for the following ones
+ * are already outstanding.  On a cold cache or a network file system
+ * this overlaps what would otherwise be one round trip per file.
+ *
+ * Where the kernel supports it, the requests are submitted as
+ * IORING_OP_STATX operations on an io_uring.  Otherwise a small pool
+ * of threads makes the statx() (or fstatat()) calls.  At most
+ * BatchWindow requests per directory are outstanding at any time, so
+ * memory use does not depend on the size of the directory.
+ *
+ * We only deal with entries which fts has not itself stat()ed
+ * (FTS_NSOK) and which are not known to be directories (fts needs to
+ * stat those itself anyway).  If a batched request fails for any
+ * reason, we just don't use its result; the usual code path then
+ * stats the file again and issues whatever diagnostic is appropriate.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
+
+#if defined __linux__
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined __NR_io_uring_setup && defined STATX_TYPE
+#  include <linux/io_uring.h>
+/* IORING_OP_STATX is an enumerator, so we can't test for it directly.
+ * It appeared in the same kernel release (5.6) as this flag.
+ */
+#  if defined IORING_FEAT_CUR_PERSONALITY
+#   define STATBATCH_URING 1
+#  endif
+# endif
+#endif
+
+#include "xalloc.h"
+#include "error.h"
+#include "fts_.h"
+#include "defs.h"
+
+#if ENABLE_NLS
+# include <libintl.h>
+# define _(Text) gettext (Text)
+#else
+# define _(Text) Text
+#endif
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW 0
+#endif
+
+#if STATBATCH_URING || USE_POSIX_THREADS
+
+enum
+  {
+    /* The number of requests we keep outstanding for each directory. */
+    BatchWindow = 256,
+
+    /* The number of threads we use if io_uring is not available and
+     * the user did not specify -threads.
+     */
+    DefaultBatchThreads = 4
+  };
+
+enum slot_engine
+  {
+    EngineNone,
+    EngineUring,
+    EngineThreads
+  };
+
+struct stat_batch;
+
+struct stat_slot
+{
+  FTSENT *ent;
+  struct stat_batch *batch;
+  enum slot_engine engine;
+  bool done;
+  int err;			/* errno value, or 0 for success */
+  struct stat st;
+#if STATBATCH_URING
+  struct statx stx;		/* filled in by the kernel */
+#endif
+  struct stat_slot *next_queued; /* for the thread pool's queue */
+};
+
+/* The outstanding requests for one directory.  Directories nest, so
+ * these form a stack; the innermost directory is at the top.
+ */
+struct stat_batch
+{
+  struct stat_batch *outer;
+  const FTSENT *dir;
+  int fd;			/* open on DIR */
+  FTSENT *next;			/* next child to request */
+  size_t head;			/* index in slots of the oldest request */
+  size_t count;			/* number of requests in slots */
+  struct stat_slot slots[BatchWindow];
+};
+
+static struct stat_batch *innermost = NULL;
+static bool tried_uring = false;
+static bool uring_usable = false;
+static bool tried_pool = false;
+
+/* Statistics, for -D stat. */
+static uintmax_t requests_made, requests_used, requests_failed;
+
+
+#if STATBATCH_URING
+
+static int ring_fd = -1;
+static void *sq_ring, *cq_ring;
+static size_t sq_ring_size, cq_ring_size, sqes_size;
+static unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned int *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned int sq_entries;
+static unsigned int unsubmitted; /* queued in the SQ but not yet submitted */
+static unsigned int ring_busy;	 /* queued or submitted but not yet reaped */
+
+static int
+sys_io_uring_enter (unsigned int to_submit, unsigned int min_complete,
+		    unsigned int flags)
+{
+  return syscall (__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+		  flags, NULL, 0);
+}
+
+static void
+uring_teardown (void)
+{
+  if (sqes)
+    munmap (sqes, sqes_size);
+  if (cq_ring)
+    munmap (cq_ring, cq_ring_size);
+  if (sq_ring)
+    munmap (sq_ring, sq_ring_size);
+  sqes = NULL;
+  cq_ring = sq_ring = NULL;
+  if (ring_fd >= 0)
+    close (ring_fd);
+  ring_fd = -1;
+}
+
+static bool
+uring_setup (void)
+{
+  struct io_uring_params params;
+  char *sq, *cq;
+
+  memset (&params, 0, sizeof params);
+  ring_fd = syscall (__NR_io_uring_setup, BatchWindow, &params);
+  if (ring_fd < 0)
+    return false;
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+  cq_ring_size = params.cq_off.cqes
+    + params.cq_entries * sizeof (struct io_uring_cqe);
+  sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  sq_ring = mmap (NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  cq_ring = mmap (NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+  sqes = mmap (NULL, sqes_size, PROT_READ | PROT_WRITE,
+	       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (MAP_FAILED == sq_ring || MAP_FAILED == cq_ring || MAP_FAILED == sqes)
+    {
+      if (MAP_FAILED == sq_ring)
+	sq_ring = NULL;
+      if (MAP_FAILED == cq_ring)
+	cq_ring = NULL;
+      if (MAP_FAILED == sqes)
+	sqes = NULL;
+      uring_teardown ();
+      return false;
+    }
+
+  sq = sq_ring;
+  cq = cq_ring;
+  sq_head = (unsigned int *) (sq + params.sq_off.head);
+  sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+  sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+  sq_array = (unsigned int *) (sq + params.sq_off.array);
+  cq_head = (unsigned int *) (cq + params.cq_off.head);
+  cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+  cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+  sq_entries = params.sq_entries;
+  unsubmitted = ring_busy = 0u;
+  return true;
+}
+
+static void
+uring_complete (struct stat_slot *slot, int res)
+{
+  assert (!slot->done);
+  if (res < 0)
+    {
+      slot->err = -res;
+      /* A kernel without IORING_OP_STATX rejects the operation
+       * itself.  Don't try the ring again.
+       */
+      if (EINVAL == slot->err)
+	uring_usable = false;
+    }
+  else
+    {
+      statx_to_stat (&slot->stx, &slot->st);
+      slot->err = 0;
+    }
+  slot->done = true;
+  --ring_busy;
+}
+
+/* Process whatever completions are waiting in the ring. */
+static void
+uring_reap (void)
+{
+  unsigned int head = *cq_head;
+  unsigned int tail = __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail)
+    {
+      const struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+      uring_complete ((struct stat_slot *) (uintptr_t) cqe->user_data,
+		      cqe->res);
+      ++head;
+    }
+  __atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submit any queued requests and, if MIN_COMPLETE is nonzero, wait
+ * for at least that many to complete.
+ */
+static void
+uring_enter (unsigned int min_complete)
+{
+  int rv;
+
+  if (0 == unsubmitted && 0 == min_complete)
+    return;
+  rv = sys_io_uring_enter (unsubmitted, min_complete,
+			   min_complete ? IORING_ENTER_GETEVENTS : 0);
+  if (rv >= 0)
+    unsubmitted -= (unsigned int) rv;
+  else if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+    error (EXIT_FAILURE, errno, _("io_uring_enter failed"));
+  uring_reap ();
+}
+
+static void
+uring_queue (struct stat_slot *slot, int flags)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int tail, index;
+
+  /* Never have more requests outstanding than the submission queue
+   * can hold; the completion queue is twice as big, so it can't
+   * overflow either.
+   */
+  while (ring_busy >= sq_entries)
+    uring_enter (1);
+
+  tail = *sq_tail;
+  index = tail & *sq_mask;
+  sqe = &sqes[index];
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = slot->batch->fd;
+  sqe->addr = (uintptr_t) slot->ent->fts_name;
+  sqe->len = options.stat_fields;
+  sqe->off = (uintptr_t) &slot->stx;
+  sqe->statx_flags = flags;
+  sqe->user_data = (uintptr_t) slot;
+  sq_array[index] = index;
+  __atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  slot->engine = EngineUring;
+  ++unsubmitted;
+  ++ring_busy;
+}
+
+static void
+uring_wait (struct stat_slot *slot)
+{
+  while (!slot->done)
+    uring_enter (1);
+}
+
+#endif /* STATBATCH_URING */
+
+
+#if USE_POSIX_THREADS
+
+static pthread_t *pool = NULL;
+static unsigned int pool_size = 0u;
+
+/* queue_lock protects the queue, pool_stopping and the done member
+ * of slots being handled by the pool.
+ */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct stat_slot *queue_head = NULL, *queue_tail = NULL;
+static bool pool_stopping = false;
+
+static void *
+pool_main (void *arg)
+{
+  (void) arg;
+  for (;;)
+    {
+      struct stat_slot *slot;
+      int err = 0;
+
+      pthread_mutex_lock (&queue_lock);
+      while (NULL == queue_head && !pool_stopping)
+	pthread_cond_wait (&queue_cond, &queue_lock);
+      slot = queue_head;
+      if (NULL == slot)
+	{
+	  /* We have been asked to stop and there is nothing left. */
+	  pthread_mutex_unlock (&queue_lock);
+	  break;
+	}
+      queue_head = slot->next_queued;
+      if (NULL == queue_head)
+	queue_tail = NULL;
+      pthread_mutex_unlock (&queue_lock);
+
+      if (0 != find_fstatat (slot->batch->fd, slot->ent->fts_name, &slot->st,
+			     options.symlink_handling == SYMLINK_ALWAYS_DEREF
+			     ? 0 : AT_SYMLINK_NOFOLLOW))
+	err = errno;
+
+      pthread_mutex_lock (&queue_lock);
+      slot->err = err;
+      slot->done = true;
+      pthread_cond_broadcast (&done_cond);
+      pthread_mutex_unlock (&queue_lock);
+    }
+  return NULL;
+}
+
+static bool
+pool_setup (void)
+{
+  unsigned int i, n;
+
+  n = options.threads > 1 ? options.threads - 1 : DefaultBatchThreads;
+  pool = xnmalloc (n, sizeof *pool);
+  pool_stopping = false;
+  for (i = 0; i < n; ++i)
+    {
+      if (0 != pthread_create (&pool[i], NULL, pool_main, NULL))
+	break;			/* Carry on with however many we have. */
+    }
+  pool_size = i;
+  if (0 == pool_size)
+    {
+      free (pool);
+      pool = NULL;
+    }
+  return pool_size > 0;
+}
+
+static void
+pool_teardown (void)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&queue_lock);
+  pool_stopping = true;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+  for (i = 0; i < pool_size; ++i)
+    pthread_join (pool[i], NULL);
+  free (pool);
+  pool = NULL;
+  pool_size = 0u;
+}
+
+static void
+pool_queue (struct stat_slot *slot)
+{
+  slot->engine = EngineThreads;
+  slot->next_queued = NULL;
+  pthread_mutex_lock (&queue_lock);
+  if (queue_tail)
+    queue_tail->next_queued = slot;
+  else
+    queue_head = slot;
+  queue_tail = slot;
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+static void
+pool_wait (struct stat_slot *slot)
+{
+  pthread_mutex_lock (&queue_lock);
+  while (!slot->done)
+    pthread_cond_wait (&done_cond, &queue_lock);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+#endif /* USE_POSIX_THREADS */
+
+
+/* Issue a request for the stat information of SLOT->ent. */
+static void
+request_stat (struct stat_slot *slot)
+{
+  ++requests_made;
+  slot->done = false;
+  slot->err = 0;
+#if STATBATCH_URING
+  if (uring_usable)
+    {
+      int flags = 0;
+      if (options.symlink_handling != SYMLINK_ALWAYS_DEREF)
+	flags |= AT_SYMLINK_NOFOLLOW;
+      if (options.stat_dont_sync)
+	flags |= AT_STATX_DONT_SYNC;
+      uring_queue (slot, flags);
+      return;
+    }
+#endif
+#if USE_POSIX_THREADS
+  if (pool)
+    {
+      pool_queue (slot);
+      return;
+    }
+#endif
+  /* Nothing can do the work for us; the main thread will stat the
+   * file in the usual way.
+   */
+  slot->engine = EngineNone;
+  slot->err = ENOSYS;
+  slot->done = true;
+}
+
+static void
+wait_for (struct stat_slot *slot)
+{
+  switch (slot->engine)
+    {
+    case EngineUring:
+#if STATBATCH_URING
+      uring_wait (slot);
+#endif
+      break;
+    case EngineThreads:
+#if USE_POSIX_THREADS
+      pool_wait (slot);
+#endif
+      break;
+    case EngineNone:
+      break;
+    }
+  assert (slot->done);
+}
+
+/* Start flushing the submission queue, if we have one. */
+static void
+kick (void)
+{
+#if STATBATCH_URING
+  if (ring_fd >= 0)
+    uring_enter (0);
+#endif
+}
+
+/* Returns true if we should ask for the stat information of ENT. */
+static bool
+wanted (const FTSENT *ent)
+{
+  return FTS_NSOK == ent->fts_info && !S_ISDIR (ent->fts_statp->st_mode);
+}
+
+/* Request stat information for as many more of the children of B as
+ * will fit.
+ */
+static void
+fill_window (struct stat_batch *b)
+{
+  while (b->count < BatchWindow && b->next)
+    {
+      FTSENT *child = b->next;
+      b->next = child->fts_link;
+      if (wanted (child))
+	{
+	  struct stat_slot *slot = &b->slots[(b->head + b->count) % BatchWindow];
+	  slot->ent = child;
+	  slot->batch = b;
+	  ++b->count;
+	  request_stat (slot);
+	}
+    }
+  kick ();
+}
+
+/* Discard the oldest request of B, once it has finished. */
+static void
+drop_oldest (struct stat_batch *b)
+{
+  assert (b->count > 0);
+  wait_for (&b->slots[b->head]);
+  b->head = (b->head + 1) % BatchWindow;
+  --b->count;
+}
+
+/* Wait for the outstanding requests of the innermost batch, and
+ * then discard it.
+ */
+static void
+pop_batch (void)
+{
+  struct stat_batch *b = innermost;
+  while (b->count)
+    drop_oldest (b);
+  close (b->fd);
+  innermost = b->outer;
+  free (b);
+}
+
+static bool
+engine_available (void)
+{
+#if STATBATCH_URING
+  if (!tried_uring)
+    {
+      tried_uring = true;
+      uring_usable = uring_setup ();
+    }
+  if (uring_usable)
+    return true;
+#endif
+#if USE_POSIX_THREADS
+  if (!tried_pool)
+    {
+      tried_pool = true;
+      pool_setup ();
+    }
+  return pool != NULL;
+#else
+  return false;
+#endif
+}
+
+
+/* We have just visited the directory DIR, and fts is about to read
+ * its contents.  CHILDREN is the list of entries fts_children()
+ * returned for DIR, and CWD_FD is the file descriptor relative to
+ * which DIR->fts_accpath is interpreted.  Start asking for the stat
+ * information of those entries.
+ */
+void
+statbatch_begin_dir (int cwd_fd, FTSENT *dir, FTSENT *children)
+{
+  struct stat_batch *b;
+  struct stat st;
+  int fd, flags = O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC;
+
+  if (NULL == children || !engine_available ())
+    return;
+
+  /* Finish with any directories we have already left. */
+  while (innermost && innermost->dir->fts_level >= dir->fts_level)
+    pop_batch ();
+
+  if (options.symlink_handling == SYMLINK_NEVER_DEREF
+      || (options.symlink_handling == SYMLINK_DEREF_ARGSONLY
+	  && dir->fts_level > 0))
+    flags |= O_NOFOLLOW;
+  fd = openat (cwd_fd, dir->fts_accpath, flags);
+  if (fd < 0)
+    return;
+  /* Make sure that we opened the directory that fts is going to read. */
+  if (0 != fstat (fd, &st)
+      || st.st_dev != dir->fts_statp->st_dev
+      || st.st_ino != dir->fts_statp->st_ino)
+    {
+      close (fd);
+      return;
+    }
+
+  b = xmalloc (sizeof *b);
+  b->outer = innermost;
+  b->dir = dir;
+  b->fd = fd;
+  b->next = children;
+  b->head = b->count = 0u;
+  innermost = b;
+  fill_window (b);
+}
+
+/* If we have the stat information for ENT, store it in *P and return
+ * true.  Otherwise return false.  This must be called for each entry
+ * in the order in which fts_read() returns them.
+ */
+bool
+statbatch_lookup (const FTSENT *ent, struct stat *p)
+{
+  struct stat_batch *b;
+  size_t i;
+
+  /* Finish with any directories we have left. */
+  while (innermost && ent->fts_level <= innermost->dir->fts_level)
+    pop_batch ();
+  b = innermost;
+  if (NULL == b || ent->fts_parent != b->dir || !wanted (ent))
+    return false;
+
+  for (i = 0; i < b->count; ++i)
+    {
+      if (b->slots[(b->head + i) % BatchWindow].ent == ent)
+	{
+	  struct stat_slot *slot;
+	  bool ok;
+
+	  /* Any older requests are for entries fts didn't give us. */
+	  while (i--)
+	    drop_oldest (b);
+	  slot = &b->slots[b->head];
+	  wait_for (slot);
+	  ok = (0 == slot->err);
+	  if (ok)
+	    {
+	      *p = slot->st;
+	      ++requests_used;
+	    }
+	  else
+	    {
+	      ++requests_failed;
+	    }
+	  drop_oldest (b);
+	  fill_window (b);
+	  return ok;
+	}
+    }
+  return false;
+}
+
+/* Wait for all outstanding requests, and release everything. */
+void
+statbatch_stop (void)
+{
+  while (innermost)
+    pop_batch ();
+#if STATBATCH_URING
+  if (ring_fd >= 0)
+    uring_teardown ();
+  tried_uring = uring_usable = false;
+#endif
+#if USE_POSIX_THREADS
+  if (pool)
+    pool_teardown ();
+  tried_pool = false;
+#endif
+  if ((options.debug_options & DebugStat) && requests_made)
+    fprintf (stderr,
+	     "batched stat: made %" PRIuMAX " requests, used %" PRIuMAX
+	     " results, %" PRIuMAX " failed\n",
+	     requests_made, requests_used, requests_failed);
+  requests_made = requests_used = requests_failed = 0u;
+}
+
+#else  /* !(STATBATCH_URING || USE_POSIX_THREADS) */
+
+void
+statbatch_begin_dir (int cwd_fd, FTSENT *dir, FTSENT *children)
+{
+  (void) cwd_fd;
+  (void) dir;
+  (void) children;
+}
+
+bool
+statbatch_lookup (const FTSENT *ent, struct stat *p)
+{
+  (void) ent;
+  (void) p;
+  return false;
+}
+
+void
+statbatch_stop (void)
+{
+}
+
+#endif
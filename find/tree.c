@@ -25,6 +25,7 @@
 
 #include "xalloc.h"
 #include "error.h"
+#include "quotearg.h"
 
 
 #if ENABLE_NLS
@@ -63,6 +64,9 @@ static struct predicate *scan_rest (struct predicate **input,
 static void merge_pred (struct predicate *beg_list, struct predicate *end_list, struct predicate **last_p);
 static struct predicate *set_new_parent (struct predicate *curr, enum predicate_precedence high_prec, struct predicate **prevp);
 static const char *cost_name (enum EvaluationCost cost);
+static void check_normalization (struct predicate *p, bool at_root);
+static float constrain_rate (float rate);
+static void init_pred_perf (struct predicate *pred);
 
 
 /* Return true if the indicated path name is a start
@@ -302,6 +306,8 @@ predicate_is_cost_free (const struct predicate *p)
 	  pred_is(p, pred_comma) ||
 	  pred_is(p, pred_or))
 	return false;
+      else if (options.optimisation_level > 2 && p->est_cost >= 0.0f)
+	return false;		/* we know what it really costs */
       else
 	return NeedsNothing == p->p_cost;
     }
@@ -351,9 +357,47 @@ predlist_insert (struct predlist *list,
     list->tail = list->head;
 }
 
+/* Which of the tests P1 and P2, with the estimated costs C1 and C2,
+ * is it cheaper to evaluate first?  If WANTFAILURE, the second is only
+ * evaluated if the first succeeds (as for -a), otherwise only if it
+ * fails (as for -o).  Return a negative number if P1 should come first,
+ * a positive one if P2 should, and 0 if it makes no difference.
+ */
+static int
+compare_expected_cost (const struct predicate *p1, float c1,
+		       const struct predicate *p2, float c2,
+		       bool wantfailure)
+{
+  float s1 = p1->est_success_rate, s2 = p2->est_success_rate;
+  float first, second;
+
+  /* c1 + s1 * c2 < c2 + s2 * c1, for example. */
+  if (wantfailure)
+    {
+      first = c1 * (1.0f - s2);
+      second = c2 * (1.0f - s1);
+    }
+  else
+    {
+      first = c1 * s2;
+      second = c2 * s1;
+    }
+  if (first == second)
+    return 0;
+  return first < second ? -1 : 1;
+}
+
 static int
 pred_cost_compare (const struct predicate *p1, const struct predicate *p2, bool wantfailure)
 {
+  if (p1->est_cost >= 0.0f && p2->est_cost >= 0.0f)
+    {
+      int result = compare_expected_cost (p1, p1->est_cost,
+					  p2, p2->est_cost, wantfailure);
+      if (result)
+	return result;
+    }
+
   if (p1->p_cost == p2->p_cost)
     {
       if (p1->est_success_rate == p2->est_success_rate)
@@ -458,7 +502,7 @@ merge_lists (struct predlist lists[], int nlists,
 
 
 
-static bool
+bool
 subtree_has_side_effects (const struct predicate *p)
 {
   if (p)
@@ -494,6 +538,28 @@ worst_cost (const struct predicate *p)
 }
 
 
+/* Return the estimated cost of evaluating every test in P, or a
+ * negative number if we don't know it.
+ */
+static float
+subtree_cost (const struct predicate *p)
+{
+  float left, right;
+
+  if (NULL == p)
+    return 0.0f;
+  if (PRIMARY_TYPE == p->p_type)
+    return p->est_cost;
+  left = subtree_cost (p->pred_left);
+  right = subtree_cost (p->pred_right);
+  if (left < 0.0f || right < 0.0f)
+    return -1.0f;
+  return left + right;
+}
+
+
+/* The number of arm swaps we have made. */
+static unsigned long arm_swaps_done = 0;
 
 static void
 perform_arm_swap (struct predicate *p)
@@ -501,6 +567,7 @@ perform_arm_swap (struct predicate *p)
   struct predicate *tmp = p->pred_left->pred_right;
   p->pred_left->pred_right = p->pred_right;
   p->pred_right = tmp;
+  ++arm_swaps_done;
 }
 
 /* Consider swapping p->pred_left->pred_right with p->pred_right,
@@ -512,11 +579,13 @@ perform_arm_swap (struct predicate *p)
  * fails most often.
  *
  * We don't consider swapping arms of an operator where their cost is
- * different or where they have side effects.
+ * different or where they have side effects.  If we have measured the
+ * costs (-calibrate), we instead compare the expected cost of each
+ * order, taking the success rates into account.
  *
  * A viable test case for this is
  * ./find -D opt   -O3  .   \! -type f -o -type d
- * Here, the ! -type f should be evaluated first,
+ * Here, the -type d should be evaluated first,
  * as we assume that 95% of inodes are vanilla files.
  */
 static bool
@@ -555,6 +624,30 @@ consider_arm_swap (struct predicate *p)
 	reason = "Right subtree has side-effects";
     }
 
+  if (!reason && (pred_is (p, pred_and) || pred_is (p, pred_or)))
+    {
+      float nsec_l = subtree_cost (*pl);
+      float nsec_r = subtree_cost (*pr);
+
+      if (nsec_l >= 0.0f && nsec_r >= 0.0f)
+	{
+	  if (options.debug_options & DebugTreeOpt)
+	    fprintf (stderr, "Costs: l=%gns, r=%gns\n", nsec_l, nsec_r);
+	  if (compare_expected_cost (*pr, nsec_r, *pl, nsec_l,
+				     pred_is (p, pred_and)) < 0)
+	    {
+	      if (options.debug_options & DebugTreeOpt)
+		{
+		  fprintf (stderr, "Performing arm swap on:\n");
+		  print_tree (stderr, p, 0);
+		}
+	      perform_arm_swap (p);
+	      return true;
+	    }
+	  reason = "cheaper as-is";
+	}
+    }
+
   if (!reason)
     {
       left_cost = worst_cost (*pl);
@@ -582,15 +675,15 @@ consider_arm_swap (struct predicate *p)
 
 	  if (pred_is (p, pred_or))
 	    {
-	      want_swap = succ_rate_r < succ_rate_l;
+	      want_swap = succ_rate_r > succ_rate_l;
 	      if (!want_swap)
-		reason = "Operation is OR and right success rate >= left";
+		reason = "Operation is OR and right success rate <= left";
 	    }
 	  else if (pred_is (p, pred_and))
 	    {
-	      want_swap = succ_rate_r > succ_rate_l;
+	      want_swap = succ_rate_r < succ_rate_l;
 	      if (!want_swap)
-		reason = "Operation is AND and right success rate <= left";
+		reason = "Operation is AND and right success rate >= left";
 	    }
 	  else
 	    {
@@ -649,6 +742,316 @@ do_arm_swaps (struct predicate *p)
 }
 
 
+/* Chains of -o with many -name tests (or -iname, -path or -ipath
+ * tests) are common, for example in commands which clean up build
+ * trees.  We replace each group of at least FuseMinTests such tests in
+ * a chain with a single test, which matches against all of the
+ * patterns at once (see nameset.c).  The tests need not be adjacent,
+ * since they have no side effects and so can be evaluated in any
+ * order, but we don't move them past anything which does have side
+ * effects.
+ */
+enum
+  {
+    FuseMinTests = 4
+  };
+
+static const struct
+{
+  PRED_FUNC test;		/* the tests we fuse */
+  PRED_FUNC fused;		/* the test we replace them with */
+  bool casefold;
+} fusable_tests[] =
+  {
+    { pred_name,  pred_name_set, false },
+    { pred_iname, pred_name_set, true },
+    { pred_path,  pred_path_set, false },
+    { pred_ipath, pred_path_set, true }
+  };
+
+/* Replace the N tests in OPS, which all use FUSABLE, by one test. */
+static struct predicate *
+make_fused_test (struct predicate **ops, size_t n, size_t fusable)
+{
+  struct predicate *p = xmalloc (sizeof *p);
+  size_t i, len;
+  char *text;
+
+  *p = *ops[0];
+  p->pred_func = fusable_tests[fusable].fused;
+  p->args.nameset = name_set_create (fusable_tests[fusable].casefold);
+  p->pred_next = NULL;
+  p->est_success_rate = 0.0f;
+  p->est_nsec = -1.0f;
+  p->est_cost = -1.0f;
+  p->memo = -1;
+  init_pred_perf (p);
+
+  /* Show the patterns as "{a,b,c}". */
+  for (len = 3, i = 0; i < n; ++i)
+    len += strlen (ops[i]->args.glob.pattern) + 1;
+  text = xmalloc (len);
+  strcpy (text, "{");
+  for (i = 0; i < n; ++i)
+    {
+      name_set_add (p->args.nameset, ops[i]->args.glob.pattern);
+      p->est_success_rate += ops[i]->est_success_rate;
+      if (i)
+	strcat (text, ",");
+      strcat (text, ops[i]->args.glob.pattern);
+    }
+  strcat (text, "}");
+  p->arg_text = text;
+  p->est_success_rate = constrain_rate (p->est_success_rate);
+
+  if (options.debug_options & DebugTreeOpt)
+    {
+      fprintf (stderr, "Fusing %lu tests into ", (unsigned long) n);
+      print_predicate (stderr, p);
+      fprintf (stderr, "\n");
+    }
+  return p;
+}
+
+/* Fuse the tests in the chain of -o operators whose top is TOP. */
+static bool
+fuse_or_chain (struct predicate *top)
+{
+  struct predicate **nodes, **ops, **group, *p;
+  size_t n_nodes, n_ops, n_group, i, j, k, start, end;
+  bool fused = false;
+
+  for (n_nodes = 0, p = top; p && pred_is (p, pred_or); p = p->pred_left)
+    ++n_nodes;
+  if (n_nodes + 1 < FuseMinTests)
+    return false;
+
+  /* The operands of the chain, in the order they are evaluated. */
+  nodes = xnmalloc (n_nodes, sizeof *nodes);
+  ops = xnmalloc (n_nodes + 1, sizeof *ops);
+  group = xnmalloc (n_nodes + 1, sizeof *group);
+  for (i = 0, p = top; i < n_nodes; ++i, p = p->pred_left)
+    nodes[i] = p;
+  n_ops = 0;
+  if (nodes[n_nodes - 1]->pred_left)
+    ops[n_ops++] = nodes[n_nodes - 1]->pred_left;
+  for (i = n_nodes; i-- > 0; )
+    ops[n_ops++] = nodes[i]->pred_right;
+
+  for (start = 0; start < n_ops; start = end + 1)
+    {
+      for (end = start; end < n_ops; ++end)
+	if (ops[end] && subtree_has_side_effects (ops[end]))
+	  break;
+      for (k = 0; k < sizeof fusable_tests / sizeof fusable_tests[0]; ++k)
+	{
+	  for (n_group = 0, j = start; j < end; ++j)
+	    if (ops[j] && pred_is (ops[j], fusable_tests[k].test))
+	      group[n_group++] = ops[j];
+	  if (n_group < FuseMinTests)
+	    continue;
+	  for (i = 0, j = start; j < end; ++j)
+	    if (ops[j] && pred_is (ops[j], fusable_tests[k].test))
+	      ops[j] = (0 == i++) ? make_fused_test (group, n_group, k) : NULL;
+	  fused = true;
+	}
+    }
+
+  if (fused)
+    {
+      /* Rebuild the chain from the operands which are left. */
+      for (i = j = 0; i < n_ops; ++i)
+	if (ops[i])
+	  ops[j++] = ops[i];
+      n_ops = j;
+      assert (n_ops <= n_nodes);
+      nodes[n_ops - 1]->pred_left = NULL;
+      for (i = 0; i < n_ops; ++i)
+	nodes[n_ops - 1 - i]->pred_right = ops[i];
+    }
+  free (group);
+  free (ops);
+  free (nodes);
+  return fused;
+}
+
+/* Fuse the tests in every chain of -o operators in the tree P.  A
+ * chain has its top at P if AT_TOP is true.  Return true if anything
+ * was fused.
+ */
+static bool
+fuse_name_tests (struct predicate *p, bool at_top)
+{
+  bool fused = false;
+
+  if (NULL == p)
+    return false;
+  if (at_top && pred_is (p, pred_or))
+    fused = fuse_or_chain (p);
+  if (fuse_name_tests (p->pred_left,
+		       !(pred_is (p, pred_or)
+			 && p->pred_left && pred_is (p->pred_left, pred_or))))
+    fused = true;
+  if (fuse_name_tests (p->pred_right, true))
+    fused = true;
+  return fused;
+}
+
+
+/* At -O4, we reconsider the arm swaps from time to time during the
+ * search, using the success rates we have actually seen rather than
+ * the estimates.  We first do this after AdaptFirstInterval files, and
+ * then at intervals which double each time up to AdaptMaxInterval, so
+ * that early decisions made on little evidence are soon revisited, but
+ * the cost becomes negligible on long searches.
+ */
+enum
+  {
+    AdaptFirstInterval = 256,
+    AdaptMaxInterval = 65536,
+    AdaptMinVisits = 32		/* too few to tell us anything */
+  };
+
+static void
+use_observed_rates (struct predicate *p)
+{
+  if (p)
+    {
+      use_observed_rates (p->pred_left);
+      use_observed_rates (p->pred_right);
+      if (p->perf.visits >= AdaptMinVisits)
+	p->est_success_rate =
+	  constrain_rate ((float)p->perf.successes / p->perf.visits);
+    }
+}
+
+/* Called for each file before the expression is applied to it. */
+void
+adapt_expression (void)
+{
+  static unsigned long interval = AdaptFirstInterval;
+  static unsigned long countdown = AdaptFirstInterval;
+  static unsigned long files_seen = 0;
+  unsigned long swaps_before;
+
+  ++files_seen;
+  if (--countdown)
+    return;
+  if (interval < AdaptMaxInterval)
+    interval *= 2;
+  countdown = interval;
+
+  if (options.debug_options & DebugTreeOpt)
+    fprintf (stderr, "-O%d: reconsidering the order of tests after %lu files\n",
+	     (int)options.optimisation_level, files_seen);
+
+  /* The counts are kept in the compiled program, if there is one. */
+  update_tree_perf (eval_tree);
+  use_observed_rates (eval_tree);
+
+  swaps_before = arm_swaps_done;
+  do_arm_swaps (eval_tree);
+  if (arm_swaps_done != swaps_before)
+    {
+      check_normalization (eval_tree, true);
+      if (expression_is_compiled ())
+	compile_expression (eval_tree);
+    }
+}
+
+
+/* In "find / -path '/srv/logs*' -print", no file outside /srv can match,
+ * so there is no point in searching anywhere else.  Before find reads
+ * a directory, it asks subtree_may_match whether the expression could
+ * do anything at all for the files in it, judging only by their paths.
+ * If we can prove that the expression would be false for every one of
+ * them, without doing anything with side effects first, we skip the
+ * directory as -prune would.  The proof only uses -path, -ipath and
+ * the prefixes found in regexes, and we only skip a directory when we
+ * are sure.
+ */
+static bool may_prune_subtrees = false;
+
+/* Could the primary P be true for any file below DIR? */
+static bool
+primary_may_match_below (const struct predicate *p, const char *dir)
+{
+  int i;
+
+  if (pred_is (p, pred_path) || pred_is (p, pred_ipath))
+    return glob_may_match_below (&p->args.glob, dir);
+  if (pred_is (p, pred_path_set))
+    return name_set_may_match_below (p->args.nameset, dir);
+  if (pred_is (p, pred_regex))
+    {
+      for (i = 0; i < p->args.regex.n_filters; ++i)
+	if (!glob_may_match_below (&p->args.regex.filters[i], dir))
+	  return false;
+    }
+  return true;
+}
+
+/* Is P false for every file below DIR, and do we get there without
+ * evaluating anything with side effects?
+ */
+static bool
+quietly_false_below (const struct predicate *p, const char *dir)
+{
+  if (NULL == p)
+    return false;
+  switch (p->p_type)
+    {
+    case PRIMARY_TYPE:
+      return !p->side_effects && !primary_may_match_below (p, dir);
+
+    case BI_OP:
+      /* Normalisation can leave operators with no left operand. */
+      if (NULL == p->pred_left)
+	return quietly_false_below (p->pred_right, dir);
+      if (pred_is (p, pred_and))
+	return quietly_false_below (p->pred_left, dir)
+	  || (!subtree_has_side_effects (p->pred_left)
+	      && quietly_false_below (p->pred_right, dir));
+      else if (pred_is (p, pred_or))
+	return quietly_false_below (p->pred_left, dir)
+	  && quietly_false_below (p->pred_right, dir);
+      else if (pred_is (p, pred_comma))
+	return !subtree_has_side_effects (p->pred_left)
+	  && quietly_false_below (p->pred_right, dir);
+      return false;
+
+    default:
+      return false;
+    }
+}
+
+static bool
+has_path_tests (const struct predicate *p)
+{
+  if (NULL == p)
+    return false;
+  if (PRIMARY_TYPE == p->p_type)
+    return pred_is (p, pred_path) || pred_is (p, pred_ipath)
+      || pred_is (p, pred_path_set)
+      || (pred_is (p, pred_regex) && p->args.regex.n_filters > 0);
+  return has_path_tests (p->pred_left) || has_path_tests (p->pred_right);
+}
+
+/* Might the expression do anything for files below the directory DIR?
+ * If not, the caller need not read it.
+ */
+bool
+subtree_may_match (const char *dir)
+{
+  if (!may_prune_subtrees || !quietly_false_below (eval_tree, dir))
+    return true;
+  if (options.debug_options & DebugSearch)
+    fprintf (stderr, "No file below %s can match, so skipping it\n",
+	     quotearg_n_style (0, options.err_quoting_style, dir));
+  return false;
+}
+
+
 
 /* Optimize the ordering of the predicates in the tree.  Rearrange
    them to minimize work.  Strategies:
@@ -762,7 +1165,7 @@ opt_expr (struct predicate **eval_treep)
 	  /* If this predicate has no side effects, consider reordering it. */
 	  if (!curr->pred_right->side_effects)
 	    {
-	      bool reorder;
+	      bool reorder, calibrated;
 
 	      /* If it's one of our special primaries, move it to the
 		 front of the list for that primary. */
@@ -779,7 +1182,14 @@ opt_expr (struct predicate **eval_treep)
 		  continue;
 		}
 
-	      if (pred_func == pred_regex)
+	      /* If we have measured the costs, we can weigh a -regex
+	       * against, say, a stat call, so at -O3 all the tests go
+	       * into one list to be sorted by cost.
+	       */
+	      calibrated = (options.optimisation_level > 2
+			    && curr->pred_right->est_cost >= 0.0f);
+
+	      if (pred_func == pred_regex && !calibrated)
 		{
 		  predlist_insert (&regex_list, curr, prevp);
 		  continue;
@@ -793,15 +1203,23 @@ opt_expr (struct predicate **eval_treep)
 
 	      if (reorder)
 		{
+		  enum EvaluationCost cost = curr->pred_right->p_cost;
+
+		  if (calibrated)
+		    cost = NeedsNothing;
 		  if (options.debug_options & DebugTreeOpt)
 		    {
 		      fprintf (stderr, "-O%d: categorising predicate ",
 			       (int)options.optimisation_level);
 		      print_predicate (stderr, curr->pred_right);
-		      fprintf (stderr, " by cost (%s)\n",
-			       cost_name(curr->pred_right->p_cost));
+		      if (calibrated)
+			fprintf (stderr, " by cost (%gns)\n",
+				 curr->pred_right->est_cost);
+		      else
+			fprintf (stderr, " by cost (%s)\n",
+				 cost_name(curr->pred_right->p_cost));
 		    }
-		  predlist_insert (&cbo_list[curr->pred_right->p_cost], curr, prevp);
+		  predlist_insert (&cbo_list[cost], curr, prevp);
 		  continue;
 		}
 	    }
@@ -872,7 +1290,11 @@ set_new_parent (struct predicate *curr, enum predicate_precedence high_prec, str
   new_parent->need_type = false;
   new_parent->need_inum = false;
   new_parent->p_cost = NeedsNothing;
+  new_parent->est_nsec = -1.0f;
+  new_parent->est_cost = -1.0f;
+  new_parent->memo = -1;
   new_parent->arg_text = NULL;
+  init_pred_perf (new_parent);
 
   switch (high_prec)
     {
@@ -945,9 +1367,12 @@ static struct pred_cost_lookup costlookup[] =
     { pred_cmin      ,  NeedsStatInfo,       },
     { pred_cnewer    ,  NeedsStatInfo,       },
     { pred_comma     ,  NeedsNothing,        },
+    { pred_contains  ,  NeedsFileContents    },
     { pred_context   ,  NeedsAccessInfo      },
     { pred_ctime     ,  NeedsStatInfo,       },
     { pred_delete    ,  NeedsSyncDiskHit     },
+    { pred_du        ,  NeedsStatInfo        },
+    { pred_duplicates,  NeedsStatInfo        },
     { pred_empty     ,  NeedsStatInfo        },
     { pred_exec      ,  NeedsEventualExec    },
     { pred_execdir   ,  NeedsEventualExec    },
@@ -959,10 +1384,13 @@ static struct pred_cost_lookup costlookup[] =
     { pred_fstype    ,  NeedsStatInfo        }, /* true for amortised cost */
     { pred_gid       ,  NeedsStatInfo        },
     { pred_group     ,  NeedsStatInfo        },
+    { pred_histogram ,  NeedsStatInfo        },
     { pred_ilname    ,  NeedsLinkName        },
     { pred_iname     ,  NeedsNothing         },
     { pred_inum      ,  NeedsInodeNumber     },
     { pred_ipath     ,  NeedsNothing         },
+    { pred_name_set  ,  NeedsNothing         },
+    { pred_path_set  ,  NeedsNothing         },
     { pred_links     ,  NeedsStatInfo        },
     { pred_lname     ,  NeedsLinkName        },
     { pred_ls        ,  NeedsStatInfo        },
@@ -988,7 +1416,9 @@ static struct pred_cost_lookup costlookup[] =
     { pred_readable  ,  NeedsAccessInfo      },
     { pred_regex     ,  NeedsNothing         },
     { pred_samefile  ,  NeedsStatInfo        },
+    { pred_sha256sum ,  NeedsSyncDiskHit     },
     { pred_size      ,  NeedsStatInfo        },
+    { pred_top       ,  NeedsStatInfo        },
     { pred_true	     ,  NeedsNothing         },
     { pred_type      ,  NeedsType            },
     { pred_uid       ,  NeedsStatInfo        },
@@ -1036,6 +1466,23 @@ cost_table_comparison (const void *p1, const void *p2)
   return memcmp (u1.mem, u2.mem, sizeof(u1.pfn));
 }
 
+/* The cost of a predicate which earlier runs found to take at least
+ * this many nanoseconds (-profile).  This is the time taken by the
+ * predicate itself; any stat call it needs is accounted for
+ * separately.
+ */
+static const struct
+{
+  float nsec;
+  enum EvaluationCost cost;
+} measured_costs[] =
+  {
+    { 50000.0f, NeedsSyncDiskHit },
+    { 5000.0f,  NeedsAccessInfo },
+    { 1000.0f,  NeedsStatInfo },
+    { 0.0f,     NeedsNothing }
+  };
+
 static enum EvaluationCost
 get_pred_cost (const struct predicate *p)
 {
@@ -1116,6 +1563,16 @@ get_pred_cost (const struct predicate *p)
 		 p->p_name);
 	  inherent_cost = NeedsUnknown;
 	}
+
+      /* If we know how long the predicate actually takes, go by that. */
+      if (p->est_nsec >= 0.0f && !p->side_effects
+	  && inherent_cost < NeedsEventualExec)
+	{
+	  size_t i;
+	  for (i = 0; p->est_nsec < measured_costs[i].nsec; ++i)
+	    continue;
+	  inherent_cost = measured_costs[i].cost;
+	}
     }
 
   if (inherent_cost > data_requirement_cost)
@@ -1124,6 +1581,73 @@ get_pred_cost (const struct predicate *p)
     return data_requirement_cost;
 }
 
+/* The time in nanoseconds we assume a test takes, apart from any
+ * system calls it needs, when we know no better.
+ */
+enum
+  {
+    DefaultTestNsec = 100,
+    DefaultUnknownNsec = 10000,
+    DefaultContentsNsec = 100000,
+    DefaultExecNsec = 1000000,
+    DefaultInteractionNsec = 1000000000
+  };
+
+/* Estimate the time P takes in nanoseconds from the costs of the
+ * system calls it needs, if we have measured those (-calibrate).
+ * Otherwise, return a negative number.
+ */
+static float
+estimate_nsec (const struct predicate *p)
+{
+  const struct calibrated_costs *c = get_calibrated_costs ();
+  float nsec;
+
+  if (NULL == c || PRIMARY_TYPE != p->p_type)
+    return -1.0f;
+
+  if (p->est_nsec >= 0.0f)
+    {
+      nsec = p->est_nsec;
+    }
+  else
+    {
+      switch (p->p_cost)
+	{
+	case NeedsLinkName:
+	  nsec = c->readlink_nsec;
+	  break;
+	case NeedsAccessInfo:
+	  nsec = c->access_nsec;
+	  break;
+	case NeedsSyncDiskHit:
+	case NeedsUnknown:
+	  nsec = DefaultUnknownNsec;
+	  break;
+	case NeedsFileContents:
+	  nsec = DefaultContentsNsec;
+	  break;
+	case NeedsEventualExec:
+	case NeedsImmediateExec:
+	  nsec = DefaultExecNsec;
+	  break;
+	case NeedsUserInteraction:
+	  nsec = DefaultInteractionNsec;
+	  break;
+	default:
+	  nsec = DefaultTestNsec;
+	  break;
+	}
+    }
+
+  /* The time the predicate itself takes does not include the stat
+   * call; see profile.c.
+   */
+  if (p->need_stat)
+    nsec += c->stat_nsec;
+  return nsec;
+}
+
 static void
 estimate_costs (struct predicate *tree)
 {
@@ -1133,6 +1657,7 @@ estimate_costs (struct predicate *tree)
       estimate_costs (tree->pred_left);
 
       tree->p_cost = get_pred_cost(tree);
+      tree->est_cost = estimate_nsec (tree);
     }
 }
 
@@ -1390,6 +1915,12 @@ build_expression_tree (int argc, char *argv[], int end_of_leading_options)
   pred_sanity_check (predicates);
 
   /* Done parsing the predicates.  Build the evaluation tree. */
+  /* Use what earlier runs measured, in place of the estimates. */
+  if (options.profile_file)
+    profile_start (options.profile_file, predicates);
+  if (options.calibrate)
+    calibrate_costs (start_points, num_start_points, predicates);
+
   cur_pred = predicates;
   eval_tree = get_expr (&cur_pred, NO_PREC, NULL);
   calculate_derived_rates (eval_tree);
@@ -1421,6 +1952,10 @@ build_expression_tree (int argc, char *argv[], int end_of_leading_options)
       print_tree (stderr, eval_tree, 0);
     }
 
+  /* Remove anything redundant before we start rearranging things. */
+  simplify_expression (&eval_tree);
+  calculate_derived_rates (eval_tree);
+
   estimate_costs (eval_tree);
 
   /* Rearrange the eval tree in optimal-predicate order. */
@@ -1434,6 +1969,24 @@ build_expression_tree (int argc, char *argv[], int end_of_leading_options)
   /* Check that the tree is still in normalised order */
   check_normalization (eval_tree, true);
 
+  if (fuse_name_tests (eval_tree, true))
+    {
+      check_normalization (eval_tree, true);
+      calculate_derived_rates (eval_tree);
+    }
+
+  /* We always need the file type and the mode (see get_statinfo),
+   * and traversing directories needs the inode number and link count.
+   */
+  options.stat_fields = (StatFieldType | StatFieldMode
+			 | StatFieldIno | StatFieldNlink
+			 | stat_fields_needed (eval_tree));
+  /* -watch decides which files to look at again by their ctime. */
+  if (options.watch)
+    options.stat_fields |= StatFieldCtime;
+  if (options.debug_options & DebugStat)
+    fprintf (stderr, "stat field mask: %#x\n", options.stat_fields);
+
   if (options.debug_options & (DebugExpressionTree|DebugTreeOpt))
     {
       fprintf (stderr, "Optimized Eval Tree:\n");
@@ -1443,9 +1996,46 @@ build_expression_tree (int argc, char *argv[], int end_of_leading_options)
       fprintf (stderr, "\n");
     }
 
+  may_prune_subtrees = has_path_tests (eval_tree);
+  compile_expression (eval_tree);
   return eval_tree;
 }
 
+/* Returns true if evaluating the expression PRED may need to stat
+ * files (as opposed to just knowing their type).
+ */
+bool
+expression_needs_stat (const struct predicate *pred)
+{
+  if (NULL == pred)
+    return false;
+  if (pred->need_stat || pred->need_inum)
+    return true;
+  return expression_needs_stat (pred->pred_left)
+    || expression_needs_stat (pred->pred_right);
+}
+
+/* Return the parts of struct stat (as a mask of enum StatFields
+ * values) which are needed to evaluate the expression P.
+ */
+unsigned int
+stat_fields_needed (const struct predicate *p)
+{
+  unsigned int fields = 0u;
+  if (p)
+    {
+      if (p->need_stat)
+	fields |= p->stat_fields;
+      if (p->need_type)
+	fields |= StatFieldType;
+      if (p->need_inum)
+	fields |= StatFieldIno;
+      fields |= stat_fields_needed (p->pred_left);
+      fields |= stat_fields_needed (p->pred_right);
+    }
+  return fields;
+}
+
 /* Initialise the performance data for a predicate.
  */
 static void
@@ -1453,6 +2043,7 @@ init_pred_perf (struct predicate *pred)
 {
   struct predicate_performance_info *p = &pred->perf;
   p->visits = p->successes = 0;
+  p->nsec = 0u;
 }
 
 
@@ -1508,6 +2099,7 @@ get_new_pred (const struct parser_table *entry)
   last_pred->need_stat = true;
   last_pred->need_type = true;
   last_pred->need_inum = false;
+  last_pred->stat_fields = StatFieldAll;
   last_pred->p_cost = NeedsUnknown;
   last_pred->arg_text = "ThisShouldBeSetToSomethingElse";
   last_pred->args.str = NULL;
@@ -1518,6 +2110,9 @@ get_new_pred (const struct parser_table *entry)
   last_pred->literal_control_chars = options.literal_control_chars;
   last_pred->artificial = false;
   last_pred->est_success_rate = 1.0;
+  last_pred->est_nsec = -1.0f;
+  last_pred->est_cost = -1.0f;
+  last_pred->memo = -1;
   init_pred_perf (last_pred);
   return last_pred;
 }
@@ -1588,6 +2183,7 @@ struct cost_assoc cost_table[] =
     { NeedsLinkName,        "LinkName" },
     { NeedsAccessInfo,      "AccessInfo" },
     { NeedsSyncDiskHit,     "SyncDiskHit" },
+    { NeedsFileContents,    "FileContents" },
     { NeedsEventualExec,    "EventualExec" },
     { NeedsImmediateExec,   "ImmediateExec" },
     { NeedsUserInteraction, "UserInteraction" },
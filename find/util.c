@@ -25,10 +25,18 @@
 #endif
 #include <sys/time.h>
 #include <sys/stat.h> /* for fstatat() */
+#ifdef MAJOR_IN_MKDEV
+#include <sys/mkdev.h>
+#else
+#ifdef MAJOR_IN_SYSMACROS
+#include <sys/sysmacros.h>
+#endif
+#endif
 #include <ctype.h>
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <assert.h>
 
 #include "progname.h"
@@ -40,6 +48,8 @@
 #include "dircallback.h"
 #include "xalloc.h"
 #include "save-cwd.h"
+#include "idname.h"
+#include "stdio-safer.h"
 
 
 #if ENABLE_NLS
@@ -70,11 +80,70 @@ static struct debug_option_assoc debugassoc[] =
     { "stat", DebugStat, "Trace calls to stat(2) and lstat(2)" },
     { "rates", DebugSuccessRates, "Indicate how often each predicate succeeded" },
     { "opt",  DebugExpressionTree|DebugTreeOpt, "Show diagnostic information relating to optimisation" },
-    { "exec", DebugExec,  "Show diagnostic information relating to -exec, -execdir, -ok and -okdir" }
+    { "exec", DebugExec,  "Show diagnostic information relating to -exec, -execdir, -ok and -okdir" },
+    { "prog", DebugProgram, "Show the compiled form of the expression" },
+    { "interp", DebugInterpret, "Evaluate the expression tree directly rather than compiling it" }
   };
 #define N_DEBUGASSOC (sizeof(debugassoc)/sizeof(debugassoc[0]))
 
 
+/* Which parts of struct stat each predicate examines.  Predicates
+ * which are not listed here are assumed to need all of it.  This
+ * table need not be sorted, since it is only searched when a
+ * predicate is created.
+ */
+static struct pred_stat_fields
+{
+  PRED_FUNC    fn;
+  unsigned int fields;
+} stat_field_lookup[] =
+  {
+    { pred_amin     ,  StatFieldAtime },
+    { pred_anewer   ,  StatFieldAtime },
+    { pred_atime    ,  StatFieldAtime },
+    { pred_cmin     ,  StatFieldCtime },
+    { pred_cnewer   ,  StatFieldCtime },
+    { pred_contains ,  StatFieldType | StatFieldSize },
+    { pred_ctime    ,  StatFieldCtime },
+    { pred_du       ,  StatFieldType | StatFieldNlink | StatFieldIno
+                       | StatFieldSize | StatFieldBlocks },
+    { pred_duplicates, StatFieldType | StatFieldIno | StatFieldSize },
+    { pred_empty    ,  StatFieldType | StatFieldSize },
+    { pred_gid      ,  StatFieldGid },
+    { pred_group    ,  StatFieldGid },
+    { pred_inum     ,  StatFieldIno },
+    { pred_links    ,  StatFieldNlink },
+    { pred_mmin     ,  StatFieldMtime },
+    { pred_mtime    ,  StatFieldMtime },
+    { pred_newer    ,  StatFieldMtime },
+    { pred_nogroup  ,  StatFieldGid },
+    { pred_nouser   ,  StatFieldUid },
+    { pred_perm     ,  StatFieldType | StatFieldMode },
+    { pred_prune    ,  StatFieldType },
+    { pred_samefile ,  StatFieldIno },
+    { pred_sha256sum,  StatFieldType },
+    { pred_size     ,  StatFieldSize },
+    { pred_type     ,  StatFieldType },
+    { pred_uid      ,  StatFieldUid },
+    { pred_used     ,  StatFieldAtime | StatFieldCtime },
+    { pred_user     ,  StatFieldUid },
+    { pred_xtype    ,  StatFieldType },
+  };
+#define N_STAT_FIELD_LOOKUP (sizeof(stat_field_lookup)/sizeof(stat_field_lookup[0]))
+
+static unsigned int
+get_stat_fields (PRED_FUNC pred_func)
+{
+  size_t i;
+  for (i=0; i<N_STAT_FIELD_LOOKUP; ++i)
+    {
+      if (stat_field_lookup[i].fn == pred_func)
+	return stat_field_lookup[i].fields;
+    }
+  return StatFieldAll;
+}
+
+
 
 
 /* Add a primary of predicate type PRED_FUNC (described by ENTRY) to the predicate input list.
@@ -106,6 +175,7 @@ insert_primary_withpred (const struct parser_table *entry,
   new_pred->args.str = NULL;
   new_pred->p_type = PRIMARY_TYPE;
   new_pred->p_prec = NO_PREC;
+  new_pred->stat_fields = get_stat_fields (pred_func);
   return new_pred;
 }
 
@@ -513,6 +583,22 @@ fd_leak_check_is_enabled (void)
 
 }
 
+/* Say how often the names of owners and groups came from the cache,
+ * for -D stat.
+ */
+static void
+report_idname_stats (void)
+{
+  struct idname_stats users, groups;
+
+  idname_get_stats (&users, &groups);
+  if (users.hits || users.misses || groups.hits || groups.misses)
+    fprintf (stderr,
+	     "user name cache: %" PRIuMAX " hits, %" PRIuMAX " misses; "
+	     "group name cache: %" PRIuMAX " hits, %" PRIuMAX " misses\n",
+	     users.hits, users.misses, groups.hits, groups.misses);
+}
+
 /* Complete any outstanding commands.
  * Flush and close any open files.
  */
@@ -520,12 +606,26 @@ void
 cleanup (void)
 {
   struct predicate *eval_tree = get_eval_tree ();
+
+  /* -quit can bring us here while read-ahead threads are running. */
+  digest_stop ();
+  du_stop ();
+  prefetch_stop ();
+  statbatch_stop ();
+  snapshot_stop ();
+  profile_stop ();
+  if (options.debug_options & DebugStat)
+    report_idname_stats ();
+
   if (eval_tree)
     {
       traverse_tree (eval_tree, complete_pending_execs);
       complete_pending_execdirs ();
     }
 
+  /* -top, -histogram and -duplicates print their results last. */
+  report_finish ();
+
   /* Close ouptut files and NULL out references to them. */
   sharefile_destroy (state.shared_files);
   if (eval_tree)
@@ -544,6 +644,89 @@ cleanup (void)
 }
 
 
+#if defined STATX_TYPE
+/* Copy the result of statx() into a struct stat.  Fields we did not
+ * ask for may not be filled in, but we don't look at those anyway.
+ * The birth time is only kept if struct stat has room for it, which
+ * is not the case with the GNU C library.
+ */
+void
+statx_to_stat (const struct statx *stx, struct stat *p)
+{
+  p->st_dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+  p->st_ino = stx->stx_ino;
+  p->st_mode = stx->stx_mode;
+  p->st_nlink = stx->stx_nlink;
+  p->st_uid = stx->stx_uid;
+  p->st_gid = stx->stx_gid;
+  p->st_rdev = makedev (stx->stx_rdev_major, stx->stx_rdev_minor);
+  p->st_size = stx->stx_size;
+  p->st_blksize = stx->stx_blksize;
+  p->st_blocks = stx->stx_blocks;
+  p->st_atim.tv_sec = stx->stx_atime.tv_sec;
+  p->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+  p->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+  p->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+  p->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+  p->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+#if HAVE_STRUCT_STAT_ST_BIRTHTIMESPEC_TV_NSEC
+  if (stx->stx_mask & STATX_BTIME)
+    {
+      p->st_birthtimespec.tv_sec = stx->stx_btime.tv_sec;
+      p->st_birthtimespec.tv_nsec = stx->stx_btime.tv_nsec;
+    }
+  else
+    {
+      p->st_birthtimespec.tv_sec = 0;
+      p->st_birthtimespec.tv_nsec = -1;
+    }
+#elif HAVE_STRUCT_STAT_ST_BIRTHTIM_TV_NSEC
+  if (stx->stx_mask & STATX_BTIME)
+    {
+      p->st_birthtim.tv_sec = stx->stx_btime.tv_sec;
+      p->st_birthtim.tv_nsec = stx->stx_btime.tv_nsec;
+    }
+  else
+    {
+      p->st_birthtim.tv_sec = 0;
+      p->st_birthtim.tv_nsec = -1;
+    }
+#endif
+}
+#endif
+
+/* Like fstatat(), but where the system allows it, fetch only the
+ * parts of the stat information listed in options.stat_fields.
+ */
+int
+find_fstatat (int fd, const char *name, struct stat *p, int flags)
+{
+#if defined STATX_TYPE
+  static bool statx_unavailable = false;
+
+  if (!statx_unavailable)
+    {
+      struct statx stx;
+      int statx_flags = flags;
+
+      if (options.stat_dont_sync)
+	statx_flags |= AT_STATX_DONT_SYNC;
+      if (0 == statx (fd, name, statx_flags, options.stat_fields, &stx))
+	{
+	  statx_to_stat (&stx, p);
+	  return 0;
+	}
+      else if (ENOSYS != errno)
+	{
+	  return -1;
+	}
+      /* The C library has statx, but the kernel doesn't. */
+      statx_unavailable = true;
+    }
+#endif
+  return fstatat (fd, name, p, flags);
+}
+
 static int
 fallback_stat (const char *name, struct stat *p, int prev_rv)
 {
@@ -557,7 +740,7 @@ fallback_stat (const char *name, struct stat *p, int prev_rv)
     case ENOTDIR:
       if (options.debug_options & DebugStat)
 	fprintf(stderr, "fallback_stat(): stat(%s) failed; falling back on lstat()\n", name);
-      return fstatat(state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
+      return find_fstatat (state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
 
     case EACCES:
     case EIO:
@@ -594,7 +777,7 @@ optionh_stat (const char *name, struct stat *p)
        * is a link).
        */
       int rv;
-      rv = fstatat (state.cwd_dir_fd, name, p, 0);
+      rv = find_fstatat (state.cwd_dir_fd, name, p, 0);
       if (0 == rv)
 	return 0;		/* success */
       else
@@ -604,7 +787,7 @@ optionh_stat (const char *name, struct stat *p)
     {
       /* Not a file on the command line; do not dereference the link.
        */
-      return fstatat (state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
+      return find_fstatat (state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
     }
 }
 
@@ -620,7 +803,7 @@ optionl_stat(const char *name, struct stat *p)
     assert (state.cwd_dir_fd >= 0);
 
   set_stat_placeholders (p);
-  rv = fstatat (state.cwd_dir_fd, name, p, 0);
+  rv = find_fstatat (state.cwd_dir_fd, name, p, 0);
   if (0 == rv)
     return 0;			/* normal case. */
   else
@@ -636,7 +819,7 @@ optionp_stat (const char *name, struct stat *p)
 {
   assert ((state.cwd_dir_fd >= 0) || (state.cwd_dir_fd==AT_FDCWD));
   set_stat_placeholders (p);
-  return fstatat (state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
+  return find_fstatat (state.cwd_dir_fd, name, p, AT_SYMLINK_NOFOLLOW);
 }
 
 
@@ -678,6 +861,86 @@ following_links(void)
     }
 }
 
+/* Open the current file, PATHNAME, to read its contents.  Return the
+ * file descriptor, or -1 if it cannot be opened (in which case we have
+ * already said why) or is not a regular file.
+ */
+int
+open_regular_file (const char *pathname)
+{
+  struct stat st;
+  int fd, flags = O_RDONLY | O_NOCTTY | O_NONBLOCK;
+
+#ifdef O_CLOEXEC
+  flags |= O_CLOEXEC;
+#endif
+#ifdef O_NOFOLLOW
+  if (!following_links ())
+    flags |= O_NOFOLLOW;
+#endif
+  fd = openat (state.cwd_dir_fd, state.rel_pathname, flags);
+  if (fd < 0)
+    {
+      nonfatal_target_file_error (errno, pathname);
+      return -1;
+    }
+  /* Don't hang reading something which replaced the file since we
+   * looked at it.
+   */
+  if (0 != fstat (fd, &st) || !S_ISREG (st.st_mode))
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Replace the contents of FILENAME with what WRITE_CONTENTS (FP, DATA)
+ * writes to FP, a new file opened with fopen's MODE.  WRITE_CONTENTS
+ * returns false if it fails.  We write to a temporary file first and
+ * rename it over FILENAME, so that the old contents survive if we are
+ * interrupted or something goes wrong.  Problems are reported, but are
+ * not fatal.  Return true if FILENAME was replaced.
+ */
+bool
+replace_file (const char *filename, const char *mode,
+	      bool (*write_contents) (FILE *fp, void *data), void *data)
+{
+  char *tmpname = xmalloc (strlen (filename) + sizeof ".new");
+  bool ok = false;
+  FILE *fp;
+
+  strcpy (tmpname, filename);
+  strcat (tmpname, ".new");
+  fp = fopen_safer (tmpname, mode);
+  if (NULL == fp)
+    {
+      nonfatal_nontarget_file_error (errno, tmpname);
+    }
+  else if (!write_contents (fp, data) || ferror (fp))
+    {
+      nonfatal_nontarget_file_error (errno, tmpname);
+      fclose (fp);
+      unlink (tmpname);
+    }
+  else if (0 != fclose (fp))
+    {
+      nonfatal_nontarget_file_error (errno, tmpname);
+      unlink (tmpname);
+    }
+  else if (0 != rename (tmpname, filename))
+    {
+      nonfatal_nontarget_file_error (errno, filename);
+      unlink (tmpname);
+    }
+  else
+    {
+      ok = true;
+    }
+  free (tmpname);
+  return ok;
+}
+
 
 /* Take a "mode" indicator and fill in the files of 'state'.
  */
@@ -980,6 +1243,9 @@ set_option_defaults (struct options *p)
 #endif
 
   p->regex_options = RE_SYNTAX_EMACS;
+  p->contents_limit = UINTMAX_MAX;
+  p->nobinary_contents = false;
+  p->du_apparent_size = false;
 
   if (isatty (0))
     {
@@ -1015,6 +1281,17 @@ set_option_defaults (struct options *p)
 
   p->debug_options = 0uL;
   p->optimisation_level = 2;
+  p->threads = 1;
+  p->stat_fields = StatFieldAll;
+  p->stat_dont_sync = false;
+  p->batch_stat = false;
+  p->batch_eval = false;
+  p->inode_order = false;
+  p->readdir_batch = 100000;
+  p->snapshot_file = NULL;
+  p->profile_file = NULL;
+  p->calibrate = false;
+  p->watch = false;
 
   if (getenv ("FIND_BLOCK_SIZE"))
     {
@@ -1042,23 +1319,65 @@ set_option_defaults (struct options *p)
 bool
 apply_predicate(const char *pathname, struct stat *stat_buf, struct predicate *p)
 {
+  bool result;
+
   ++p->perf.visits;
 
-  if (p->need_stat || p->need_type || p->need_inum)
+  if (p->memo >= 0 && memo_recall (p->memo, &result))
     {
-      /* We may need a stat here. */
-      if (get_info(pathname, stat_buf, p) != 0)
-	    return false;
+      /* We have already evaluated the same thing for this file. */
     }
-  if ((p->pred_func)(pathname, stat_buf, p))
+  else if ((p->need_stat || p->need_type || p->need_inum)
+	   /* We may need a stat here. */
+	   && get_info(pathname, stat_buf, p) != 0)
     {
-      ++(p->perf.successes);
-      return true;
+      result = false;
     }
   else
     {
-      return false;
+      result = (options.profile_file
+		? profile_call (pathname, stat_buf, p, &p->perf.nsec)
+		: (p->pred_func)(pathname, stat_buf, p));
+      if (p->memo >= 0)
+	memo_store (p->memo, result);
+      else if (p->side_effects && PRIMARY_TYPE == p->p_type)
+	memo_forget ();
     }
+
+  if (result)
+    ++(p->perf.successes);
+  return result;
+}
+
+
+/* apply_expression
+ *
+ * Evaluate the whole expression for PATHNAME, using the compiled
+ * program if there is one.  At -O4 we may first reorder it.
+ */
+bool
+apply_expression (const char *pathname, struct stat *stat_buf)
+{
+  memo_forget ();
+  if (options.optimisation_level > 3)
+    adapt_expression ();
+  if (expression_is_compiled ())
+    return run_program (pathname, stat_buf);
+  else
+    return apply_predicate (pathname, stat_buf, get_eval_tree ());
+}
+
+/* Like apply_expression, but run_program_batch has already applied
+ * the first tests to PATHNAME, with result R.
+ */
+bool
+apply_expression_after_batch (const char *pathname, struct stat *stat_buf,
+			      const struct batch_result *r)
+{
+  memo_forget ();
+  if (options.optimisation_level > 3)
+    adapt_expression ();
+  return run_program_after_batch (pathname, stat_buf, r);
 }
 
 
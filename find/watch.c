@@ -0,0 +1,603 @@
+/* watch.c -- keep looking for new and changed files after the search.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With -watch, we put an inotify watch on each directory we search.
+ * Once the search is complete, we wait for entries to be created in,
+ * moved into or written to those directories, and search again from
+ * each such entry.  A new directory is searched (and watched) in its
+ * entirety.  A new regular file is examined when whatever created it
+ * closes it, rather than as soon as it is created.
+ *
+ * If we run out of watches, directories we cannot watch are searched
+ * again every WatchRescanInterval seconds.  Each of those searches
+ * only applies the expression to files whose status has changed
+ * since the previous one.  If the kernel's event queue overflows,
+ * we don't know what we missed, so we search everything again in the
+ * same way.  Since those searches do not apply the expression to a
+ * directory which has not changed, we remember which directories
+ * -prune kept the search out of, and keep out of them then too.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined __linux__
+# include <poll.h>
+# include <sys/inotify.h>
+# if defined IN_CLOEXEC && defined IN_EXCL_UNLINK
+#  define WATCH_INOTIFY 1
+# endif
+#endif
+
+#include "xalloc.h"
+#include "error.h"
+#include "hash.h"
+#include "stat-time.h"
+#include "timespec.h"
+#include "defs.h"
+
+#if ENABLE_NLS
+# include <libintl.h>
+# define _(Text) gettext (Text)
+#else
+# define _(Text) Text
+#endif
+
+#if WATCH_INOTIFY
+
+enum
+  {
+    /* How often we search directories we could not watch. */
+    WatchRescanInterval = 60,
+
+    DefaultHashTableSize = 1021
+  };
+
+/* A directory we are watching (or would like to be). */
+struct watched_dir
+{
+  int wd;			/* inotify watch descriptor, or -1 */
+  char *path;
+  int level;			/* depth below the starting point */
+  int starting_path_length;	/* see state.starting_path_length */
+  struct timespec searched;	/* when we last searched it */
+};
+
+static int inotify_fd = -1;
+static Hash_table *watches = NULL;	/* watched_dir entries, by wd */
+
+/* Directories we could not watch, oldest first.  We don't add the
+ * subdirectories of these, since we search them again anyway.
+ */
+static struct watched_dir **unwatched = NULL;
+static size_t n_unwatched, unwatched_alloc;
+
+/* The starting points, which we search again after a queue overflow. */
+static struct watched_dir *roots = NULL;
+static size_t n_roots, roots_alloc;
+
+static bool overflowed = false;
+
+/* A directory which -prune kept the search out of. */
+struct pruned_dir
+{
+  dev_t dev;
+  ino_t ino;
+};
+
+static Hash_table *pruned_dirs = NULL;	/* pruned_dir entries */
+
+
+static size_t
+watched_dir_hash (const void *pv, size_t buckets)
+{
+  const struct watched_dir *p = pv;
+  return (size_t) p->wd % buckets;
+}
+
+static bool
+watched_dir_compare (const void *av, const void *bv)
+{
+  const struct watched_dir *a = av, *b = bv;
+  return a->wd == b->wd;
+}
+
+static void
+watched_dir_free (void *pv)
+{
+  struct watched_dir *p = pv;
+  free (p->path);
+  free (p);
+}
+
+static size_t
+pruned_dir_hash (const void *pv, size_t buckets)
+{
+  const struct pruned_dir *p = pv;
+  return ((size_t) p->ino ^ (size_t) p->dev) % buckets;
+}
+
+static bool
+pruned_dir_compare (const void *av, const void *bv)
+{
+  const struct pruned_dir *a = av, *b = bv;
+  return a->ino == b->ino && a->dev == b->dev;
+}
+
+static struct watched_dir *
+new_watched_dir (int wd, const char *path, int level,
+		 int starting_path_length)
+{
+  struct watched_dir *p = xmalloc (sizeof *p);
+  p->wd = wd;
+  p->path = xstrdup (path);
+  p->level = level;
+  p->starting_path_length = starting_path_length;
+  gettime (&p->searched);
+  return p;
+}
+
+/* Return true if PATH names something inside the directory DIR. */
+static bool
+is_below (const char *path, const char *dir)
+{
+  size_t len = strlen (dir);
+  return 0 == strncmp (path, dir, len)
+    && ('/' == path[len] || (len && '/' == dir[len - 1] && path[len]));
+}
+
+static char *
+join_path (const char *dir, const char *name)
+{
+  size_t len = strlen (dir);
+  char *p = xmalloc (len + strlen (name) + 2);
+  memcpy (p, dir, len);
+  if (len && '/' != dir[len - 1])
+    p[len++] = '/';
+  strcpy (p + len, name);
+  return p;
+}
+
+
+/* Get ready to watch directories.  This is called before the search. */
+void
+watch_start (void)
+{
+  inotify_fd = inotify_init1 (IN_CLOEXEC);
+  if (inotify_fd < 0)
+    error (EXIT_FAILURE, errno, _("cannot watch for new files"));
+  watches = hash_initialize (DefaultHashTableSize, NULL,
+			     watched_dir_hash, watched_dir_compare,
+			     watched_dir_free);
+  if (NULL == watches)
+    xalloc_die ();
+  pruned_dirs = hash_initialize (DefaultHashTableSize, NULL,
+				 pruned_dir_hash, pruned_dir_compare, free);
+  if (NULL == pruned_dirs)
+    xalloc_die ();
+}
+
+/* The expression has just been applied to the directory whose status
+ * is ST, and PRUNED says whether -prune kept the search out of it.
+ */
+void
+watch_note_dir (const struct stat *st, bool pruned)
+{
+  struct pruned_dir key, *p;
+
+  if (NULL == pruned_dirs)
+    return;
+  key.dev = st->st_dev;
+  key.ino = st->st_ino;
+  if (!pruned)
+    {
+      free (hash_delete (pruned_dirs, &key));
+      return;
+    }
+  if (hash_lookup (pruned_dirs, &key))
+    return;
+  p = xmalloc (sizeof *p);
+  *p = key;
+  if (NULL == hash_insert (pruned_dirs, p))
+    xalloc_die ();
+}
+
+/* Did -prune keep the search out of the directory whose status is ST
+ * the last time the expression was applied to it?
+ */
+bool
+watch_dir_pruned (const struct stat *st)
+{
+  struct pruned_dir key;
+
+  if (NULL == pruned_dirs)
+    return false;
+  key.dev = st->st_dev;
+  key.ino = st->st_ino;
+  return NULL != hash_lookup (pruned_dirs, &key);
+}
+
+static void
+add_unwatched (const char *path, int level, int starting_path_length)
+{
+  static bool warned = false;
+
+  if (!warned)
+    {
+      error (0, 0, _("WARNING: cannot watch any more directories; "
+		     "searching the rest again every %d seconds"),
+	     WatchRescanInterval);
+      warned = true;
+    }
+  if (n_unwatched == unwatched_alloc)
+    unwatched = x2nrealloc (unwatched, &unwatched_alloc, sizeof *unwatched);
+  unwatched[n_unwatched++] = new_watched_dir (-1, path, level,
+					      starting_path_length);
+}
+
+static void
+add_root (const char *path, int starting_path_length)
+{
+  size_t i;
+
+  for (i = 0; i < n_roots; ++i)
+    if (0 == strcmp (roots[i].path, path))
+      return;
+  if (n_roots == roots_alloc)
+    roots = x2nrealloc (roots, &roots_alloc, sizeof *roots);
+  roots[n_roots].wd = -1;
+  roots[n_roots].path = xstrdup (path);
+  roots[n_roots].level = 0;
+  roots[n_roots].starting_path_length = starting_path_length;
+  ++n_roots;
+}
+
+/* We have just visited the directory PATH, LEVEL levels below the
+ * starting point, and are about to search it.  Start watching it.
+ */
+void
+watch_dir (const char *path, int level, int starting_path_length)
+{
+  uint32_t mask = (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE
+		   | IN_MOVED_FROM | IN_DELETE | IN_MOVE_SELF
+		   | IN_ONLYDIR | IN_EXCL_UNLINK);
+  struct watched_dir key, *p;
+  bool follow;
+  int wd;
+
+  if (inotify_fd < 0)
+    return;
+  if (n_unwatched && is_below (path, unwatched[n_unwatched - 1]->path))
+    return;
+  if (0 == level)
+    add_root (path, starting_path_length);
+
+  if (0 == level)
+    follow = (options.symlink_handling != SYMLINK_NEVER_DEREF);
+  else
+    follow = (options.symlink_handling == SYMLINK_ALWAYS_DEREF);
+  if (!follow)
+    mask |= IN_DONT_FOLLOW;
+
+  wd = inotify_add_watch (inotify_fd, path, mask);
+  if (wd < 0)
+    {
+      if (ENOSPC == errno || ENOMEM == errno)
+	add_unwatched (path, level, starting_path_length);
+      /* Otherwise, the directory has probably gone away already. */
+      return;
+    }
+
+  key.wd = wd;
+  p = hash_lookup (watches, &key);
+  if (p)
+    {
+      /* We already watch this directory, perhaps under another name. */
+      free (p->path);
+      p->path = xstrdup (path);
+      p->level = level;
+      p->starting_path_length = starting_path_length;
+    }
+  else if (NULL == hash_insert (watches,
+				new_watched_dir (wd, path, level,
+						 starting_path_length)))
+    {
+      xalloc_die ();
+    }
+}
+
+
+static void
+forget (struct watched_dir *p, bool remove_watch)
+{
+  if (remove_watch)
+    inotify_rm_watch (inotify_fd, p->wd);
+  hash_delete (watches, p);
+  watched_dir_free (p);
+}
+
+struct below_arg
+{
+  const char *path;
+  struct watched_dir **found;
+  size_t n_found, alloc;
+};
+
+static bool
+collect_below (void *entry, void *data)
+{
+  struct watched_dir *p = entry;
+  struct below_arg *arg = data;
+
+  if (0 == strcmp (p->path, arg->path) || is_below (p->path, arg->path))
+    {
+      if (arg->n_found == arg->alloc)
+	arg->found = x2nrealloc (arg->found, &arg->alloc, sizeof *arg->found);
+      arg->found[arg->n_found++] = p;
+    }
+  return true;
+}
+
+/* The directory PATH has been moved or removed.  Stop watching it and
+ * everything below it; if it turns up elsewhere, we'll search it again
+ * from there.
+ */
+static void
+forget_below (const char *path)
+{
+  struct below_arg arg;
+  size_t i, j;
+
+  arg.path = path;
+  arg.found = NULL;
+  arg.n_found = arg.alloc = 0;
+  hash_do_for_each (watches, collect_below, &arg);
+  for (i = 0; i < arg.n_found; ++i)
+    forget (arg.found[i], true);
+  free (arg.found);
+
+  for (i = j = 0; i < n_unwatched; ++i)
+    {
+      if (0 == strcmp (unwatched[i]->path, path)
+	  || is_below (unwatched[i]->path, path))
+	watched_dir_free (unwatched[i]);
+      else
+	unwatched[j++] = unwatched[i];
+    }
+  n_unwatched = j;
+}
+
+/* Would we have found PATH (which is a new directory entry) without
+ * an event for a regular file being closed?  That is the case if it
+ * is not a regular file, or if it got here by being linked to.
+ */
+static bool
+wait_for_close (const char *path)
+{
+  struct stat st;
+  return 0 == lstat (path, &st) && S_ISREG (st.st_mode) && 1 == st.st_nlink;
+}
+
+static void
+handle_event (const struct inotify_event *ev, watch_scan_fn scan)
+{
+  struct watched_dir key, *p;
+  char *path;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+      overflowed = true;
+      return;
+    }
+  key.wd = ev->wd;
+  p = hash_lookup (watches, &key);
+  if (NULL == p)
+    return;
+  if (ev->mask & IN_IGNORED)
+    {
+      forget (p, false);
+      return;
+    }
+  if (ev->mask & IN_MOVE_SELF)
+    {
+      forget (p, true);
+      return;
+    }
+  if (0 == ev->len)
+    return;
+
+  path = join_path (p->path, ev->name);
+  if (options.debug_options & DebugSearch)
+    fprintf (stderr, "watch: %s: event mask %#lx\n",
+	     quotearg_n_style (0, options.err_quoting_style, path),
+	     (unsigned long) ev->mask);
+
+  if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
+    {
+      if (ev->mask & IN_ISDIR)
+	forget_below (path);
+    }
+  else if ((ev->mask & IN_CREATE) && !(ev->mask & IN_ISDIR)
+	   && wait_for_close (path))
+    {
+      /* We'll get IN_CLOSE_WRITE for this when it has been written. */
+    }
+  else
+    {
+      (void) scan (path, p->level + 1, p->starting_path_length, NULL);
+    }
+  free (path);
+}
+
+/* Search the starting points again, looking at just the files which
+ * have changed since SINCE.
+ */
+static void
+search_roots_again (watch_scan_fn scan, struct timespec since)
+{
+  size_t i;
+
+  for (i = 0; i < n_roots; ++i)
+    (void) scan (roots[i].path, 0, roots[i].starting_path_length, &since);
+}
+
+/* Search again those directories we could not watch and have not
+ * searched for WatchRescanInterval seconds.  Return the number of
+ * milliseconds until we need to do that again, or -1 if never.
+ */
+static int
+search_unwatched (watch_scan_fn scan)
+{
+  struct timespec now;
+
+  while (n_unwatched)
+    {
+      struct watched_dir *p = unwatched[0];
+      struct timespec since;
+      struct stat st;
+
+      gettime (&now);
+      if (now.tv_sec < p->searched.tv_sec + WatchRescanInterval)
+	{
+	  time_t ms = ((p->searched.tv_sec + WatchRescanInterval - now.tv_sec)
+		       * 1000 - now.tv_nsec / 1000000);
+	  return ms > 0 ? ms : 0;
+	}
+
+      /* If the search fails to watch P again, it will add it back on
+       * the end of the list.
+       */
+      memmove (unwatched, unwatched + 1, --n_unwatched * sizeof *unwatched);
+      since.tv_sec = p->searched.tv_sec - 1;
+      since.tv_nsec = 0;
+      if (0 == lstat (p->path, &st))
+	(void) scan (p->path, p->level, p->starting_path_length, &since);
+      watched_dir_free (p);
+    }
+  return -1;
+}
+
+/* Wait for changes in the directories we are watching, and search
+ * again where they happened.  We only return if there is nothing left
+ * to watch or something goes wrong.
+ */
+void
+watch_loop (watch_scan_fn scan)
+{
+  /* Before this, we have seen every event which the kernel did not
+   * drop.  File times can lag the clock slightly, so allow a second.
+   */
+  struct timespec synced = options.start_time;
+
+  for (;;)
+    {
+      char buf[8192]
+	__attribute__ ((aligned (__alignof__ (struct inotify_event))));
+      struct timespec before;
+      ssize_t n;
+      char *p;
+      int timeout;
+
+      timeout = search_unwatched (scan);
+
+      /* Report what we found as soon as we find it. */
+      digest_sync ();
+      complete_pending_execs (get_eval_tree ());
+      complete_pending_execdirs ();
+      if (EOF == fflush (stdout))
+	nonfatal_nontarget_file_error (errno, "standard output");
+      if (0 == hash_get_n_entries (watches) && timeout < 0)
+	break;
+      if (timeout >= 0)
+	{
+	  struct pollfd pfd;
+	  pfd.fd = inotify_fd;
+	  pfd.events = POLLIN;
+	  if (poll (&pfd, 1, timeout) <= 0)
+	    continue;
+	}
+
+      gettime (&before);
+      n = read (inotify_fd, buf, sizeof buf);
+      if (n < 0)
+	{
+	  if (EINTR == errno)
+	    continue;
+	  error (0, errno, _("cannot read inotify events"));
+	  error_severity (EXIT_FAILURE);
+	  break;
+	}
+      for (p = buf; p < buf + n; )
+	{
+	  const struct inotify_event *ev = (const struct inotify_event *) p;
+	  handle_event (ev, scan);
+	  p += sizeof *ev + ev->len;
+	}
+      if (overflowed)
+	{
+	  overflowed = false;
+	  synced.tv_sec -= 1;
+	  synced.tv_nsec = 0;
+	  search_roots_again (scan, synced);
+	}
+      synced = before;
+    }
+}
+
+#else  /* !WATCH_INOTIFY */
+
+void
+watch_start (void)
+{
+  error (EXIT_FAILURE, 0, _("-watch is not supported on this system"));
+}
+
+void
+watch_dir (const char *path, int level, int starting_path_length)
+{
+  (void) path;
+  (void) level;
+  (void) starting_path_length;
+}
+
+void
+watch_note_dir (const struct stat *st, bool pruned)
+{
+  (void) st;
+  (void) pruned;
+}
+
+bool
+watch_dir_pruned (const struct stat *st)
+{
+  (void) st;
+  return false;
+}
+
+void
+watch_loop (watch_scan_fn scan)
+{
+  (void) scan;
+}
+
+#endif
@@ -145,6 +145,23 @@ enum
   _FTS_INODE_SORT_DIR_ENTRIES_THRESHOLD = FTS_INODE_SORT_DIR_ENTRIES_THRESHOLD
 };
 
+/* The default maximum number of directory entries to read at one
+   time (see fts_build).  This is large enough for inode-sorting to
+   help, but small enough not to exhaust memory for a directory with
+   many millions of entries.  */
+#ifndef FTS_MAX_READDIR_ENTRIES
+# define FTS_MAX_READDIR_ENTRIES 100000
+#endif
+
+#define closedir_and_clear(dirp)                \
+  do                                            \
+    {                                           \
+      if (dirp)                                 \
+        closedir (dirp);                        \
+      (dirp) = NULL;                            \
+    }                                           \
+  while (0)
+
 enum Fts_stat
 {
   FTS_NO_STAT_REQUIRED = 1,
@@ -390,6 +407,9 @@ fts_open (char * const *argv,
                 return (NULL);
         memset(sp, 0, sizeof(FTS));
         sp->fts_compar = compar;
+        sp->fts_max_readdir_entries = FTS_MAX_READDIR_ENTRIES;
+        sp->fts_readdir = NULL;
+        sp->fts_batch = NULL;
         sp->fts_options = options;
 
         /* Logical walks turn on NOCHDIR; symbolic links are too hard. */
@@ -576,6 +596,8 @@ fts_close (FTS *sp)
                 for (p = sp->fts_cur; p->fts_level >= FTS_ROOTLEVEL;) {
                         freep = p;
                         p = p->fts_link != NULL ? p->fts_link : p->fts_parent;
+                        if (freep->fts_dirp)
+                                closedir (freep->fts_dirp);
                         free(freep);
                 }
                 free(p);
@@ -855,6 +877,7 @@ fts_read (register FTS *sp)
                                 fts_lfree(sp->fts_child);
                                 sp->fts_child = NULL;
                         }
+                        closedir_and_clear(p->fts_dirp);
                         p->fts_info = FTS_DP;
                         LEAVE_DIR (sp, p, "1");
                         return (p);
@@ -863,6 +886,7 @@ fts_read (register FTS *sp)
                 /* Rebuild if only read the names and now traversing. */
                 if (sp->fts_child != NULL && ISSET(FTS_NAMEONLY)) {
                         CLR(FTS_NAMEONLY);
+                        closedir_and_clear(p->fts_dirp);
                         fts_lfree(sp->fts_child);
                         sp->fts_child = NULL;
                 }
@@ -883,6 +907,8 @@ fts_read (register FTS *sp)
                         if (fts_safe_changedir(sp, p, -1, p->fts_accpath)) {
                                 p->fts_errno = errno;
                                 p->fts_flags |= FTS_DONTCHDIR;
+                                /* We can't read any more entries either.  */
+                                closedir_and_clear(p->fts_dirp);
                                 for (p = sp->fts_child; p != NULL;
                                      p = p->fts_link)
                                         p->fts_accpath =
@@ -906,6 +932,27 @@ fts_read (register FTS *sp)
 
         /* Move to the next node on this level. */
 next:   tmp = p;
+
+        /* If we have so many directory entries that we're reading them
+           in batches, and we've reached the end of the current batch,
+           read in a new batch.  */
+        if (p->fts_link == NULL && p->fts_parent->fts_dirp)
+          {
+            p = tmp->fts_parent;
+            sp->fts_cur = p;
+            sp->fts_path[p->fts_pathlen] = '\0';
+
+            if ((p = fts_build (sp, BREAD)) == NULL)
+              {
+                if (ISSET(FTS_STOP))
+                  return NULL;
+                goto cd_dot_dot;
+              }
+
+            free(tmp);
+            goto name;
+          }
+
         if ((p = p->fts_link) != NULL) {
                 sp->fts_cur = p;
                 free(tmp);
@@ -995,6 +1042,8 @@ check_for_dir:
                 return p;
         }
 
+cd_dot_dot:
+
         /* Move up to the parent node. */
         p = tmp->fts_parent;
         sp->fts_cur = p;
@@ -1223,9 +1272,12 @@ fts_build (register FTS *sp, int type)
         size_t len, maxlen, new_len;
         char *cp;
         int dir_fd;
+        bool continue_readdir;
+        size_t max_entries;
 
         /* Set current node pointer. */
         cur = sp->fts_cur;
+        continue_readdir = (cur->fts_dirp != NULL);
 
         /*
          * Open the directory for reading.  If this fails, we're done.
@@ -1247,7 +1299,14 @@ fts_build (register FTS *sp, int type)
                    ? O_NOFOLLOW : 0),                           \
                   &dir_fd)
 #endif
-       if ((dirp = __opendir2(cur->fts_accpath, oflag)) == NULL) {
+       /* When cur->fts_dirp is non-NULL, we stopped reading the
+          directory part of the way through last time (see below), so
+          continue reading from the same DIR rather than opening it
+          again.  */
+       if (continue_readdir) {
+                dirp = cur->fts_dirp;
+                dir_fd = dirfd (dirp);
+       } else if ((dirp = __opendir2(cur->fts_accpath, oflag)) == NULL) {
                 if (type == BREAD) {
                         cur->fts_info = FTS_DNR;
                         cur->fts_errno = errno;
@@ -1257,7 +1316,11 @@ fts_build (register FTS *sp, int type)
        /* Rather than calling fts_stat for each and every entry encountered
           in the readdir loop (below), stat each directory only right after
           opening it.  */
-       if (cur->fts_info == FTS_NSOK)
+       if (continue_readdir)
+         {
+           /* We already did that.  */
+         }
+       else if (cur->fts_info == FTS_NSOK)
          cur->fts_info = fts_stat(sp, cur, false);
        else if (sp->fts_options & FTS_TIGHT_CYCLE_CHECK) {
                 /* Now read the stat info again after opening a directory to
@@ -1307,7 +1370,10 @@ fts_build (register FTS *sp, int type)
          * needed sorted entries or stat information, they had better be
          * checking FTS_NS on the returned nodes.
          */
-        if (nlinks || type == BREAD) {
+        if (continue_readdir) {
+                /* We are still in the directory from last time.  */
+                descend = true;
+        } else if (nlinks || type == BREAD) {
                 if (ISSET(FTS_CWDFD))
                   {
                     dir_fd = dup (dir_fd);
@@ -1351,9 +1417,20 @@ fts_build (register FTS *sp, int type)
 
         level = cur->fts_level + 1;
 
+        /* Maximum number of entries to read at one time.  When there is
+           a comparison function, we have to read everything before
+           calling it.  Otherwise, we read in batches, so that the memory
+           we need and the time before we return the first entry do not
+           depend on the size of the directory.  */
+        max_entries = (sp->fts_compar || type == BNAMES
+                       ? SIZE_MAX : sp->fts_max_readdir_entries);
+
         /* Read the directory, attaching each entry to the `link' pointer. */
         doadjust = false;
-        for (head = tail = NULL, nitems = 0; dirp && (dp = readdir(dirp));) {
+        for (head = tail = NULL, nitems = 0;
+             dirp && (dp = (sp->fts_readdir
+                            ? sp->fts_readdir (cur, dirp)
+                            : readdir (dirp)));) {
                 bool is_dir;
 
                 if (!ISSET(FTS_SEEDOT) && ISDOT(dp->d_name))
@@ -1375,6 +1452,7 @@ mem1:                           saved_errno = errno;
                                 free(p);
                                 fts_lfree(head);
                                 closedir(dirp);
+                                cur->fts_dirp = NULL;
                                 cur->fts_info = FTS_ERR;
                                 SET(FTS_STOP);
                                 __set_errno (saved_errno);
@@ -1400,6 +1478,7 @@ mem1:                           saved_errno = errno;
                         free(p);
                         fts_lfree(head);
                         closedir(dirp);
+                        cur->fts_dirp = NULL;
                         cur->fts_info = FTS_ERR;
                         SET(FTS_STOP);
                         __set_errno (ENAMETOOLONG);
@@ -1468,9 +1547,18 @@ mem1:                           saved_errno = errno;
                         tail = p;
                 }
                 ++nitems;
+                if (max_entries <= nitems) {
+                        /* Leave the directory open, so that fts_read
+                           can take up where we left off.  */
+                        cur->fts_dirp = dirp;
+                        goto break_without_closedir;
+                }
         }
         if (dirp)
                 closedir(dirp);
+        cur->fts_dirp = NULL;
+
+ break_without_closedir:
 
         /*
          * If realloc() changed the address of the file name, adjust the
@@ -1496,7 +1584,7 @@ mem1:                           saved_errno = errno;
          * to an empty directory, we wind up here with no other way back.  If
          * can't get back, we're done.
          */
-        if (descend && (type == BCHILD || !nitems) &&
+        if (!continue_readdir && descend && (type == BCHILD || !nitems) &&
             (cur->fts_level == FTS_ROOTLEVEL
              ? RESTORE_INITIAL_CWD(sp)
              : fts_safe_changedir(sp, cur->fts_parent, -1, ".."))) {
@@ -1506,6 +1594,23 @@ mem1:                           saved_errno = errno;
                 return (NULL);
         }
 
+        /* Let the caller look at all the entries at once, and drop those
+           it has no use for.  The first one is always kept, since an
+           empty list would mean that there was nothing left to read.  */
+        if (sp->fts_batch != NULL && head != NULL && type != BNAMES) {
+                FTSENT *prev = head;
+
+                sp->fts_batch(cur, head);
+                while ((p = prev->fts_link) != NULL) {
+                        if (p->fts_instr == FTS_SKIP) {
+                                prev->fts_link = p->fts_link;
+                                free(p);
+                                --nitems;
+                        } else
+                                prev = p;
+                }
+        }
+
         /* If didn't find anything, return NULL. */
         if (!nitems) {
                 if (type == BREAD)
@@ -1826,6 +1931,7 @@ fts_alloc (FTS *sp, const char *name, register size_t namelen)
         p->fts_instr = FTS_NOINSTR;
         p->fts_number = 0;
         p->fts_pointer = NULL;
+        p->fts_dirp = NULL;
         return (p);
 }
 
@@ -1838,6 +1944,8 @@ fts_lfree (register FTSENT *head)
         /* Free a linked list of structures. */
         while ((p = head)) {
                 head = head->fts_link;
+                if (p->fts_dirp)
+                        closedir (p->fts_dirp);
                 free(p);
         }
 }
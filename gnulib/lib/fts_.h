@@ -67,6 +67,7 @@
 
 # include <stddef.h>
 # include <sys/types.h>
+# include <dirent.h>
 # include <sys/stat.h>
 # include "i-ring.h"
 
@@ -83,6 +84,24 @@ typedef struct {
         size_t fts_nitems;              /* elements in the sort array */
         int (*fts_compar) (struct _ftsent const **, struct _ftsent const **);
                                         /* compare fn */
+        size_t fts_max_readdir_entries; /* read directories in batches of
+                                           at most this many entries; see
+                                           fts_build.  The caller may change
+                                           this after calling fts_open.  */
+        struct dirent *(*fts_readdir) (struct _ftsent *, DIR *);
+                                        /* if non-NULL, fts_build calls this
+                                           rather than readdir to read the
+                                           given directory.  The caller may
+                                           set this after calling fts_open.  */
+        void (*fts_batch) (struct _ftsent *, struct _ftsent *);
+                                        /* if non-NULL, fts_build calls this
+                                           with the directory and the list of
+                                           entries it has just read from it,
+                                           before sorting them, and then drops
+                                           any entry but the first which has
+                                           been marked with FTS_SKIP.  The
+                                           caller may set this after calling
+                                           fts_open.  */
 
 # define FTS_COMFOLLOW  0x0001          /* follow command line symlinks */
 # define FTS_LOGICAL    0x0002          /* logical walk */
@@ -191,6 +210,9 @@ typedef struct _ftsent {
         struct _ftsent *fts_link;       /* next file in directory */
         long fts_number;                /* local numeric value */
         void *fts_pointer;              /* local address value */
+        DIR *fts_dirp;                  /* Dir pointer for any directory
+                                           containing more than
+                                           fts_max_readdir_entries entries */
         char *fts_accpath;              /* access file name */
         char *fts_path;                 /* root name; == fts_fts->fts_path */
         int fts_errno;                  /* errno for this node */
@@ -0,0 +1,268 @@
+/* asciicase.c -- fast comparison of strings ignoring the case of ASCII letters.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* find -iname and locate -i spend most of their time comparing file
+ * names with a pattern while ignoring case.  The C library does this
+ * one character at a time through the locale's tables, but in the
+ * common case that both the pattern and the name are plain ASCII we
+ * can instead fold and compare 16 bytes at a time with SSE2, or 32
+ * with AVX2 where the processor has it.  Where neither is available
+ * we fall back on comparing one byte at a time, which is still cheaper
+ * than going through the locale.
+ *
+ * The callers must check with ascii_fold_scope that this gives the
+ * same answers as the locale would, and with ascii_only when it only
+ * does so for ASCII text.  The folded strings these functions compare
+ * against must already be in lower case; see ascii_fold.
+ */
+
+#include <config.h>
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "c-ctype.h"
+#include "asciicase.h"
+
+#if (defined __x86_64__ || defined __i386__) && defined __SSE2__
+# define USE_SSE2 1
+# include <emmintrin.h>
+/* We only use AVX2 if the processor we end up running on has it. */
+# if defined __GNUC__ && (4 < __GNUC__ || (4 == __GNUC__ && 9 <= __GNUC_MINOR__))
+#  define USE_AVX2 1
+#  include <immintrin.h>
+# endif
+#endif
+
+
+/* Does folding the case of ASCII letters alone give the same results
+ * as the current locale does?  In a multibyte locale, we can only say
+ * so for ASCII text, since the other bytes are parts of characters.
+ */
+enum ascii_fold_scope
+ascii_fold_scope (void)
+{
+  int c;
+
+  if (1 < MB_CUR_MAX)
+    {
+      for (c = 0; c < 0x80; ++c)
+	{
+	  wint_t wc = btowc (c);
+	  if (WEOF == wc || towlower (wc) != btowc (c_tolower (c)))
+	    return ASCII_FOLD_NONE;
+	}
+      return ASCII_FOLD_ASCII;
+    }
+
+  for (c = 0; c < 0x80; ++c)
+    if (tolower (c) != c_tolower (c))
+      return ASCII_FOLD_NONE;
+  for (; c <= UCHAR_MAX; ++c)
+    if (tolower (c) != c)
+      return ASCII_FOLD_ASCII;
+  return ASCII_FOLD_ALL;
+}
+
+/* Fold the ASCII letters in S to lower case. */
+void
+ascii_fold (char *s)
+{
+  for (; *s; ++s)
+    *s = c_tolower ((unsigned char) *s);
+}
+
+
+#if USE_SSE2
+/* Fold the ASCII letters among the 16 bytes of X to lower case.  Bytes
+ * above 0x7f compare as negative, so are never taken for letters.
+ */
+static inline __m128i
+fold16 (__m128i x)
+{
+  __m128i upper = _mm_and_si128 (_mm_cmpgt_epi8 (x, _mm_set1_epi8 ('A' - 1)),
+				 _mm_cmplt_epi8 (x, _mm_set1_epi8 ('Z' + 1)));
+  return _mm_or_si128 (x, _mm_and_si128 (upper, _mm_set1_epi8 (0x20)));
+}
+#endif
+
+/* Are all of the N bytes at S ASCII? */
+bool
+ascii_only (const char *s, size_t n)
+{
+#if USE_SSE2
+  for (; n >= 16u; s += 16, n -= 16u)
+    if (_mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) s)))
+      return false;
+#endif
+  for (; n; --n)
+    if ((unsigned char) *s++ >= 0x80)
+      return false;
+  return true;
+}
+
+static bool
+fold_equal_bytes (const char *s, const char *folded, size_t n)
+{
+  for (; n; --n)
+    if (c_tolower ((unsigned char) *s++) != (unsigned char) *folded++)
+      return false;
+  return true;
+}
+
+/* Are the N bytes at S the same as the N bytes at FOLDED, ignoring the
+ * case of ASCII letters?
+ */
+bool
+ascii_fold_equal (const char *s, const char *folded, size_t n)
+{
+#if USE_SSE2
+  for (; n >= 16u; s += 16, folded += 16, n -= 16u)
+    {
+      __m128i a = fold16 (_mm_loadu_si128 ((const __m128i *) s));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) folded);
+      if (0xffff != _mm_movemask_epi8 (_mm_cmpeq_epi8 (a, b)))
+	return false;
+    }
+#endif
+  return fold_equal_bytes (s, folded, n);
+}
+
+
+/* Look for FOLDED at each position from *POS on in the N bytes at S,
+ * one at a time, and advance *POS past those we have tried.
+ */
+static const char *
+search_bytes (const char *s, size_t n, const char *folded, size_t m,
+	      size_t *pos)
+{
+  size_t i;
+
+  for (i = *pos; i + m <= n; ++i)
+    if (c_tolower ((unsigned char) s[i]) == (unsigned char) folded[0]
+	&& fold_equal_bytes (s + i + 1, folded + 1, m - 1u))
+      return s + i;
+  *pos = i;
+  return NULL;
+}
+
+/* The vector searches below compare the first and last bytes of
+ * FOLDED with a block of positions at once, and only compare the rest
+ * at positions where both of those match.  They look at the blocks
+ * which lie wholly within S, and leave the rest to search_bytes.
+ */
+
+#if USE_SSE2
+static const char *
+search_sse2 (const char *s, size_t n, const char *folded, size_t m,
+	     size_t *pos)
+{
+  const __m128i first = _mm_set1_epi8 (folded[0]);
+  const __m128i last = _mm_set1_epi8 (folded[m - 1u]);
+  size_t i;
+
+  for (i = *pos; i + m - 1u + 16u <= n; i += 16u)
+    {
+      __m128i a = fold16 (_mm_loadu_si128 ((const __m128i *) (s + i)));
+      __m128i b = fold16 (_mm_loadu_si128 ((const __m128i *) (s + i + m - 1u)));
+      unsigned int mask = _mm_movemask_epi8 (_mm_and_si128
+					     (_mm_cmpeq_epi8 (a, first),
+					      _mm_cmpeq_epi8 (b, last)));
+      for (; mask; mask &= mask - 1u)
+	{
+	  const char *p = s + i + ffs (mask) - 1;
+	  if (m <= 2u || fold_equal_bytes (p + 1, folded + 1, m - 2u))
+	    return p;
+	}
+    }
+  *pos = i;
+  return NULL;
+}
+#endif
+
+#if USE_AVX2
+static inline __m256i __attribute__ ((__target__ ("avx2")))
+fold32 (__m256i x)
+{
+  __m256i upper = _mm256_and_si256 (_mm256_cmpgt_epi8 (x, _mm256_set1_epi8 ('A' - 1)),
+				    _mm256_cmpgt_epi8 (_mm256_set1_epi8 ('Z' + 1), x));
+  return _mm256_or_si256 (x, _mm256_and_si256 (upper, _mm256_set1_epi8 (0x20)));
+}
+
+static const char * __attribute__ ((__target__ ("avx2")))
+search_avx2 (const char *s, size_t n, const char *folded, size_t m,
+	     size_t *pos)
+{
+  const __m256i first = _mm256_set1_epi8 (folded[0]);
+  const __m256i last = _mm256_set1_epi8 (folded[m - 1u]);
+  size_t i;
+
+  for (i = *pos; i + m - 1u + 32u <= n; i += 32u)
+    {
+      __m256i a = fold32 (_mm256_loadu_si256 ((const __m256i *) (s + i)));
+      __m256i b = fold32 (_mm256_loadu_si256 ((const __m256i *) (s + i + m - 1u)));
+      unsigned int mask = _mm256_movemask_epi8 (_mm256_and_si256
+						(_mm256_cmpeq_epi8 (a, first),
+						 _mm256_cmpeq_epi8 (b, last)));
+      for (; mask; mask &= mask - 1u)
+	{
+	  const char *p = s + i + ffs (mask) - 1;
+	  if (m <= 2u || fold_equal_bytes (p + 1, folded + 1, m - 2u))
+	    return p;
+	}
+    }
+  *pos = i;
+  return NULL;
+}
+
+static int have_avx2 = -1;	/* not yet known */
+#endif
+
+/* Return the first place in the N bytes at S where the M bytes at
+ * FOLDED occur, ignoring the case of ASCII letters, or NULL if there is
+ * none.
+ */
+const char *
+ascii_fold_search (const char *s, size_t n, const char *folded, size_t m)
+{
+  const char *found = NULL;
+  size_t pos = 0u;
+
+  if (0u == m)
+    return s;
+  if (m > n)
+    return NULL;
+
+#if USE_AVX2
+  if (have_avx2 < 0)
+    have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+  if (have_avx2)
+    found = search_avx2 (s, n, folded, m, &pos);
+#endif
+#if USE_SSE2
+  if (NULL == found)
+    found = search_sse2 (s, n, folded, m, &pos);
+#endif
+  if (NULL == found)
+    found = search_bytes (s, n, folded, m, &pos);
+  return found;
+}
@@ -0,0 +1,42 @@
+/* asciicase.h -- fast comparison of strings ignoring the case of ASCII letters.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASCIICASE_H
+#define ASCIICASE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* How far folding just the ASCII letters agrees with the way the
+ * current locale folds case; see ascii_fold_scope.
+ */
+enum ascii_fold_scope
+  {
+    ASCII_FOLD_NONE,		/* not even for ASCII text (Turkish) */
+    ASCII_FOLD_ASCII,		/* for text which is entirely ASCII */
+    ASCII_FOLD_ALL		/* for any text at all (the C locale) */
+  };
+
+enum ascii_fold_scope ascii_fold_scope (void);
+
+bool ascii_only (const char *s, size_t n);
+void ascii_fold (char *s);
+bool ascii_fold_equal (const char *s, const char *folded, size_t n);
+const char *ascii_fold_search (const char *s, size_t n,
+			       const char *folded, size_t m);
+
+#endif
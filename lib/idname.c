@@ -0,0 +1,153 @@
+/* idname.c -- cached translation of user and group IDs to names.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* find -ls, -printf %u and %g, -nouser and -nogroup all need the name
+ * which goes with the owner or group of each file.  Where the user
+ * database is held on a directory server, asking the system for each
+ * file costs far more than anything else find does.  So we remember
+ * the answer for each ID, including the answer that there is no such
+ * user or group, in a hash table which grows as needed.  Most trees
+ * have files belonging to only a handful of owners, so almost every
+ * lookup is answered from the table.
+ */
+
+#include <config.h>
+
+#include <grp.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "xalloc.h"
+#include "idname.h"
+
+enum
+  {
+    DefaultHashTableSize = 31
+  };
+
+struct id_entry
+{
+  uintmax_t id;
+  char *name;			/* NULL if there is no such user or group */
+};
+
+struct id_cache
+{
+  Hash_table *table;
+  struct idname_stats stats;
+};
+
+static struct id_cache users, groups;
+
+
+static size_t
+id_entry_hash (const void *pv, size_t buckets)
+{
+  const struct id_entry *p = pv;
+  return p->id % buckets;
+}
+
+static bool
+id_entry_compare (const void *av, const void *bv)
+{
+  const struct id_entry *a = av, *b = bv;
+  return a->id == b->id;
+}
+
+static void
+id_entry_free (void *pv)
+{
+  struct id_entry *p = pv;
+  free (p->name);
+  free (p);
+}
+
+/* Look up ID in CACHE.  If we have not seen it before, call LOOKUP to
+ * find its name, and remember that.
+ */
+static const char *
+cached_name (struct id_cache *cache, uintmax_t id,
+	     const char *(*lookup) (uintmax_t id))
+{
+  struct id_entry probe, *e;
+  const char *name;
+
+  if (NULL == cache->table)
+    {
+      cache->table = hash_initialize (DefaultHashTableSize, NULL,
+				      id_entry_hash, id_entry_compare,
+				      id_entry_free);
+      if (NULL == cache->table)
+	xalloc_die ();
+    }
+
+  probe.id = id;
+  e = hash_lookup (cache->table, &probe);
+  if (e)
+    {
+      ++cache->stats.hits;
+      return e->name;
+    }
+
+  ++cache->stats.misses;
+  name = lookup (id);
+  e = xmalloc (sizeof *e);
+  e->id = id;
+  e->name = name ? xstrdup (name) : NULL;
+  if (NULL == hash_insert (cache->table, e))
+    xalloc_die ();
+  return e->name;
+}
+
+static const char *
+lookup_user (uintmax_t id)
+{
+  struct passwd *pw = getpwuid ((uid_t) id);
+  return pw ? pw->pw_name : NULL;
+}
+
+static const char *
+lookup_group (uintmax_t id)
+{
+  struct group *gr = getgrgid ((gid_t) id);
+  return gr ? gr->gr_name : NULL;
+}
+
+/* Return the name of the user UID, or NULL if there is none. */
+const char *
+uid_to_name (uid_t uid)
+{
+  return cached_name (&users, uid, lookup_user);
+}
+
+/* Return the name of the group GID, or NULL if there is none. */
+const char *
+gid_to_name (gid_t gid)
+{
+  return cached_name (&groups, gid, lookup_group);
+}
+
+/* Report how well the caches have done so far. */
+void
+idname_get_stats (struct idname_stats *user_stats,
+		  struct idname_stats *group_stats)
+{
+  *user_stats = users.stats;
+  *group_stats = groups.stats;
+}
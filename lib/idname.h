@@ -0,0 +1,36 @@
+/* idname.h -- cached translation of user and group IDs to names.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IDNAME_H
+#define IDNAME_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* How often the cache has answered a question itself. */
+struct idname_stats
+{
+  uintmax_t hits;
+  uintmax_t misses;		/* and had to ask the system */
+};
+
+const char *uid_to_name (uid_t uid);
+const char *gid_to_name (gid_t gid);
+void idname_get_stats (struct idname_stats *user_stats,
+		       struct idname_stats *group_stats);
+
+#endif
@@ -38,7 +38,7 @@
 #include "pathmax.h"
 #include "error.h"
 #include "filemode.h"
-#include "idcache.h"
+#include "idname.h"
 #include "areadlink.h"
 
 #include "listfile.h"
@@ -183,13 +183,13 @@ list_file (const char *name,
      as the POSIX "optional alternate access method flag".  */
   fprintf (stream, "%s%3lu ", modebuf, (unsigned long) statp->st_nlink);
 
-  user_name = getuser (statp->st_uid);
+  user_name = uid_to_name (statp->st_uid);
   if (user_name)
     fprintf (stream, "%-8s ", user_name);
   else
     fprintf (stream, "%-8lu ", (unsigned long) statp->st_uid);
 
-  group_name = getgroup (statp->st_gid);
+  group_name = gid_to_name (statp->st_gid);
   if (group_name)
     fprintf (stream, "%-8s ", group_name);
   else
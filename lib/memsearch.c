@@ -0,0 +1,118 @@
+/* memsearch.c -- fast search for a string of bytes in a buffer.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* find -contains searches the contents of files for a fixed string.
+ * Where the processor has AVX2, we compare the first and last bytes
+ * of the string with 32 positions at once, and only compare the rest
+ * at positions where both of those match; for the text people
+ * usually search, this is several times faster than the C library's
+ * memmem.  (An SSE2 version of the same thing turned out slower than
+ * glibc's memmem, so we do not have one.)  Otherwise we use memmem
+ * where the C library has it, and memchr and memcmp where it does not.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <strings.h>
+
+#include "memsearch.h"
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__ \
+  && (4 < __GNUC__ || (4 == __GNUC__ && 9 <= __GNUC_MINOR__))
+# define USE_AVX2 1
+# include <immintrin.h>
+#endif
+
+
+#if USE_AVX2
+/* Look for W at each position from *POS on in the N bytes at S, 32 at
+ * a time, and advance *POS past those we have tried.  We only look at
+ * the blocks which lie wholly within S.
+ */
+static const char * __attribute__ ((__target__ ("avx2")))
+search_avx2 (const char *s, size_t n, const char *w, size_t m, size_t *pos)
+{
+  const __m256i first = _mm256_set1_epi8 (w[0]);
+  const __m256i last = _mm256_set1_epi8 (w[m - 1u]);
+  size_t i;
+
+  for (i = *pos; i + m - 1u + 32u <= n; i += 32u)
+    {
+      __m256i a = _mm256_loadu_si256 ((const __m256i *) (s + i));
+      __m256i b = _mm256_loadu_si256 ((const __m256i *) (s + i + m - 1u));
+      unsigned int mask = _mm256_movemask_epi8 (_mm256_and_si256
+						(_mm256_cmpeq_epi8 (a, first),
+						 _mm256_cmpeq_epi8 (b, last)));
+      for (; mask; mask &= mask - 1u)
+	{
+	  const char *p = s + i + ffs (mask) - 1;
+	  if (m <= 2u || 0 == memcmp (p + 1, w + 1, m - 2u))
+	    return p;
+	}
+    }
+  *pos = i;
+  return NULL;
+}
+
+static int have_avx2 = -1;	/* not yet known */
+#endif
+
+/* Look for W in the N bytes at S from position POS on. */
+static const char *
+search_rest (const char *s, size_t n, const char *w, size_t m, size_t pos)
+{
+#if defined __GLIBC__
+  return memmem (s + pos, n - pos, w, m);
+#else
+  const char *p = s + pos, *end = s + n - m + 1u;
+
+  while (p < end && NULL != (p = memchr (p, w[0], end - p)))
+    {
+      if (0 == memcmp (p + 1, w + 1, m - 1u))
+	return p;
+      ++p;
+    }
+  return NULL;
+#endif
+}
+
+/* Return the first place in the N bytes at S where the M bytes at W
+ * occur, or NULL if there is none.
+ */
+const char *
+mem_search (const char *s, size_t n, const char *w, size_t m)
+{
+  size_t pos = 0u;
+
+  if (0u == m)
+    return s;
+  if (m > n)
+    return NULL;
+
+#if USE_AVX2
+  if (have_avx2 < 0)
+    have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+  if (have_avx2)
+    {
+      const char *found = search_avx2 (s, n, w, m, &pos);
+      if (found)
+	return found;
+    }
+#endif
+  return search_rest (s, n, w, m, pos);
+}
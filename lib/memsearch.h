@@ -0,0 +1,25 @@
+/* memsearch.h -- fast search for a string of bytes in a buffer.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMSEARCH_H
+#define MEMSEARCH_H 1
+
+#include <stddef.h>
+
+const char *mem_search (const char *s, size_t n, const char *w, size_t m);
+
+#endif
@@ -56,7 +56,9 @@
 # define CLOSEDIR(d) closedir (d)
 #endif
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -106,6 +108,7 @@ struct new_savedir_direntry_internal
 {
   int    flags;			/* from SaveDirDataFlags */
   mode_t type_info;
+  ino_t  inode;
   size_t buffer_offset;
 };
 
@@ -120,6 +123,20 @@ savedir_cmp (const void *p1, const void *p2)
   return strcmp (de1->name, de2->name); /* POSIX order, not locale order. */
 }
 
+static int
+savedir_inode_cmp (const void *p1, const void *p2)
+{
+  const struct savedir_direntry *de1, *de2;
+  de1 = p1;
+  de2 = p2;
+  if (de1->inode != de2->inode)
+    return de1->inode < de2->inode ? -1 : 1;
+  /* Keep entries with the same (or unknown) inode number in the
+   * order readdir returned them.  The names are stored in that order.
+   */
+  return de1->name < de2->name ? -1 : de1->name > de2->name;
+}
+
 
 static struct savedir_direntry*
 convertentries (const struct savedir_dirinfo *info,
@@ -137,17 +154,54 @@ convertentries (const struct savedir_dirinfo *info,
     {
       result[i].flags = internal[i].flags;
       result[i].type_info = internal[i].type_info;
+      result[i].inode = internal[i].inode;
       result[i].name = &p[internal[i].buffer_offset];
     }
   return result;
 }
 
 
-struct savedir_dirinfo *
-xsavedir (const char *dir, int flags)
+struct savedir_stream
 {
   DIR *dirp;
-  struct dirent *dp;
+  bool at_end;
+};
+
+
+struct savedir_stream *
+savedir_open (const char *dir)
+{
+  struct savedir_stream *stream;
+  DIR *dirp = opendir_safer (dir);
+  if (dirp == NULL)
+    return NULL;
+  stream = xmalloc (sizeof (*stream));
+  stream->dirp = dirp;
+  stream->at_end = false;
+  return stream;
+}
+
+
+bool
+savedir_at_end (const struct savedir_stream *stream)
+{
+  return stream->at_end;
+}
+
+
+int
+savedir_close (struct savedir_stream *stream)
+{
+  int rv = CLOSEDIR (stream->dirp);
+  free (stream);
+  return rv;
+}
+
+
+struct savedir_dirinfo *
+xsavedir_next (struct savedir_stream *stream, int flags, size_t max_entries)
+{
+  struct dirent *dp = NULL;
   struct savedir_dirinfo *result = NULL;
   struct new_savedir_direntry_internal *internal;
 
@@ -155,22 +209,24 @@ xsavedir (const char *dir, int flags)
   size_t entrybuf_allocated = 0u;
   int save_errno;
 
-  dirp = opendir_safer (dir);
-  if (dirp == NULL)
-    return NULL;
-
-  errno = 0;
   result = xmalloc (sizeof (*result));
   result->buffer = NULL;
   result->size = 0u;
   result->entries = NULL;
   internal = NULL;
 
-  while ((dp = readdir (dirp)) != NULL)
+  while (result->size < max_entries)
     {
+      char const *entry;
+
+      errno = 0;
+      dp = readdir (stream->dirp);
+      if (dp == NULL)
+	break;
+
       /* Skip "", ".", and "..".  "" is returned by at least one buggy
          implementation: Solaris 2.4 readdir on NFS file systems.  */
-      char const *entry = dp->d_name;
+      entry = dp->d_name;
       if (entry[entry[0] != '.' ? 0 : entry[1] != '.' ? 1 : 2] != '\0')
 	{
 	  /* Remember the name. */
@@ -183,10 +239,15 @@ xsavedir (const char *dir, int flags)
 	  internal[result->size].flags = 0;
 
 	  internal[result->size].type_info = 0;
+	  internal[result->size].inode = 0;
 #if defined HAVE_STRUCT_DIRENT_D_TYPE
 	  internal[result->size].type_info = type_to_mode (dp->d_type);
 	  if (dp->d_type != DT_UNKNOWN)
 	    internal[result->size].flags |= SavedirHaveFileType;
+#endif
+#if defined D_INO_IN_DIRENT
+	  internal[result->size].inode = dp->d_ino;
+	  internal[result->size].flags |= SavedirHaveInode;
 #endif
 	  internal[result->size].buffer_offset = namebuf_used;
 
@@ -195,6 +256,9 @@ xsavedir (const char *dir, int flags)
 	  namebuf_used += entry_size;
 	}
     }
+  save_errno = (dp == NULL) ? errno : 0;
+  if (dp == NULL)
+    stream->at_end = true;
 
   result->buffer = xextendbuf (result->buffer, namebuf_used+1, &namebuf_allocated);
   result->buffer[namebuf_used] = '\0';
@@ -211,15 +275,16 @@ xsavedir (const char *dir, int flags)
 	     result->size, sizeof (*result->entries),
 	     savedir_cmp);
     }
+  else if (flags & SavedirSortInode)
+    {
+      qsort (result->entries,
+	     result->size, sizeof (*result->entries),
+	     savedir_inode_cmp);
+    }
 
-
-  save_errno = errno;
-  if (CLOSEDIR (dirp) != 0)
-    save_errno = errno;
   if (save_errno != 0)
     {
-      free (result->buffer);
-      free (result);
+      free_dirinfo (result);
       errno = save_errno;
       return NULL;
     }
@@ -227,6 +292,31 @@ xsavedir (const char *dir, int flags)
   return result;
 }
 
+
+struct savedir_dirinfo *
+xsavedir (const char *dir, int flags)
+{
+  struct savedir_stream *stream;
+  struct savedir_dirinfo *result;
+  int save_errno;
+
+  stream = savedir_open (dir);
+  if (stream == NULL)
+    return NULL;
+
+  result = xsavedir_next (stream, flags, SIZE_MAX);
+  save_errno = errno;
+  if (savedir_close (stream) != 0)
+    {
+      save_errno = errno;
+      if (result)
+	free_dirinfo (result);
+      result = NULL;
+    }
+  errno = save_errno;
+  return result;
+}
+
 void free_dirinfo (struct savedir_dirinfo *p)
 {
   free (p->entries);
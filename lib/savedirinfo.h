@@ -26,14 +26,20 @@
 
 typedef enum tagSaveDirControlFlags
   {
-    SavedirSort = 1
+    SavedirSort = 1,
+    /* Order the entries by inode number.  On many file systems, it is
+     * much faster to stat files in this order.  If SavedirSort is also
+     * given, it takes precedence.
+     */
+    SavedirSortInode = 2
   }
 SaveDirControlFlags;
 
 
 typedef enum tagSaveDirDataFlags
   {
-    SavedirHaveFileType = 1
+    SavedirHaveFileType = 1,
+    SavedirHaveInode = 2
   }
 SaveDirDataFlags;
 
@@ -46,6 +52,7 @@ struct savedir_direntry
   int      flags;		/* from SaveDirDataFlags */
   char     *name;		/* the name of the directory entry */
   mode_t   type_info;		/* the type (or zero if unknown) */
+  ino_t    inode;		/* the inode number (or zero if unknown) */
 };
 
 struct savedir_dirinfo
@@ -70,4 +77,18 @@ char *savedirinfo (const char *dir, struct savedir_extrainfo **extra);
 struct savedir_dirinfo * xsavedir(const char *dir, int flags);
 void free_dirinfo(struct savedir_dirinfo *p);
 
+/* To read a very large directory without holding all of its entries
+ * in memory at once, open it with savedir_open() and then call
+ * xsavedir_next() repeatedly; each call returns (sorted according to
+ * FLAGS) at most MAX_ENTRIES of the entries not yet returned.  The
+ * result is NULL on error, and has no entries once the end of the
+ * directory has been reached.
+ */
+struct savedir_stream;
+struct savedir_stream *savedir_open (const char *dir);
+struct savedir_dirinfo *xsavedir_next (struct savedir_stream *stream,
+				       int flags, size_t max_entries);
+bool savedir_at_end (const struct savedir_stream *stream);
+int savedir_close (struct savedir_stream *stream);
+
 #endif
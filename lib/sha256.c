@@ -0,0 +1,166 @@
+/* sha256.c -- compute SHA-256 message digests.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* This is a straightforward implementation of SHA-256 as described in
+ * FIPS 180-2, for find's %x directive.  It gives the same digests as
+ * sha256sum.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "sha256.h"
+
+static const uint32_t initial_hash[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+static const uint32_t round_constants[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Hash the 64-byte block P into the state H. */
+static void
+sha256_block (uint32_t h[8], const unsigned char *p)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, k, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; ++i, p += 4)
+    w[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+      | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+  for (; i < 64; ++i)
+    {
+      uint32_t s0 = ROTR (w[i - 15], 7) ^ ROTR (w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROTR (w[i - 2], 17) ^ ROTR (w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3];
+  e = h[4]; f = h[5]; g = h[6]; k = h[7];
+  for (i = 0; i < 64; ++i)
+    {
+      t1 = k + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25))
+	+ ((e & f) ^ (~e & g)) + round_constants[i] + w[i];
+      t2 = (ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22))
+	+ ((a & b) ^ (a & c) ^ (b & c));
+      k = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+  h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void
+sha256_start (struct sha256_state *s)
+{
+  memcpy (s->h, initial_hash, sizeof s->h);
+  s->length = 0u;
+  s->used = 0u;
+}
+
+/* Add the LEN bytes at DATA to the message. */
+void
+sha256_add (struct sha256_state *s, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  s->length += len;
+  if (s->used)
+    {
+      size_t n = sizeof s->block - s->used;
+      if (n > len)
+	n = len;
+      memcpy (s->block + s->used, p, n);
+      s->used += n;
+      p += n;
+      len -= n;
+      if (s->used < sizeof s->block)
+	return;
+      sha256_block (s->h, s->block);
+      s->used = 0u;
+    }
+  for (; len >= sizeof s->block; p += sizeof s->block, len -= sizeof s->block)
+    sha256_block (s->h, p);
+  memcpy (s->block, p, len);
+  s->used = len;
+}
+
+/* Finish the message and store its digest in DIGEST. */
+void
+sha256_end (struct sha256_state *s, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+  uint64_t bits = s->length * 8u;
+  int i;
+
+  s->block[s->used++] = 0x80;
+  if (s->used > sizeof s->block - 8u)
+    {
+      memset (s->block + s->used, 0, sizeof s->block - s->used);
+      sha256_block (s->h, s->block);
+      s->used = 0u;
+    }
+  memset (s->block + s->used, 0, sizeof s->block - 8u - s->used);
+  for (i = 0; i < 8; ++i)
+    s->block[sizeof s->block - 1u - i] = (unsigned char) (bits >> (8 * i));
+  sha256_block (s->h, s->block);
+
+  for (i = 0; i < 8; ++i)
+    {
+      digest[4 * i] = (unsigned char) (s->h[i] >> 24);
+      digest[4 * i + 1] = (unsigned char) (s->h[i] >> 16);
+      digest[4 * i + 2] = (unsigned char) (s->h[i] >> 8);
+      digest[4 * i + 3] = (unsigned char) s->h[i];
+    }
+}
+
+/* Write DIGEST in hexadecimal to HEX, which is not NUL-terminated. */
+void
+sha256_hex (const unsigned char digest[SHA256_DIGEST_SIZE],
+	    char hex[SHA256_HEX_SIZE])
+{
+  static const char digits[] = "0123456789abcdef";
+  int i;
+
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    {
+      hex[2 * i] = digits[digest[i] >> 4];
+      hex[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+}
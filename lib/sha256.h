@@ -0,0 +1,44 @@
+/* sha256.h -- compute SHA-256 message digests.
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHA256_H
+#define SHA256_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum
+  {
+    SHA256_DIGEST_SIZE = 32,	/* bytes */
+    SHA256_HEX_SIZE = 2 * SHA256_DIGEST_SIZE /* characters, without a NUL */
+  };
+
+struct sha256_state
+{
+  uint32_t h[8];
+  uint64_t length;		/* bytes hashed so far */
+  unsigned char block[64];	/* partial block */
+  size_t used;			/* bytes in block */
+};
+
+void sha256_start (struct sha256_state *s);
+void sha256_add (struct sha256_state *s, const void *data, size_t len);
+void sha256_end (struct sha256_state *s, unsigned char digest[SHA256_DIGEST_SIZE]);
+void sha256_hex (const unsigned char digest[SHA256_DIGEST_SIZE],
+		 char hex[SHA256_HEX_SIZE]);
+
+#endif
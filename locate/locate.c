@@ -128,6 +128,7 @@
 #include "printquoted.h"
 #include "regextype.h"
 #include "findutils-version.h"
+#include "asciicase.h"
 
 /* Note that this evaluates Ch many times.  */
 #ifdef _LIBC
@@ -777,6 +778,49 @@ visit_substring_match_casefold_narrow (struct process_data *procdata, void *cont
 }
 
 
+/* A pattern for locate -i which is plain ASCII, in a locale where
+ * folding ASCII letters is enough to compare it with ASCII names.
+ */
+struct casefold_substring
+{
+  const char *pattern;
+  char *folded;			/* the pattern in lower case */
+  size_t len;
+  bool any_name;		/* folding ASCII is enough for any name */
+  visitfunc fallback;		/* the matcher for other names */
+};
+
+static struct casefold_substring *
+new_casefold_substring (const char *pattern, enum ascii_fold_scope scope,
+			visitfunc fallback)
+{
+  struct casefold_substring *m = xmalloc (sizeof *m);
+
+  m->pattern = pattern;
+  m->folded = xstrdup (pattern);
+  ascii_fold (m->folded);
+  m->len = strlen (pattern);
+  m->any_name = (ASCII_FOLD_ALL == scope);
+  m->fallback = fallback;
+  return m;
+}
+
+static int
+visit_substring_match_casefold_ascii (struct process_data *procdata, void *context)
+{
+  const struct casefold_substring *m = context;
+  const char *name = procdata->munged_filename;
+  size_t n = strlen (name);
+
+  if (!m->any_name && !ascii_only (name, n))
+    return (m->fallback) (procdata, (void *) m->pattern);
+  if (NULL != ascii_fold_search (name, n, m->folded, m->len))
+    return VISIT_ACCEPTED;
+  else
+    return VISIT_REJECTED;
+}
+
+
 static int
 visit_globmatch_nofold (struct process_data *procdata, void *context)
 {
@@ -1253,6 +1297,7 @@ search_one_database (int argc,
 	   * James Youngman <jay@gnu.org>
 	   */
 	  visitfunc matcher;
+	  enum ascii_fold_scope scope;
 	  if (1 == MB_CUR_MAX)
 	    {
 	      /* As an optimisation, use a strstr () matcher if we are
@@ -1271,7 +1316,17 @@ search_one_database (int argc,
 		visit_substring_match_casefold_wide  :
 		visit_substring_match_nocasefold_wide;
 	    }
-	  add_visitor (matcher, pathpart);
+
+	  /* Plain ASCII patterns can usually be matched without going
+	   * through the locale's case tables.
+	   */
+	  scope = ignore_case ? ascii_fold_scope () : ASCII_FOLD_NONE;
+	  if (ASCII_FOLD_NONE != scope
+	      && ascii_only (pathpart, strlen (pathpart)))
+	    add_visitor (visit_substring_match_casefold_ascii,
+			 new_casefold_substring (pathpart, scope, matcher));
+	  else
+	    add_visitor (matcher, pathpart);
 	}
     }
 